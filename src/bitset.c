@@ -0,0 +1,118 @@
+#include "bitset.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define WORD_BITS   ((int)(8 * sizeof(unsigned int)))
+
+bitset_t *create_bitset(int n_bits)
+{
+    bitset_t *set = malloc(sizeof(bitset_t));
+    assert(set);
+    set->n_bits = n_bits;
+    set->n_words = (n_bits + WORD_BITS - 1) / WORD_BITS;
+    set->words = calloc(set->n_words ? set->n_words : 1, sizeof(unsigned int));
+    assert(set->words);
+    return set;
+}
+
+void destroy_bitset(bitset_t *set)
+{
+    if (!set)
+        return;
+    free(set->words);
+    free(set);
+}
+
+void bitset_add(bitset_t *set, int i)
+{
+    assert(i >= 0 && i < set->n_bits);
+    set->words[i / WORD_BITS] |= 1u << (i % WORD_BITS);
+}
+
+void bitset_remove(bitset_t *set, int i)
+{
+    assert(i >= 0 && i < set->n_bits);
+    set->words[i / WORD_BITS] &= ~(1u << (i % WORD_BITS));
+}
+
+int bitset_contains(bitset_t *set, int i)
+{
+    assert(i >= 0 && i < set->n_bits);
+    return (set->words[i / WORD_BITS] >> (i % WORD_BITS)) & 1u;
+}
+
+int bitset_count(bitset_t *set)
+{
+    int count = 0;
+    for (int i = 0; i < set->n_words; ++i)
+        for (unsigned int word = set->words[i]; word; word &= word - 1)
+            count++;
+    return count;
+}
+
+void bitset_fill(bitset_t *set)
+{
+    if (set->n_words == 0)
+        return;
+    memset(set->words, 0xff, set->n_words * sizeof(unsigned int));
+    /* Keep the bits beyond 'n_bits' clear so that 'bitset_count'
+     * and 'bitset_equal' are exact. */
+    int rest = set->n_bits % WORD_BITS;
+    if (rest)
+        set->words[set->n_words - 1] = (1u << rest) - 1;
+}
+
+void bitset_clear(bitset_t *set)
+{
+    memset(set->words, 0, set->n_words * sizeof(unsigned int));
+}
+
+void bitset_copy(bitset_t *dst, bitset_t *src)
+{
+    assert(dst->n_bits == src->n_bits);
+    memcpy(dst->words, src->words, src->n_words * sizeof(unsigned int));
+}
+
+int bitset_equal(bitset_t *lhs, bitset_t *rhs)
+{
+    assert(lhs->n_bits == rhs->n_bits);
+    return !memcmp(lhs->words, rhs->words, lhs->n_words * sizeof(unsigned int));
+}
+
+int bitset_union(bitset_t *dst, bitset_t *src)
+{
+    assert(dst->n_bits == src->n_bits);
+    int changed = 0;
+    for (int i = 0; i < dst->n_words; ++i) {
+        unsigned int word = dst->words[i] | src->words[i];
+        changed |= (word != dst->words[i]);
+        dst->words[i] = word;
+    }
+    return changed;
+}
+
+int bitset_intersect(bitset_t *dst, bitset_t *src)
+{
+    assert(dst->n_bits == src->n_bits);
+    int changed = 0;
+    for (int i = 0; i < dst->n_words; ++i) {
+        unsigned int word = dst->words[i] & src->words[i];
+        changed |= (word != dst->words[i]);
+        dst->words[i] = word;
+    }
+    return changed;
+}
+
+int bitset_subtract(bitset_t *dst, bitset_t *src)
+{
+    assert(dst->n_bits == src->n_bits);
+    int changed = 0;
+    for (int i = 0; i < dst->n_words; ++i) {
+        unsigned int word = dst->words[i] & ~src->words[i];
+        changed |= (word != dst->words[i]);
+        dst->words[i] = word;
+    }
+    return changed;
+}
@@ -0,0 +1,29 @@
+#ifndef _BITSET_H
+#define _BITSET_H
+
+typedef struct bitset {
+    int n_bits;
+    int n_words;
+    unsigned int *words;
+} bitset_t;
+
+bitset_t *create_bitset(int n_bits);
+void destroy_bitset(bitset_t *set);
+
+void bitset_add(bitset_t *set, int i);
+void bitset_remove(bitset_t *set, int i);
+int bitset_contains(bitset_t *set, int i);
+int bitset_count(bitset_t *set);
+
+void bitset_fill(bitset_t *set);
+void bitset_clear(bitset_t *set);
+void bitset_copy(bitset_t *dst, bitset_t *src);
+int bitset_equal(bitset_t *lhs, bitset_t *rhs);
+
+/* These operations store the result in 'dst' and return whether
+ * 'dst' changed. */
+int bitset_union(bitset_t *dst, bitset_t *src);
+int bitset_intersect(bitset_t *dst, bitset_t *src);
+int bitset_subtract(bitset_t *dst, bitset_t *src);
+
+#endif
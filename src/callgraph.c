@@ -0,0 +1,190 @@
+#include "callgraph.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* ------------------------------------ *
+ *              call graph              *
+ * ------------------------------------ */
+
+cgnode_t *create_cgnode(int id, icfunc_t *func)
+{
+    cgnode_t *node = malloc(sizeof(cgnode_t));
+    assert(node);
+    node->id = id;
+    node->func = func;
+    node->n_sites = 0;
+    for (iclistnode_t *cur = func->body.front; cur != NULL; cur = cur->next)
+        if (cur->ic->kind == IC_CALL)
+            node->n_sites++;
+    node->sites = malloc((node->n_sites ? node->n_sites : 1) * sizeof(iclistnode_t *));
+    node->callees = malloc((node->n_sites ? node->n_sites : 1) * sizeof(cgnode_t *));
+    assert(node->sites && node->callees);
+    node->n_callers = 0;
+    node->scc = -1;
+    node->is_recursive = 0;
+    return node;
+}
+
+void destroy_cgnode(cgnode_t *node)
+{
+    free(node->sites);
+    free(node->callees);
+    free(node);
+}
+
+/* Tarjan's algorithm, which finishes an SCC only after all SCCs reachable
+ * from it, so the SCCs come out bottom-up. */
+static struct {
+    callgraph_t *cg;
+    int time;
+    int *index;
+    int *lowlink;
+    int n_stack;
+    cgnode_t **stack;
+    char *on_stack;
+    int n_done;
+} tarjan;
+
+void tarjan_visit(cgnode_t *node)
+{
+    int v = node->id;
+    tarjan.index[v] = tarjan.lowlink[v] = tarjan.time++;
+    tarjan.stack[tarjan.n_stack++] = node;
+    tarjan.on_stack[v] = 1;
+
+    for (int i = 0; i < node->n_sites; ++i) {
+        cgnode_t *callee = node->callees[i];
+        if (!callee)
+            continue;
+        int w = callee->id;
+        if (tarjan.index[w] == -1) {
+            tarjan_visit(callee);
+            if (tarjan.lowlink[w] < tarjan.lowlink[v])
+                tarjan.lowlink[v] = tarjan.lowlink[w];
+        }
+        else if (tarjan.on_stack[w] && tarjan.index[w] < tarjan.lowlink[v]) {
+            tarjan.lowlink[v] = tarjan.index[w];
+        }
+    }
+
+    if (tarjan.lowlink[v] != tarjan.index[v])
+        return;
+    callgraph_t *cg = tarjan.cg;
+    int scc = cg->n_sccs++, first = tarjan.n_done;
+    cgnode_t *member;
+    do {
+        member = tarjan.stack[--tarjan.n_stack];
+        tarjan.on_stack[member->id] = 0;
+        member->scc = scc;
+        cg->bottom_up[tarjan.n_done++] = member;
+    } while (member != node);
+
+    int is_recursive = (tarjan.n_done - first > 1);
+    for (int i = 0; i < node->n_sites; ++i)
+        if (node->callees[i] == node)
+            is_recursive = 1;
+    for (int i = first; i < tarjan.n_done; ++i)
+        cg->bottom_up[i]->is_recursive = is_recursive;
+}
+
+void callgraph_find_sccs(callgraph_t *cg)
+{
+    int n = cg->n_nodes;
+    tarjan.cg = cg;
+    tarjan.time = 0;
+    tarjan.index = malloc((n ? n : 1) * sizeof(int));
+    tarjan.lowlink = malloc((n ? n : 1) * sizeof(int));
+    tarjan.stack = malloc((n ? n : 1) * sizeof(cgnode_t *));
+    tarjan.on_stack = calloc(n ? n : 1, sizeof(char));
+    assert(tarjan.index && tarjan.lowlink && tarjan.stack && tarjan.on_stack);
+    tarjan.n_stack = 0;
+    tarjan.n_done = 0;
+    for (int i = 0; i < n; ++i)
+        tarjan.index[i] = -1;
+
+    for (int i = 0; i < n; ++i)
+        if (tarjan.index[i] == -1)
+            tarjan_visit(cg->nodes[i]);
+    assert(tarjan.n_done == n);
+
+    free(tarjan.index);
+    free(tarjan.lowlink);
+    free(tarjan.stack);
+    free(tarjan.on_stack);
+}
+
+callgraph_t *create_callgraph(icprog_t *prog)
+{
+    callgraph_t *cg = malloc(sizeof(callgraph_t));
+    assert(cg);
+    cg->prog = prog;
+    cg->n_nodes = prog->size;
+    cg->nodes = malloc((prog->size ? prog->size : 1) * sizeof(cgnode_t *));
+    cg->bottom_up = malloc((prog->size ? prog->size : 1) * sizeof(cgnode_t *));
+    assert(cg->nodes && cg->bottom_up);
+    cg->n_sccs = 0;
+    for (int i = 0; i < prog->size; ++i)
+        cg->nodes[i] = create_cgnode(i, prog->funcs[i]);
+
+    for (int i = 0; i < cg->n_nodes; ++i) {
+        cgnode_t *node = cg->nodes[i];
+        int k = 0;
+        for (iclistnode_t *cur = node->func->body.front; cur != NULL; cur = cur->next) {
+            if (cur->ic->kind != IC_CALL)
+                continue;
+            cgnode_t *callee = callgraph_find(cg, ((ic_call_t *)cur->ic)->fname);
+            node->sites[k] = cur;
+            node->callees[k++] = callee;
+            if (callee)
+                callee->n_callers++;
+        }
+    }
+
+    callgraph_find_sccs(cg);
+    return cg;
+}
+
+void destroy_callgraph(callgraph_t *cg)
+{
+    for (int i = 0; i < cg->n_nodes; ++i)
+        destroy_cgnode(cg->nodes[i]);
+    free(cg->nodes);
+    free(cg->bottom_up);
+    free(cg);
+}
+
+cgnode_t *callgraph_find(callgraph_t *cg, const char *fname)
+{
+    for (int i = 0; i < cg->n_nodes; ++i)
+        if (!strcmp(cg->nodes[i]->func->fname, fname))
+            return cg->nodes[i];
+    return NULL;
+}
+
+int icfunc_size(icfunc_t *func)
+{
+    int size = 0;
+    for (iclistnode_t *cur = func->body.front; cur != NULL; cur = cur->next) {
+        int kind = cur->ic->kind;
+        if (kind != IC_FUNCDEF && kind != IC_LABEL && kind != IC_PARAM &&
+            kind != IC_DEC)
+            size++;
+    }
+    return size;
+}
+
+void fprint_callgraph(FILE *fp, callgraph_t *cg)
+{
+    fprintf(fp, "Call graph:\n");
+    for (int i = 0; i < cg->n_nodes; ++i) {
+        cgnode_t *node = cg->bottom_up[i];
+        fprintf(fp, "  %s: scc %d%s, %d callers, calls", node->func->fname,
+                node->scc, (node->is_recursive ? " (recursive)" : ""),
+                node->n_callers);
+        for (int j = 0; j < node->n_sites; ++j)
+            fprintf(fp, " %s", ((ic_call_t *)node->sites[j]->ic)->fname);
+        fprintf(fp, "\n");
+    }
+}
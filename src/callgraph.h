@@ -0,0 +1,53 @@
+#ifndef _CALLGRAPH_H
+#define _CALLGRAPH_H
+
+#include "optim.h"
+
+#include <stdio.h>
+
+/* ------------------------------------ *
+ *              call graph              *
+ * ------------------------------------ */
+
+typedef struct cgnode {
+    int id;
+    icfunc_t *func;
+    /* The IC_CALL nodes in the body and the function each one calls. */
+    int n_sites;
+    iclistnode_t **sites;
+    struct cgnode **callees;
+    /* The number of call sites calling the function in the program. */
+    int n_callers;
+    /* The strongly connected component of the function. It is recursive
+     * if it has several functions or a function calling itself. */
+    int scc;
+    int is_recursive;
+} cgnode_t;
+
+/* The call graph is a view of the program. It should be rebuilt after
+ * calls are added or removed. */
+typedef struct callgraph {
+    icprog_t *prog;
+    /* Nodes are in the order of the functions of the program. */
+    int n_nodes;
+    cgnode_t **nodes;
+    /* The functions ordered by their SCCs, so that callees come before
+     * their callers, except for calls inside the same SCC. The functions
+     * of an SCC are adjacent. */
+    int n_sccs;
+    cgnode_t **bottom_up;
+} callgraph_t;
+
+callgraph_t *create_callgraph(icprog_t *prog);
+void destroy_callgraph(callgraph_t *cg);
+
+/* Return the node of the function named 'fname', or NULL. */
+cgnode_t *callgraph_find(callgraph_t *cg, const char *fname);
+
+/* Return the size of the function counted in intercodes doing work, that
+ * is, not labels, parameters and declarations. */
+int icfunc_size(icfunc_t *func);
+
+void fprint_callgraph(FILE *fp, callgraph_t *cg);
+
+#endif
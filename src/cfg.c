@@ -0,0 +1,555 @@
+#include "cfg.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* ------------------------------------ *
+ *             basic block              *
+ * ------------------------------------ */
+
+block_t *create_block(int id, iclistnode_t *first)
+{
+    block_t *block = malloc(sizeof(block_t));
+    assert(block);
+    block->id = id;
+    block->first = block->last = first;
+    block->jump = block->fall = NULL;
+    block->n_succs = 0;
+    block->n_preds = 0;
+    block->preds = NULL;
+    return block;
+}
+
+void destroy_block(block_t *block)
+{
+    free(block->preds);
+    free(block);
+}
+
+int block_is_empty(block_t *block)
+{
+    block_foreach(node, block) {
+        int kind = node->ic->kind;
+        if (kind != IC_LABEL && kind != IC_FUNCDEF &&
+            kind != IC_PARAM && kind != IC_DEC)
+            return 0;
+    }
+    return 1;
+}
+
+void block_add_succ(block_t *block, block_t *succ)
+{
+    for (int i = 0; i < block->n_succs; ++i)
+        if (block->succs[i] == succ)
+            return;
+    assert(block->n_succs < 2);
+    block->succs[block->n_succs++] = succ;
+    succ->preds = realloc(succ->preds, (succ->n_preds + 1) * sizeof(block_t *));
+    assert(succ->preds);
+    succ->preds[succ->n_preds++] = block;
+}
+
+/* ------------------------------------ *
+ *         control flow graph           *
+ * ------------------------------------ */
+
+int is_block_leader(iclistnode_t *node)
+{
+    if (node->ic->kind == IC_LABEL)
+        return 1;
+    int kind = node->prev->ic->kind;
+    return kind == IC_GOTO || kind == IC_CONDGOTO || kind == IC_RETURN;
+}
+
+void cfg_build_blocks(cfg_t *cfg)
+{
+    int capacity = 16;
+    cfg->n_blocks = 0;
+    cfg->blocks = malloc(capacity * sizeof(block_t *));
+    assert(cfg->blocks);
+
+    block_t *block = NULL;
+    for (iclistnode_t *cur = cfg->func->body.front; cur; cur = cur->next) {
+        if (!block || is_block_leader(cur)) {
+            if (cfg->n_blocks == capacity) {
+                capacity *= 2;
+                cfg->blocks = realloc(cfg->blocks, capacity * sizeof(block_t *));
+                assert(cfg->blocks);
+            }
+            block = create_block(cfg->n_blocks, cur);
+            cfg->blocks[cfg->n_blocks++] = block;
+        }
+        block->last = cur;
+    }
+}
+
+void cfg_build_labels(cfg_t *cfg)
+{
+    int min = 0, max = -1;
+    for (int i = 0; i < cfg->n_blocks; ++i) {
+        intercode_t *ic = cfg->blocks[i]->first->ic;
+        if (ic->kind != IC_LABEL)
+            continue;
+        int labelid = ((ic_label_t *)ic)->labelid;
+        if (max < min || labelid < min)
+            min = labelid;
+        if (labelid > max)
+            max = labelid;
+    }
+
+    cfg->label_base = min;
+    cfg->n_labels = max - min + 1;
+    cfg->label_blocks = calloc(cfg->n_labels > 0 ? cfg->n_labels : 1,
+                               sizeof(block_t *));
+    assert(cfg->label_blocks);
+    for (int i = 0; i < cfg->n_blocks; ++i) {
+        intercode_t *ic = cfg->blocks[i]->first->ic;
+        if (ic->kind == IC_LABEL)
+            cfg->label_blocks[((ic_label_t *)ic)->labelid - min] = cfg->blocks[i];
+    }
+}
+
+void cfg_build_edges(cfg_t *cfg)
+{
+    for (int i = 0; i < cfg->n_blocks; ++i) {
+        block_t *block = cfg->blocks[i];
+        block_t *next = (i + 1 < cfg->n_blocks ? cfg->blocks[i + 1] : NULL);
+        intercode_t *ic = block->last->ic;
+
+        if (ic->kind == IC_GOTO) {
+            block->jump = cfg_label_block(cfg, ((ic_goto_t *)ic)->labelid);
+            assert(block->jump);
+        }
+        else if (ic->kind == IC_CONDGOTO) {
+            block->jump = cfg_label_block(cfg, ((ic_condgoto_t *)ic)->labelid);
+            assert(block->jump);
+            block->fall = next;
+        }
+        else if (ic->kind != IC_RETURN) {
+            block->fall = next;
+        }
+
+        if (block->jump)
+            block_add_succ(block, block->jump);
+        if (block->fall)
+            block_add_succ(block, block->fall);
+    }
+}
+
+void cfg_index_var(cfg_t *cfg, operand_t *op, int pass)
+{
+    if (op->kind != OPERAND_VAR && op->kind != OPERAND_ADDR)
+        return;
+
+    if (pass == 0) {
+        /* The first pass only finds the range of varids. */
+        if (cfg->n_varids == 0 || op->varid < cfg->var_base) {
+            int end = cfg->var_base + cfg->n_varids;
+            cfg->var_base = op->varid;
+            cfg->n_varids = (cfg->n_varids == 0 ? 1 : end - op->varid);
+        }
+        else if (op->varid >= cfg->var_base + cfg->n_varids) {
+            cfg->n_varids = op->varid - cfg->var_base + 1;
+        }
+        return;
+    }
+
+    int *index = &cfg->var_index[op->varid - cfg->var_base];
+    if (*index < 0) {
+        *index = cfg->n_vars;
+        cfg->varids[cfg->n_vars++] = op->varid;
+    }
+}
+
+void cfg_build_vars(cfg_t *cfg)
+{
+    cfg->var_base = 0;
+    cfg->n_varids = 0;
+    cfg->n_vars = 0;
+
+    for (int pass = 0; pass < 2; ++pass) {
+        for (iclistnode_t *cur = cfg->func->body.front; cur; cur = cur->next) {
+            intercode_t *ic = cur->ic;
+            operand_t *uses[2];
+            int n_uses = intercode_uses(ic, uses);
+            for (int i = 0; i < n_uses; ++i)
+                cfg_index_var(cfg, uses[i], pass);
+            operand_t *def = intercode_def(ic);
+            if (def)
+                cfg_index_var(cfg, def, pass);
+            if (ic->kind == IC_DEC)
+                cfg_index_var(cfg, &((ic_dec_t *)ic)->var, pass);
+            else if (ic->kind == IC_REF)
+                cfg_index_var(cfg, &((ic_ref_t *)ic)->rhs, pass);
+        }
+
+        if (pass == 0) {
+            int size = (cfg->n_varids > 0 ? cfg->n_varids : 1);
+            cfg->var_index = malloc(size * sizeof(int));
+            cfg->varids = malloc(size * sizeof(int));
+            assert(cfg->var_index && cfg->varids);
+            for (int i = 0; i < size; ++i)
+                cfg->var_index[i] = -1;
+        }
+    }
+}
+
+cfg_t *create_cfg(icfunc_t *func)
+{
+    assert(func->body.size > 0);
+    cfg_t *cfg = malloc(sizeof(cfg_t));
+    assert(cfg);
+    cfg->func = func;
+
+    cfg_build_blocks(cfg);
+    cfg_build_labels(cfg);
+    cfg_build_edges(cfg);
+    cfg_build_vars(cfg);
+    return cfg;
+}
+
+void destroy_cfg(cfg_t *cfg)
+{
+    for (int i = 0; i < cfg->n_blocks; ++i)
+        destroy_block(cfg->blocks[i]);
+    free(cfg->blocks);
+    free(cfg->label_blocks);
+    free(cfg->var_index);
+    free(cfg->varids);
+    free(cfg);
+}
+
+block_t *cfg_label_block(cfg_t *cfg, int labelid)
+{
+    int i = labelid - cfg->label_base;
+    if (i < 0 || i >= cfg->n_labels)
+        return NULL;
+    return cfg->label_blocks[i];
+}
+
+int cfg_var_index(cfg_t *cfg, operand_t *op)
+{
+    if (op->kind != OPERAND_VAR && op->kind != OPERAND_ADDR)
+        return -1;
+    int i = op->varid - cfg->var_base;
+    assert(i >= 0 && i < cfg->n_varids && cfg->var_index[i] >= 0);
+    return cfg->var_index[i];
+}
+
+block_t **cfg_reverse_postorder(cfg_t *cfg, int *n)
+{
+    block_t **order = malloc(cfg->n_blocks * sizeof(block_t *));
+    block_t **stack = malloc(cfg->n_blocks * sizeof(block_t *));
+    int *next_succ = calloc(cfg->n_blocks, sizeof(int));
+    char *visited = calloc(cfg->n_blocks, sizeof(char));
+    assert(order && stack && next_succ && visited);
+
+    /* Iterative DFS. Blocks are put at the back of 'order' when they
+     * finish, so 'order' is filled backward. */
+    int top = 0, count = 0;
+    stack[top++] = cfg->blocks[0];
+    visited[0] = 1;
+    while (top > 0) {
+        block_t *block = stack[top - 1];
+        if (next_succ[block->id] < block->n_succs) {
+            block_t *succ = block->succs[next_succ[block->id]++];
+            if (!visited[succ->id]) {
+                visited[succ->id] = 1;
+                stack[top++] = succ;
+            }
+        }
+        else {
+            order[cfg->n_blocks - 1 - count++] = block;
+            top--;
+        }
+    }
+
+    memmove(order, order + cfg->n_blocks - count, count * sizeof(block_t *));
+    free(stack);
+    free(next_succ);
+    free(visited);
+    *n = count;
+    return order;
+}
+
+/* ------------------------------------ *
+ *             dominators               *
+ * ------------------------------------ */
+
+/* A graph given in adjacency lists, so that dominators and
+ * post-dominators are computed by the same code. */
+typedef struct graph {
+    int n;
+    int *n_succs;
+    int **succs;
+    int *n_preds;
+    int **preds;
+} graph_t;
+
+graph_t *create_graph(int n)
+{
+    graph_t *g = malloc(sizeof(graph_t));
+    assert(g);
+    g->n = n;
+    g->n_succs = calloc(n, sizeof(int));
+    g->succs = calloc(n, sizeof(int *));
+    g->n_preds = calloc(n, sizeof(int));
+    g->preds = calloc(n, sizeof(int *));
+    assert(g->n_succs && g->succs && g->n_preds && g->preds);
+    return g;
+}
+
+void destroy_graph(graph_t *g)
+{
+    for (int i = 0; i < g->n; ++i) {
+        free(g->succs[i]);
+        free(g->preds[i]);
+    }
+    free(g->n_succs);
+    free(g->succs);
+    free(g->n_preds);
+    free(g->preds);
+    free(g);
+}
+
+void graph_add_edge(graph_t *g, int from, int to)
+{
+    g->succs[from] = realloc(g->succs[from], (g->n_succs[from] + 1) * sizeof(int));
+    g->preds[to] = realloc(g->preds[to], (g->n_preds[to] + 1) * sizeof(int));
+    assert(g->succs[from] && g->preds[to]);
+    g->succs[from][g->n_succs[from]++] = to;
+    g->preds[to][g->n_preds[to]++] = from;
+}
+
+/* Cooper, Harvey and Kennedy's iterative algorithm. */
+int *graph_idoms(graph_t *g, int root)
+{
+    int n = g->n;
+    int *postnum = malloc(n * sizeof(int));
+    int *order = malloc(n * sizeof(int));
+    int *stack = malloc(n * sizeof(int));
+    int *next_succ = calloc(n, sizeof(int));
+    int *idoms = malloc(n * sizeof(int));
+    assert(postnum && order && stack && next_succ && idoms);
+
+    for (int i = 0; i < n; ++i) {
+        postnum[i] = -1;
+        idoms[i] = -1;
+    }
+
+    /* 'order' lists the nodes in postorder. */
+    int top = 0, count = 0;
+    stack[top++] = root;
+    postnum[root] = -2;
+    while (top > 0) {
+        int v = stack[top - 1];
+        if (next_succ[v] < g->n_succs[v]) {
+            int w = g->succs[v][next_succ[v]++];
+            if (postnum[w] == -1) {
+                postnum[w] = -2;
+                stack[top++] = w;
+            }
+        }
+        else {
+            postnum[v] = count;
+            order[count++] = v;
+            top--;
+        }
+    }
+
+    idoms[root] = root;
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = count - 2; i >= 0; --i) {
+            int v = order[i];
+            int new_idom = -1;
+            for (int j = 0; j < g->n_preds[v]; ++j) {
+                int p = g->preds[v][j];
+                if (idoms[p] == -1)
+                    continue;
+                if (new_idom == -1) {
+                    new_idom = p;
+                    continue;
+                }
+                int a = p, b = new_idom;
+                while (a != b) {
+                    while (postnum[a] < postnum[b])
+                        a = idoms[a];
+                    while (postnum[b] < postnum[a])
+                        b = idoms[b];
+                }
+                new_idom = a;
+            }
+            if (idoms[v] != new_idom) {
+                idoms[v] = new_idom;
+                changed = 1;
+            }
+        }
+    }
+
+    free(postnum);
+    free(order);
+    free(stack);
+    free(next_succ);
+    return idoms;
+}
+
+int *cfg_idoms(cfg_t *cfg)
+{
+    graph_t *g = create_graph(cfg->n_blocks);
+    for (int i = 0; i < cfg->n_blocks; ++i) {
+        block_t *block = cfg->blocks[i];
+        for (int j = 0; j < block->n_succs; ++j)
+            graph_add_edge(g, i, block->succs[j]->id);
+    }
+    int *idoms = graph_idoms(g, 0);
+    destroy_graph(g);
+    return idoms;
+}
+
+int *cfg_ipdoms(cfg_t *cfg)
+{
+    int exit = cfg->n_blocks;
+    graph_t *g = create_graph(cfg->n_blocks + 1);
+    for (int i = 0; i < cfg->n_blocks; ++i) {
+        block_t *block = cfg->blocks[i];
+        for (int j = 0; j < block->n_succs; ++j)
+            graph_add_edge(g, block->succs[j]->id, i);
+        if (block->n_succs == 0)
+            graph_add_edge(g, exit, i);
+    }
+    int *ipdoms = graph_idoms(g, exit);
+    destroy_graph(g);
+    return ipdoms;
+}
+
+int idoms_dominate(int *idoms, int a, int b)
+{
+    while (b != -1) {
+        if (a == b)
+            return 1;
+        if (idoms[b] == b)
+            return 0;
+        b = idoms[b];
+    }
+    return 0;
+}
+
+/* ------------------------------------ *
+ *              liveness                *
+ * ------------------------------------ */
+
+void liveness_transfer(cfg_t *cfg, intercode_t *ic, bitset_t *live)
+{
+    operand_t *def = intercode_def(ic);
+    if (def)
+        bitset_remove(live, cfg_var_index(cfg, def));
+    operand_t *uses[2];
+    int n_uses = intercode_uses(ic, uses);
+    for (int i = 0; i < n_uses; ++i)
+        if (!is_const_operand(uses[i]))
+            bitset_add(live, cfg_var_index(cfg, uses[i]));
+}
+
+liveness_t *create_liveness(cfg_t *cfg)
+{
+    liveness_t *live = malloc(sizeof(liveness_t));
+    assert(live);
+    live->n_blocks = cfg->n_blocks;
+    live->in = malloc(cfg->n_blocks * sizeof(bitset_t *));
+    live->out = malloc(cfg->n_blocks * sizeof(bitset_t *));
+    assert(live->in && live->out);
+    for (int i = 0; i < cfg->n_blocks; ++i) {
+        live->in[i] = create_bitset(cfg->n_vars);
+        live->out[i] = create_bitset(cfg->n_vars);
+    }
+
+    bitset_t *state = create_bitset(cfg->n_vars);
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = cfg->n_blocks - 1; i >= 0; --i) {
+            block_t *block = cfg->blocks[i];
+            for (int j = 0; j < block->n_succs; ++j)
+                bitset_union(live->out[i], live->in[block->succs[j]->id]);
+            bitset_copy(state, live->out[i]);
+            for (iclistnode_t *cur = block->last; cur != block->first->prev; cur = cur->prev)
+                liveness_transfer(cfg, cur->ic, state);
+            changed |= bitset_union(live->in[i], state);
+        }
+    }
+    destroy_bitset(state);
+    return live;
+}
+
+void destroy_liveness(liveness_t *live)
+{
+    for (int i = 0; i < live->n_blocks; ++i) {
+        destroy_bitset(live->in[i]);
+        destroy_bitset(live->out[i]);
+    }
+    free(live->in);
+    free(live->out);
+    free(live);
+}
+
+/* ------------------------------------ *
+ *           transformation             *
+ * ------------------------------------ */
+
+int cfg_remove_block(cfg_t *cfg, block_t *block)
+{
+    iclist_t *body = &cfg->func->body;
+    iclistnode_t *end = block->last->next;
+    int changed = 0;
+
+    for (iclistnode_t *cur = block->first, *next; cur != end; cur = next) {
+        next = cur->next;
+        /* Declarations only allocate memory, keep them. */
+        if (cur->ic->kind == IC_DEC)
+            continue;
+        iclist_remove(body, cur);
+        changed = 1;
+    }
+    return changed;
+}
+
+int cfg_remove_unreachable(cfg_t *cfg)
+{
+    int n;
+    block_t **order = cfg_reverse_postorder(cfg, &n);
+    char *reachable = calloc(cfg->n_blocks, sizeof(char));
+    assert(reachable);
+    for (int i = 0; i < n; ++i)
+        reachable[order[i]->id] = 1;
+    free(order);
+
+    int changed = 0;
+    for (int i = 0; i < cfg->n_blocks; ++i)
+        if (!reachable[i])
+            changed |= cfg_remove_block(cfg, cfg->blocks[i]);
+    free(reachable);
+    return changed;
+}
+
+void fprint_cfg(FILE *fp, cfg_t *cfg)
+{
+    fprintf(fp, "CFG of %s:\n", cfg->func->fname);
+    for (int i = 0; i < cfg->n_blocks; ++i) {
+        block_t *block = cfg->blocks[i];
+        fprintf(fp, "B%d: preds", block->id);
+        for (int j = 0; j < block->n_preds; ++j)
+            fprintf(fp, " B%d", block->preds[j]->id);
+        fprintf(fp, ", succs");
+        for (int j = 0; j < block->n_succs; ++j)
+            fprintf(fp, " B%d", block->succs[j]->id);
+        fprintf(fp, "\n");
+        block_foreach(node, block) {
+            fprintf(fp, "  ");
+            fprint_intercode(fp, node->ic);
+            fprintf(fp, "\n");
+        }
+    }
+}
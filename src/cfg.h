@@ -0,0 +1,102 @@
+#ifndef _CFG_H
+#define _CFG_H
+
+#include "optim.h"
+#include "bitset.h"
+
+#include <stdio.h>
+
+/* ------------------------------------ *
+ *             basic block              *
+ * ------------------------------------ */
+
+typedef struct block {
+    int id;
+    /* The intercodes of the block are [first, last] in the body. */
+    iclistnode_t *first;
+    iclistnode_t *last;
+    /* 'jump' is the target of the GOTO or CONDGOTO ending the block,
+     * and 'fall' is the block that control falls through to. */
+    struct block *jump;
+    struct block *fall;
+    int n_succs;
+    struct block *succs[2];
+    int n_preds;
+    struct block **preds;
+} block_t;
+
+/* Iterate the intercodes of a block. The block must not be modified. */
+#define block_foreach(node, block) \
+    for (iclistnode_t *node = (block)->first; \
+         node != (block)->last->next; node = node->next)
+
+int block_is_empty(block_t *block);
+
+/* ------------------------------------ *
+ *         control flow graph           *
+ * ------------------------------------ */
+
+typedef struct cfg {
+    icfunc_t *func;
+    /* Blocks are in the order of intercodes, and blocks[0] is the entry
+     * which begins with the IC_FUNCDEF. */
+    int n_blocks;
+    block_t **blocks;
+    /* Map from labelid to the block beginning with the label. */
+    int label_base;
+    int n_labels;
+    block_t **label_blocks;
+    /* Variables used in the function are numbered from 0 to n_vars - 1,
+     * so that analyses can use dense arrays. */
+    int n_vars;
+    int *varids;
+    int var_base;
+    int n_varids;
+    int *var_index;
+} cfg_t;
+
+/* The CFG is a view of the function. It should be rebuilt after the
+ * intercodes are modified. */
+cfg_t *create_cfg(icfunc_t *func);
+void destroy_cfg(cfg_t *cfg);
+
+block_t *cfg_label_block(cfg_t *cfg, int labelid);
+/* Return the dense index of a variable, or -1 if it is a constant. */
+int cfg_var_index(cfg_t *cfg, operand_t *op);
+
+/* Return the blocks reachable from the entry in reverse postorder, and
+ * store the number of them in 'n'. The array should be freed. */
+block_t **cfg_reverse_postorder(cfg_t *cfg, int *n);
+
+/* Return the immediate dominator of every block, indexed by block id.
+ * The entry is its own dominator, and unreachable blocks get -1. */
+int *cfg_idoms(cfg_t *cfg);
+/* Return the immediate post-dominator of every block. A virtual exit
+ * numbered n_blocks post-dominates the blocks leaving the function, and
+ * blocks never reaching the exit get -1. The array has n_blocks + 1
+ * entries. */
+int *cfg_ipdoms(cfg_t *cfg);
+/* Whether 'a' (post-)dominates 'b' according to 'idoms'. */
+int idoms_dominate(int *idoms, int a, int b);
+
+/* Variables live at the entry and the exit of every block, as bitsets
+ * of dense variable indices. */
+typedef struct liveness {
+    int n_blocks;
+    bitset_t **in;
+    bitset_t **out;
+} liveness_t;
+
+liveness_t *create_liveness(cfg_t *cfg);
+void destroy_liveness(liveness_t *live);
+/* Update 'live' from after 'ic' to before it. */
+void liveness_transfer(cfg_t *cfg, intercode_t *ic, bitset_t *live);
+
+/* Remove the intercodes of a block except declarations, or those of
+ * all blocks unreachable from the entry. The CFG is invalid after that. */
+int cfg_remove_block(cfg_t *cfg, block_t *block);
+int cfg_remove_unreachable(cfg_t *cfg);
+
+void fprint_cfg(FILE *fp, cfg_t *cfg);
+
+#endif
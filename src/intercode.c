@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
 
 /* ------------------------------------ *
  *              operator                *
@@ -31,6 +32,16 @@ int alloc_labelid()
     return free_labelid++;
 }
 
+int varid_bound()
+{
+    return free_varid;
+}
+
+int labelid_bound()
+{
+    return free_labelid;
+}
+
 void init_var_operand(operand_t *op, int varid)
 {
     assert(op);
@@ -167,6 +178,38 @@ int complement_rel_icop(int icop)
     return ICOP_EQ;
 }
 
+int fold_arith_icop(int icop, int lhs, int rhs, int *result)
+{
+    /* Compute in unsigned so that overflow wraps around like mips. */
+    unsigned int ulhs = lhs, urhs = rhs;
+    switch (icop) {
+    case ICOP_ADD: *result = (int)(ulhs + urhs); return 0;
+    case ICOP_SUB: *result = (int)(ulhs - urhs); return 0;
+    case ICOP_MUL: *result = (int)(ulhs * urhs); return 0;
+    case ICOP_DIV:
+        if (rhs == 0 || (lhs == INT_MIN && rhs == -1))
+            return -1;
+        *result = lhs / rhs;
+        return 0;
+    default: assert(0); break;
+    }
+    return -1;
+}
+
+int eval_rel_icop(int icop, int lhs, int rhs)
+{
+    switch (icop) {
+    case ICOP_EQ:  return lhs == rhs;
+    case ICOP_NEQ: return lhs != rhs;
+    case ICOP_L:   return lhs < rhs;
+    case ICOP_LE:  return lhs <= rhs;
+    case ICOP_G:   return lhs > rhs;
+    case ICOP_GE:  return lhs >= rhs;
+    default: assert(0); break;
+    }
+    return 0;
+}
+
 intercode_t *create_ic_label(int labelid)
 {
     ic_label_t *ic = malloc(sizeof(ic_label_t));
@@ -342,6 +385,44 @@ intercode_t *create_ic_write(operand_t *var)
     return (intercode_t *)ic;
 }
 
+void destroy_intercode(intercode_t *ic)
+{
+    free(ic);
+}
+
+size_t sizeof_intercode(intercode_t *ic)
+{
+    switch (ic->kind) {
+    case IC_LABEL:       return sizeof(ic_label_t);
+    case IC_FUNCDEF:     return sizeof(ic_funcdef_t);
+    case IC_ASSIGN:      return sizeof(ic_assign_t);
+    case IC_ARITHBOP:    return sizeof(ic_arithbop_t);
+    case IC_REF:         return sizeof(ic_ref_t);
+    case IC_DREF:        return sizeof(ic_dref_t);
+    case IC_DREFASSIGN:  return sizeof(ic_drefassign_t);
+    case IC_GOTO:        return sizeof(ic_goto_t);
+    case IC_CONDGOTO:    return sizeof(ic_condgoto_t);
+    case IC_RETURN:      return sizeof(ic_return_t);
+    case IC_DEC:         return sizeof(ic_dec_t);
+    case IC_ARG:         return sizeof(ic_arg_t);
+    case IC_CALL:        return sizeof(ic_call_t);
+    case IC_PARAM:       return sizeof(ic_param_t);
+    case IC_READ:        return sizeof(ic_read_t);
+    case IC_WRITE:       return sizeof(ic_write_t);
+    default: assert(0); return 0;
+    }
+}
+
+intercode_t *copy_intercode(intercode_t *ic)
+{
+    assert(ic);
+    size_t size = sizeof_intercode(ic);
+    intercode_t *copy = malloc(size);
+    assert(copy);
+    memcpy(copy, ic, size);
+    return copy;
+}
+
 void fprint_ic_label(FILE *fp, ic_label_t *ic)
 {
     fprintf(fp, "LABEL L%d :", ic->labelid);
@@ -489,6 +570,64 @@ void fprint_intercode(FILE *fp, intercode_t *ic)
     }
 }
 
+operand_t *intercode_def(intercode_t *ic)
+{
+    assert(ic);
+    switch (ic->kind) {
+    case IC_ASSIGN: return &((ic_assign_t *)ic)->lhs;
+    case IC_ARITHBOP: return &((ic_arithbop_t *)ic)->target;
+    case IC_REF: return &((ic_ref_t *)ic)->lhs;
+    case IC_DREF: return &((ic_dref_t *)ic)->lhs;
+    case IC_CALL: return &((ic_call_t *)ic)->ret;
+    case IC_PARAM: return &((ic_param_t *)ic)->var;
+    case IC_READ: return &((ic_read_t *)ic)->var;
+    default: break;
+    }
+    return NULL;
+}
+
+int intercode_uses(intercode_t *ic, operand_t *uses[])
+{
+    assert(ic);
+    switch (ic->kind) {
+    case IC_ASSIGN:
+        uses[0] = &((ic_assign_t *)ic)->rhs;
+        return 1;
+    case IC_ARITHBOP:
+        uses[0] = &((ic_arithbop_t *)ic)->lhs;
+        uses[1] = &((ic_arithbop_t *)ic)->rhs;
+        return 2;
+    case IC_DREF:
+        uses[0] = &((ic_dref_t *)ic)->rhs;
+        return 1;
+    case IC_DREFASSIGN:
+        uses[0] = &((ic_drefassign_t *)ic)->lhs;
+        uses[1] = &((ic_drefassign_t *)ic)->rhs;
+        return 2;
+    case IC_CONDGOTO:
+        uses[0] = &((ic_condgoto_t *)ic)->lhs;
+        uses[1] = &((ic_condgoto_t *)ic)->rhs;
+        return 2;
+    case IC_RETURN:
+        uses[0] = &((ic_return_t *)ic)->ret;
+        return 1;
+    case IC_ARG:
+        uses[0] = &((ic_arg_t *)ic)->arg;
+        return 1;
+    case IC_WRITE:
+        uses[0] = &((ic_write_t *)ic)->var;
+        return 1;
+    default:
+        break;
+    }
+    return 0;
+}
+
+int intercode_is_jump(intercode_t *ic)
+{
+    return ic->kind == IC_GOTO || ic->kind == IC_RETURN;
+}
+
 /* ------------------------------------ *
  *           intercodelist              *
  * ------------------------------------ */
@@ -533,3 +672,200 @@ void fprint_iclist(FILE *fp, iclist_t *iclist)
         fprintf(fp, "\n");
     }
 }
+
+iclistnode_t *iclist_insert_before(iclist_t *iclist, iclistnode_t *pos,
+                                   intercode_t *ic)
+{
+    assert(iclist);
+    assert(pos);
+    assert(ic);
+    iclistnode_t *newnode = create_iclistnode(ic);
+    assert(newnode);
+
+    newnode->prev = pos->prev;
+    newnode->next = pos;
+    if (pos->prev)
+        pos->prev->next = newnode;
+    else
+        iclist->front = newnode;
+    pos->prev = newnode;
+    iclist->size++;
+    return newnode;
+}
+
+iclistnode_t *iclist_insert_after(iclist_t *iclist, iclistnode_t *pos,
+                                  intercode_t *ic)
+{
+    assert(iclist);
+    assert(pos);
+    assert(ic);
+    iclistnode_t *newnode = create_iclistnode(ic);
+    assert(newnode);
+
+    newnode->prev = pos;
+    newnode->next = pos->next;
+    if (pos->next)
+        pos->next->prev = newnode;
+    else
+        iclist->back = newnode;
+    pos->next = newnode;
+    iclist->size++;
+    return newnode;
+}
+
+iclistnode_t *iclist_remove(iclist_t *iclist, iclistnode_t *node)
+{
+    assert(iclist);
+    assert(node);
+    iclistnode_t *next = node->next;
+
+    if (node->prev)
+        node->prev->next = node->next;
+    else
+        iclist->front = node->next;
+    if (node->next)
+        node->next->prev = node->prev;
+    else
+        iclist->back = node->prev;
+    iclist->size--;
+
+    destroy_intercode(node->ic);
+    free(node);
+    return next;
+}
+
+void iclist_replace(iclistnode_t *node, intercode_t *ic)
+{
+    assert(node);
+    assert(ic);
+    destroy_intercode(node->ic);
+    node->ic = ic;
+}
+
+void iclist_move_before(iclist_t *iclist, iclistnode_t *pos, iclistnode_t *node)
+{
+    assert(iclist);
+    assert(pos);
+    assert(node && node != pos);
+
+    if (node->prev)
+        node->prev->next = node->next;
+    else
+        iclist->front = node->next;
+    if (node->next)
+        node->next->prev = node->prev;
+    else
+        iclist->back = node->prev;
+
+    node->prev = pos->prev;
+    node->next = pos;
+    if (pos->prev)
+        pos->prev->next = node;
+    else
+        iclist->front = node;
+    pos->prev = node;
+}
+
+iclistnode_t *iclist_copy_range(iclist_t *iclist, iclistnode_t *pos,
+                                iclistnode_t *first, iclistnode_t *last)
+{
+    assert(iclist);
+    assert(first && last);
+
+    int n_labels = 0;
+    for (iclistnode_t *cur = first; cur != last->next; cur = cur->next)
+        if (cur->ic->kind == IC_LABEL)
+            n_labels++;
+    int *from = malloc((n_labels ? n_labels : 1) * sizeof(int));
+    int *to = malloc((n_labels ? n_labels : 1) * sizeof(int));
+    assert(from && to);
+    n_labels = 0;
+    for (iclistnode_t *cur = first; cur != last->next; cur = cur->next) {
+        if (cur->ic->kind == IC_LABEL) {
+            from[n_labels] = ((ic_label_t *)cur->ic)->labelid;
+            to[n_labels++] = alloc_labelid();
+        }
+    }
+
+    iclistnode_t *copy_first = NULL;
+    for (iclistnode_t *cur = first; cur != last->next; cur = cur->next) {
+        intercode_t *ic = copy_intercode(cur->ic);
+        int *labelid = NULL;
+        if (ic->kind == IC_LABEL)
+            labelid = &((ic_label_t *)ic)->labelid;
+        else if (ic->kind == IC_GOTO)
+            labelid = &((ic_goto_t *)ic)->labelid;
+        else if (ic->kind == IC_CONDGOTO)
+            labelid = &((ic_condgoto_t *)ic)->labelid;
+        for (int i = 0; labelid && i < n_labels; ++i) {
+            if (from[i] == *labelid) {
+                *labelid = to[i];
+                break;
+            }
+        }
+        iclistnode_t *node;
+        if (pos) {
+            node = iclist_insert_before(iclist, pos, ic);
+        }
+        else {
+            iclist_push_back(iclist, ic);
+            node = iclist->back;
+        }
+        if (!copy_first)
+            copy_first = node;
+    }
+    free(from);
+    free(to);
+    return copy_first;
+}
+
+int iclist_is_tail_call(iclistnode_t *node)
+{
+    assert(node);
+    if (node->ic->kind != IC_CALL || !node->next ||
+        node->next->ic->kind != IC_RETURN)
+        return 0;
+    operand_t *ret = &((ic_return_t *)node->next->ic)->ret;
+    return operand_is_equal(ret, &((ic_call_t *)node->ic)->ret);
+}
+
+void iclist_splice_back(iclist_t *iclist, iclist_t *other)
+{
+    assert(iclist);
+    assert(other);
+    if (other->size == 0)
+        return;
+
+    if (iclist->size == 0)
+        iclist->front = other->front;
+    else
+        iclist->back->next = other->front;
+    other->front->prev = iclist->back;
+    iclist->back = other->back;
+    iclist->size += other->size;
+    init_iclist(other);
+}
+
+void iclist_split_front(iclist_t *iclist, iclistnode_t *last, iclist_t *front)
+{
+    assert(iclist);
+    assert(last);
+    assert(front && front->size == 0);
+
+    int size = 1;
+    for (iclistnode_t *cur = iclist->front; cur != last; cur = cur->next) {
+        assert(cur);
+        size++;
+    }
+
+    front->front = iclist->front;
+    front->back = last;
+    front->size = size;
+    iclist->front = last->next;
+    iclist->size -= size;
+    if (iclist->front)
+        iclist->front->prev = NULL;
+    else
+        iclist->back = NULL;
+    last->next = NULL;
+}
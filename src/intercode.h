@@ -27,6 +27,11 @@ void init_labelid();
 int alloc_varid();
 int alloc_labelid();
 
+/* Every id allocated so far is strictly less than the bound, so the
+ * bounds can be used to size tables directly indexed by id. */
+int varid_bound();
+int labelid_bound();
+
 void init_var_operand(operand_t *op, int varid);
 void init_addr_operand(operand_t *op, int varid);
 void init_const_operand(operand_t *op, int val);
@@ -52,6 +57,11 @@ const char *icop_to_str(int icop);
 int str_to_icop(const char *str);
 int complement_rel_icop(int icop);
 
+/* Compute 'lhs icop rhs' as the target machine does. Return -1 if it
+ * cannot be folded at compile time, such as dividing by zero. */
+int fold_arith_icop(int icop, int lhs, int rhs, int *result);
+int eval_rel_icop(int icop, int lhs, int rhs);
+
 enum {
     IC_LABEL, IC_FUNCDEF, IC_ASSIGN, IC_ARITHBOP,
     IC_REF, IC_DREF, IC_DREFASSIGN, IC_GOTO, IC_CONDGOTO,
@@ -174,8 +184,22 @@ intercode_t *create_ic_param(operand_t *var);
 intercode_t *create_ic_read(operand_t *var);
 intercode_t *create_ic_write(operand_t *var);
 
+void destroy_intercode(intercode_t *ic);
+/* Names of functions are shared by the copy. */
+intercode_t *copy_intercode(intercode_t *ic);
 void fprint_intercode(FILE *fp, intercode_t *ic);
 
+/* Return the operand defined by 'ic', or NULL if it defines nothing. */
+operand_t *intercode_def(intercode_t *ic);
+
+/* Store the operands read by 'ic' in 'uses' and return how many there
+ * are. At most 2 operands are read by an intercode. Constants are
+ * included, while the array referred by IC_REF is not. */
+int intercode_uses(intercode_t *ic, operand_t *uses[]);
+
+/* Whether control never falls through to the next intercode. */
+int intercode_is_jump(intercode_t *ic);
+
 /* ------------------------------------ *
  *           intercodelist              *
  * ------------------------------------ */
@@ -196,4 +220,30 @@ void init_iclist(iclist_t *iclist);
 void iclist_push_back(iclist_t *iclist, intercode_t *ic);
 void fprint_iclist(FILE *fp, iclist_t *iclist);
 
+/* Insert 'ic' before or after 'pos' and return the new node. */
+iclistnode_t *iclist_insert_before(iclist_t *iclist, iclistnode_t *pos,
+                                   intercode_t *ic);
+iclistnode_t *iclist_insert_after(iclist_t *iclist, iclistnode_t *pos,
+                                  intercode_t *ic);
+/* Remove 'node' and destroy its intercode. Return the next node. */
+iclistnode_t *iclist_remove(iclist_t *iclist, iclistnode_t *node);
+/* Destroy the intercode of 'node' and put 'ic' in place of it. */
+void iclist_replace(iclistnode_t *node, intercode_t *ic);
+/* Unlink 'node' and link it again before 'pos'. */
+void iclist_move_before(iclist_t *iclist, iclistnode_t *pos, iclistnode_t *node);
+/* Insert a copy of the nodes from 'first' to 'last' before 'pos', or at
+ * the back if 'pos' is NULL, where the labels defined in the range get
+ * new ids. Return the first node of the copy. */
+iclistnode_t *iclist_copy_range(iclist_t *iclist, iclistnode_t *pos,
+                                iclistnode_t *first, iclistnode_t *last);
+
+/* Whether 'node' calls a function and returns its result at once. */
+int iclist_is_tail_call(iclistnode_t *node);
+
+/* Move all nodes of 'other' to the back of 'iclist'. */
+void iclist_splice_back(iclist_t *iclist, iclist_t *other);
+/* Move the nodes from the front of 'iclist' up to 'last' into 'front',
+ * which should be empty. */
+void iclist_split_front(iclist_t *iclist, iclistnode_t *last, iclist_t *front);
+
 #endif
\ No newline at end of file
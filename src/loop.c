@@ -0,0 +1,320 @@
+#include "loop.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+/* ------------------------------------ *
+ *               loop                   *
+ * ------------------------------------ */
+
+loop_t *create_loop(cfg_t *cfg, block_t *header)
+{
+    loop_t *loop = malloc(sizeof(loop_t));
+    assert(loop);
+    loop->id = 0;
+    loop->header = header;
+    loop->n_blocks = 0;
+    loop->blocks = NULL;
+    loop->contains = calloc(cfg->n_blocks, sizeof(char));
+    loop->n_latches = 0;
+    loop->latches = NULL;
+    loop->parent = NULL;
+    loop->n_children = 0;
+    loop->children = NULL;
+    loop->depth = 0;
+    assert(loop->contains);
+    return loop;
+}
+
+void destroy_loop(loop_t *loop)
+{
+    free(loop->blocks);
+    free(loop->contains);
+    free(loop->latches);
+    free(loop->children);
+    free(loop);
+}
+
+int loop_contains(loop_t *loop, block_t *block)
+{
+    return loop->contains[block->id];
+}
+
+int loop_is_exiting(loop_t *loop, block_t *block)
+{
+    if (!loop_contains(loop, block))
+        return 0;
+    if (block->n_succs == 0)
+        return 1;
+    for (int i = 0; i < block->n_succs; ++i)
+        if (!loop_contains(loop, block->succs[i]))
+            return 1;
+    return 0;
+}
+
+void loop_add_latch(loop_t *loop, block_t *latch)
+{
+    loop->latches = realloc(loop->latches, (loop->n_latches + 1) * sizeof(block_t *));
+    assert(loop->latches);
+    loop->latches[loop->n_latches++] = latch;
+}
+
+void loop_add_child(loop_t *loop, loop_t *child)
+{
+    loop->children = realloc(loop->children, (loop->n_children + 1) * sizeof(loop_t *));
+    assert(loop->children);
+    loop->children[loop->n_children++] = child;
+}
+
+/* The body is the header and the blocks reaching a latch without
+ * passing the header. */
+void loop_find_body(cfg_t *cfg, loop_t *loop)
+{
+    block_t **stack = malloc(cfg->n_blocks * sizeof(block_t *));
+    assert(stack);
+    int top = 0;
+    loop->contains[loop->header->id] = 1;
+    for (int i = 0; i < loop->n_latches; ++i) {
+        block_t *latch = loop->latches[i];
+        if (!loop->contains[latch->id]) {
+            loop->contains[latch->id] = 1;
+            stack[top++] = latch;
+        }
+    }
+    while (top > 0) {
+        block_t *block = stack[--top];
+        for (int i = 0; i < block->n_preds; ++i) {
+            block_t *pred = block->preds[i];
+            if (!loop->contains[pred->id]) {
+                loop->contains[pred->id] = 1;
+                stack[top++] = pred;
+            }
+        }
+    }
+    free(stack);
+
+    loop->blocks = malloc(cfg->n_blocks * sizeof(block_t *));
+    assert(loop->blocks);
+    for (int i = 0; i < cfg->n_blocks; ++i)
+        if (loop->contains[i])
+            loop->blocks[loop->n_blocks++] = cfg->blocks[i];
+}
+
+/* ------------------------------------ *
+ *             loop nest                *
+ * ------------------------------------ */
+
+int compare_loop_size(const void *lhs, const void *rhs)
+{
+    const loop_t *l = *(const loop_t **)lhs, *r = *(const loop_t **)rhs;
+    if (l->n_blocks != r->n_blocks)
+        return l->n_blocks - r->n_blocks;
+    return l->header->id - r->header->id;
+}
+
+loopnest_t *create_loopnest(cfg_t *cfg)
+{
+    loopnest_t *nest = malloc(sizeof(loopnest_t));
+    assert(nest);
+    nest->cfg = cfg;
+    nest->idoms = cfg_idoms(cfg);
+    nest->n_loops = 0;
+    nest->loops = malloc(cfg->n_blocks * sizeof(loop_t *));
+    nest->block_loops = calloc(cfg->n_blocks, sizeof(loop_t *));
+    loop_t **header_loops = calloc(cfg->n_blocks, sizeof(loop_t *));
+    assert(nest->loops && nest->block_loops && header_loops);
+
+    /* An edge is a back edge if its target dominates its source. */
+    for (int i = 0; i < cfg->n_blocks; ++i) {
+        block_t *block = cfg->blocks[i];
+        if (nest->idoms[i] == -1)
+            continue;
+        for (int j = 0; j < block->n_succs; ++j) {
+            block_t *header = block->succs[j];
+            if (!idoms_dominate(nest->idoms, header->id, block->id))
+                continue;
+            loop_t *loop = header_loops[header->id];
+            if (!loop) {
+                loop = header_loops[header->id] = create_loop(cfg, header);
+                nest->loops[nest->n_loops++] = loop;
+            }
+            loop_add_latch(loop, block);
+        }
+    }
+    free(header_loops);
+
+    for (int i = 0; i < nest->n_loops; ++i)
+        loop_find_body(cfg, nest->loops[i]);
+
+    /* Natural loops with different headers are either disjoint or
+     * nested, and an inner loop is smaller. So the parent of a loop is
+     * the smallest bigger one containing its header. */
+    qsort(nest->loops, nest->n_loops, sizeof(loop_t *), compare_loop_size);
+    for (int i = 0; i < nest->n_loops; ++i) {
+        loop_t *loop = nest->loops[i];
+        loop->id = i;
+        for (int j = i + 1; j < nest->n_loops; ++j) {
+            if (loop_contains(nest->loops[j], loop->header)) {
+                loop->parent = nest->loops[j];
+                loop_add_child(loop->parent, loop);
+                break;
+            }
+        }
+        for (int k = 0; k < loop->n_blocks; ++k)
+            if (!nest->block_loops[loop->blocks[k]->id])
+                nest->block_loops[loop->blocks[k]->id] = loop;
+    }
+    for (int i = nest->n_loops - 1; i >= 0; --i) {
+        loop_t *loop = nest->loops[i];
+        loop->depth = (loop->parent ? loop->parent->depth + 1 : 1);
+    }
+    return nest;
+}
+
+void destroy_loopnest(loopnest_t *nest)
+{
+    for (int i = 0; i < nest->n_loops; ++i)
+        destroy_loop(nest->loops[i]);
+    free(nest->loops);
+    free(nest->block_loops);
+    free(nest->idoms);
+    free(nest);
+}
+
+int *block_jump_labelid(block_t *block)
+{
+    intercode_t *ic = block->last->ic;
+    if (ic->kind == IC_GOTO)
+        return &((ic_goto_t *)ic)->labelid;
+    if (ic->kind == IC_CONDGOTO)
+        return &((ic_condgoto_t *)ic)->labelid;
+    return NULL;
+}
+
+iclistnode_t *loop_insert_preheader(loopnest_t *nest, loop_t *loop)
+{
+    cfg_t *cfg = nest->cfg;
+    block_t *header = loop->header;
+    if (header->id == 0 || header->first->ic->kind != IC_LABEL)
+        return NULL;
+    int header_label = ((ic_label_t *)header->first->ic)->labelid;
+
+    int n_entries = 0;
+    block_t *entry = NULL;
+    for (int i = 0; i < header->n_preds; ++i) {
+        if (!loop_contains(loop, header->preds[i])) {
+            entry = header->preds[i];
+            n_entries++;
+        }
+    }
+    assert(n_entries > 0);
+
+    /* A single entry going nowhere else is a preheader already. */
+    if (n_entries == 1 && entry->n_succs == 1) {
+        int kind = entry->last->ic->kind;
+        if (kind == IC_GOTO || kind == IC_CONDGOTO)
+            return entry->last;
+        return entry->last->next;
+    }
+
+    /* Otherwise the code goes right before the header, where the block
+     * above falls into. It must not be a back edge. */
+    block_t *above = cfg->blocks[header->id - 1];
+    if (above->fall == header && loop_contains(loop, above))
+        return NULL;
+
+    int labelid = 0;
+    for (int i = 0; i < header->n_preds; ++i) {
+        block_t *pred = header->preds[i];
+        if (loop_contains(loop, pred) || pred->jump != header)
+            continue;
+        if (!labelid) {
+            labelid = alloc_labelid();
+            iclist_insert_before(&cfg->func->body, header->first,
+                                 create_ic_label(labelid));
+        }
+        int *target = block_jump_labelid(pred);
+        assert(target && *target == header_label);
+        *target = labelid;
+    }
+    return header->first;
+}
+
+int loop_iv_step(intercode_t *ic, operand_t *var)
+{
+    if (ic->kind != IC_ARITHBOP)
+        return 0;
+    ic_arithbop_t *arith = (ic_arithbop_t *)ic;
+    if (arith->op == ICOP_ADD) {
+        if (operand_is_equal(&arith->lhs, var) && is_const_operand(&arith->rhs))
+            return arith->rhs.val;
+        if (operand_is_equal(&arith->rhs, var) && is_const_operand(&arith->lhs))
+            return arith->lhs.val;
+    }
+    if (arith->op == ICOP_SUB &&
+        operand_is_equal(&arith->lhs, var) && is_const_operand(&arith->rhs))
+        return -arith->rhs.val;
+    return 0;
+}
+
+int labelid_in(int *labelids, int n, int labelid)
+{
+    for (int i = 0; i < n; ++i)
+        if (labelids[i] == labelid)
+            return 1;
+    return 0;
+}
+
+int loop_transform_each(icfunc_t *func, loop_transform_t transform)
+{
+    /* Loops are handled from inner to outer, one at a time, since the
+     * CFG changes. They are known by the labels of their headers. */
+    int *done = NULL, n_done = 0, changed = 0;
+    while (1) {
+        cfg_t *cfg = create_cfg(func);
+        if (cfg_remove_unreachable(cfg)) {
+            destroy_cfg(cfg);
+            cfg = create_cfg(func);
+            changed = 1;
+        }
+        loopnest_t *nest = create_loopnest(cfg);
+
+        loop_t *loop = NULL;
+        int labelid = 0;
+        for (int i = 0; i < nest->n_loops && !loop; ++i) {
+            intercode_t *ic = nest->loops[i]->header->first->ic;
+            if (ic->kind != IC_LABEL)
+                continue;
+            labelid = ((ic_label_t *)ic)->labelid;
+            if (!labelid_in(done, n_done, labelid))
+                loop = nest->loops[i];
+        }
+
+        if (loop) {
+            done = realloc(done, (n_done + 1) * sizeof(int));
+            assert(done);
+            done[n_done++] = labelid;
+            changed |= transform(nest, loop);
+        }
+
+        destroy_loopnest(nest);
+        destroy_cfg(cfg);
+        if (!loop)
+            break;
+    }
+    free(done);
+    return changed;
+}
+
+void fprint_loopnest(FILE *fp, loopnest_t *nest)
+{
+    fprintf(fp, "Loops of %s:\n", nest->cfg->func->fname);
+    for (int i = 0; i < nest->n_loops; ++i) {
+        loop_t *loop = nest->loops[i];
+        fprintf(fp, "%*sloop %d: header B%d, depth %d, blocks",
+                2 * loop->depth, "", loop->id, loop->header->id, loop->depth);
+        for (int j = 0; j < loop->n_blocks; ++j)
+            fprintf(fp, " B%d", loop->blocks[j]->id);
+        fprintf(fp, "\n");
+    }
+}
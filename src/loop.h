@@ -0,0 +1,68 @@
+#ifndef _LOOP_H
+#define _LOOP_H
+
+#include "cfg.h"
+
+/* ------------------------------------ *
+ *               loop                   *
+ * ------------------------------------ */
+
+/* A natural loop, formed by the back edges to its header. Loops with
+ * the same header are merged. */
+typedef struct loop {
+    int id;
+    block_t *header;
+    int n_blocks;
+    block_t **blocks;       /* in the order of the body */
+    char *contains;         /* indexed by block id */
+    int n_latches;
+    block_t **latches;
+    struct loop *parent;
+    int n_children;
+    struct loop **children;
+    int depth;              /* 1 for outermost loops */
+} loop_t;
+
+int loop_contains(loop_t *loop, block_t *block);
+/* Whether control may leave the loop from the block. */
+int loop_is_exiting(loop_t *loop, block_t *block);
+
+/* ------------------------------------ *
+ *             loop nest                *
+ * ------------------------------------ */
+
+typedef struct loopnest {
+    cfg_t *cfg;
+    int *idoms;
+    /* Loops are ordered so that inner loops come before outer ones. */
+    int n_loops;
+    loop_t **loops;
+    loop_t **block_loops;   /* the innermost loop of every block, or NULL */
+} loopnest_t;
+
+loopnest_t *create_loopnest(cfg_t *cfg);
+void destroy_loopnest(loopnest_t *nest);
+
+/* Return the label id targeted by the jump ending the block, or NULL. */
+int *block_jump_labelid(block_t *block);
+
+/* Return the node before which code runs once each time the loop is
+ * entered, adding a label to separate the entries from the back edges
+ * if needed. Return NULL if the loop is entered by falling through from
+ * inside. The CFG should be rebuilt after that. */
+iclistnode_t *loop_insert_preheader(loopnest_t *nest, loop_t *loop);
+
+/* Return the step of 'ic' if it increments 'var' by a constant, as the
+ * definitions of a basic induction variable do, otherwise 0. */
+int loop_iv_step(intercode_t *ic, operand_t *var);
+
+/* Apply the transformation to every loop of the function once, inner
+ * loops first. The CFG and the loop nest are rebuilt for each loop, so
+ * the transformation may change the code freely. It returns whether the
+ * code is changed. */
+typedef int (*loop_transform_t)(loopnest_t *nest, loop_t *loop);
+int loop_transform_each(icfunc_t *func, loop_transform_t transform);
+
+void fprint_loopnest(FILE *fp, loopnest_t *nest);
+
+#endif
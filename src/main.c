@@ -1,24 +1,108 @@
+#include "optim.h"
+#include "mips.h"
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 extern int yydebug;
 void yyrestart(FILE *);
 int yyparse(void);
 FILE *fout;
+int output_ir = 0;
+
+void print_usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] <src.cmm> [<dst.s>]\n"
+            "Options:\n"
+            "  -O<level>          optimization level from 0 to %d\n"
+            "  --passes=<list>    run the comma-separated passes instead\n"
+            "  --unroll=<n>       unroll loops of unknown trip count n times\n"
+            "  --inline-threshold=<n>\n"
+            "                     inline callees costing at most n intercodes\n"
+            "  --regalloc=<name>  allocate registers by 'local', 'linear' scan or\n"
+            "                     'graph' coloring\n"
+            "  --stats            report time and intercode delta of passes, and\n"
+            "                     the frames and registers allocated\n"
+            "  --verify-ir        verify the IR after every pass\n"
+            "  --ir               output the intercodes instead of mips\n"
+            "Passes:\n", prog, OPTIM_MAX_LEVEL);
+    optim_print_passes(stderr);
+}
+
+int parse_option(const char *opt)
+{
+    if (opt[1] == 'O' && opt[2] >= '0' && opt[2] <= '0' + OPTIM_MAX_LEVEL &&
+        opt[3] == '\0') {
+        optim_set_level(opt[2] - '0');
+        return 0;
+    }
+    if (!strncmp(opt, "--passes=", 9))
+        return optim_set_passes(opt + 9);
+    if (!strncmp(opt, "--unroll=", 9)) {
+        int factor = atoi(opt + 9);
+        if (factor < 1)
+            return -1;
+        optim_set_unroll_factor(factor);
+        return 0;
+    }
+    if (!strncmp(opt, "--inline-threshold=", 19)) {
+        if (opt[19] < '0' || opt[19] > '9')
+            return -1;
+        optim_set_inline_threshold(atoi(opt + 19));
+        return 0;
+    }
+    if (!strncmp(opt, "--regalloc=", 11))
+        return mips_set_regalloc(opt + 11);
+    if (!strcmp(opt, "--stats")) {
+        optim_enable_stats();
+        return 0;
+    }
+    if (!strcmp(opt, "--verify-ir")) {
+        optim_enable_verify();
+        return 0;
+    }
+    if (!strcmp(opt, "--ir")) {
+        output_ir = 1;
+        return 0;
+    }
+    return -1;
+}
 
 int main(int argc, char **argv)
 {
     FILE *fin;
-    
-    if (argc <= 1)
+    const char *files[2] = { NULL, NULL };
+    int n_files = 0;
+
+    optim_set_level(0);
+    for (int i = 1; i < argc; ++i) {
+        if (argv[i][0] == '-') {
+            if (parse_option(argv[i]) != 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (n_files < 2) {
+            files[n_files++] = argv[i];
+        }
+        else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (n_files == 0)
         return 1;
-    if (!(fin = fopen(argv[1], "r"))) {
-        perror(argv[1]);
+    if (!(fin = fopen(files[0], "r"))) {
+        perror(files[0]);
         return 1;
     }
 
     fout = stdout;
-    if (argc >= 3 && !(fout = fopen(argv[2], "w"))) {
-        perror(argv[2]);
+    if (n_files >= 2 && !(fout = fopen(files[1], "w"))) {
+        perror(files[1]);
         return 1;
     }
 
@@ -0,0 +1,630 @@
+#include "mips-regalloc.h"
+#include "loop.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* ------------------------------------ *
+ *     iterated register coalescing     *
+ * ------------------------------------ */
+
+/* The allocator of George and Appel. The nodes of the interference graph
+ * are the registers to give, which are precoloured, and the variables.
+ * The copies 'x := y' are moves between variables, and the parameters,
+ * the arguments, the results of calls and the values returned are moves
+ * between variables and $a0..$a3 or $v0, so that coalescing them puts
+ * the variables right where the calling convention wants them. Those
+ * registers are clobbered by calls and by read and write, so they
+ * interfere with the variables live across. Moves are coalesced by the
+ * tests of Briggs and George, which never make the graph uncolourable.
+ * Spill costs count the definitions and uses weighted by loop depth. A
+ * spilled variable lives in its stack slot, from which the code
+ * generator loads it to the registers kept out of the graph. */
+
+#define COLOR_LOOP_WEIGHT   10
+#define COLOR_MAX_DEPTH     4
+
+static const int colors[] = {
+    R_T0, R_T1, R_T2, R_T3, R_T4, R_T5, R_T6, R_T7,
+    R_S0, R_S1, R_S2, R_S3, R_S4, R_S5, R_S6, R_S7,
+    R_A0, R_A1, R_A2, R_A3, R_V0
+};
+
+#define K   ((int)(sizeof(colors) / sizeof(colors[0])))
+
+enum {
+    NODE_PRECOLORED, NODE_INITIAL, NODE_SIMPLIFY, NODE_FREEZE, NODE_SPILL,
+    NODE_SPILLED, NODE_COALESCED, NODE_COLORED, NODE_SELECT
+};
+
+enum {
+    MOVE_COALESCED, MOVE_CONSTRAINED, MOVE_FROZEN, MOVE_WORKLIST, MOVE_ACTIVE
+};
+
+typedef struct intlist {
+    int size;
+    int capacity;
+    int *items;
+} intlist_t;
+
+static struct {
+    regalloc_t *ra;
+    int n_nodes;            /* K precoloured nodes, then the variables */
+    bitset_t **adj_set;
+    intlist_t *adj_lists;
+    int *degrees;
+    int *states;
+    int *aliases;
+    int *node_colors;
+    double *costs;
+    char *crosses_call;
+    intlist_t *move_lists;
+    int n_moves;
+    int move_capacity;
+    int *move_dsts;
+    int *move_srcs;
+    int *move_states;
+    /* Stacks with lazy deletion, whose entries are valid only if the
+     * state of the node or move still matches. */
+    intlist_t simplify_stack;
+    intlist_t freeze_stack;
+    intlist_t move_stack;
+    intlist_t select_stack;
+} coloring;
+
+void intlist_push(intlist_t *list, int item)
+{
+    if (list->size == list->capacity) {
+        list->capacity = (list->capacity ? 2 * list->capacity : 4);
+        list->items = realloc(list->items, list->capacity * sizeof(int));
+        assert(list->items);
+    }
+    list->items[list->size++] = item;
+}
+
+int color_reg_node(int reg)
+{
+    for (int i = 0; i < K; ++i)
+        if (colors[i] == reg)
+            return i;
+    assert(0);
+    return -1;
+}
+
+int color_var_node(operand_t *var)
+{
+    int i = cfg_var_index(coloring.ra->cfg, var);
+    return (i < 0 ? -1 : K + i);
+}
+
+int color_is_precolored(int n)
+{
+    return n < K;
+}
+
+int color_adjacent(int u, int v)
+{
+    return bitset_contains(coloring.adj_set[u], v);
+}
+
+void color_add_edge(int u, int v)
+{
+    if (u == v || u < 0 || v < 0 || color_adjacent(u, v))
+        return;
+    bitset_add(coloring.adj_set[u], v);
+    bitset_add(coloring.adj_set[v], u);
+    if (!color_is_precolored(u)) {
+        intlist_push(&coloring.adj_lists[u], v);
+        coloring.degrees[u]++;
+    }
+    if (!color_is_precolored(v)) {
+        intlist_push(&coloring.adj_lists[v], u);
+        coloring.degrees[v]++;
+    }
+}
+
+void color_add_move(int dst, int src)
+{
+    if (dst < 0 || src < 0 || dst == src)
+        return;
+    if (coloring.n_moves == coloring.move_capacity) {
+        coloring.move_capacity = (coloring.move_capacity ? 2 * coloring.move_capacity : 16);
+        coloring.move_dsts = realloc(coloring.move_dsts, coloring.move_capacity * sizeof(int));
+        coloring.move_srcs = realloc(coloring.move_srcs, coloring.move_capacity * sizeof(int));
+        coloring.move_states = realloc(coloring.move_states,
+                                       coloring.move_capacity * sizeof(int));
+        assert(coloring.move_dsts && coloring.move_srcs && coloring.move_states);
+    }
+    int m = coloring.n_moves++;
+    coloring.move_dsts[m] = dst;
+    coloring.move_srcs[m] = src;
+    coloring.move_states[m] = MOVE_WORKLIST;
+    intlist_push(&coloring.move_lists[dst], m);
+    intlist_push(&coloring.move_lists[src], m);
+    intlist_push(&coloring.move_stack, m);
+}
+
+/* Every variable in 'live' interferes with the registers clobbered. */
+void color_clobber(bitset_t *live, const int *regs, int n_regs)
+{
+    regalloc_t *ra = coloring.ra;
+    for (int v = 0; v < ra->cfg->n_vars; ++v) {
+        if (!bitset_contains(live, v))
+            continue;
+        for (int i = 0; i < n_regs; ++i)
+            color_add_edge(K + v, color_reg_node(regs[i]));
+    }
+}
+
+/* Add the moves of the calling convention at 'node'. */
+void color_add_conv_moves(iclistnode_t *node)
+{
+    intercode_t *ic = node->ic;
+    if (ic->kind == IC_PARAM) {
+        int n = 0;
+        for (iclistnode_t *cur = node; cur->ic->kind == IC_PARAM; cur = cur->prev)
+            n++;
+        if (n <= 4)
+            color_add_move(color_var_node(&((ic_param_t *)ic)->var),
+                           color_reg_node(R_A0 + n - 1));
+    }
+    else if (ic->kind == IC_ARG) {
+        int n = 0;
+        for (iclistnode_t *cur = node; cur->ic->kind == IC_ARG; cur = cur->next)
+            n++;
+        if (n <= 4)
+            color_add_move(color_reg_node(R_A0 + n - 1),
+                           color_var_node(&((ic_arg_t *)ic)->arg));
+    }
+    else if (ic->kind == IC_CALL) {
+        color_add_move(color_var_node(&((ic_call_t *)ic)->ret), color_reg_node(R_V0));
+    }
+    else if (ic->kind == IC_RETURN) {
+        color_add_move(color_reg_node(R_V0), color_var_node(&((ic_return_t *)ic)->ret));
+    }
+}
+
+void color_build(regalloc_t *ra, loopnest_t *nest)
+{
+    static const int call_clobbers[] = { R_A0, R_A1, R_A2, R_A3, R_V0 };
+    static const int io_clobbers[] = { R_A0, R_V0 };
+    cfg_t *cfg = ra->cfg;
+    bitset_t *state = create_bitset(cfg->n_vars);
+
+    for (int b = 0; b < cfg->n_blocks; ++b) {
+        block_t *block = cfg->blocks[b];
+        loop_t *loop = nest->block_loops[b];
+        double weight = 1;
+        for (int d = 0; loop && d < loop->depth && d < COLOR_MAX_DEPTH; ++d)
+            weight *= COLOR_LOOP_WEIGHT;
+
+        bitset_copy(state, ra->live->out[b]);
+        for (iclistnode_t *cur = block->last; cur != block->first->prev; cur = cur->prev) {
+            intercode_t *ic = cur->ic;
+            operand_t *def = intercode_def(ic);
+            operand_t *uses[2];
+            int n_uses = intercode_uses(ic, uses);
+            int d = (def ? cfg_var_index(cfg, def) : -1);
+
+            if (d >= 0)
+                bitset_remove(state, d);
+            if (ic->kind == IC_CALL)
+                color_clobber(state, call_clobbers, 4 + 1);
+            else if (ic->kind == IC_READ || ic->kind == IC_WRITE)
+                color_clobber(state, io_clobbers, 2);
+
+            /* The source of a copy does not interfere with its target. */
+            int src = -1;
+            if (ic->kind == IC_ASSIGN && !is_const_operand(uses[0]))
+                src = cfg_var_index(cfg, uses[0]);
+            if (d >= 0) {
+                for (int v = 0; v < cfg->n_vars; ++v)
+                    if (v != src && bitset_contains(state, v))
+                        color_add_edge(K + d, K + v);
+                coloring.costs[K + d] += weight;
+            }
+            if (src >= 0)
+                color_add_move(K + d, K + src);
+            color_add_conv_moves(cur);
+
+            for (int i = 0; i < n_uses; ++i) {
+                if (is_const_operand(uses[i]))
+                    continue;
+                int u = cfg_var_index(cfg, uses[i]);
+                bitset_add(state, u);
+                coloring.costs[K + u] += weight;
+            }
+        }
+    }
+    destroy_bitset(state);
+}
+
+/* ------------------------------------ *
+ *              worklists               *
+ * ------------------------------------ */
+
+int color_is_move_related(int n)
+{
+    intlist_t *moves = &coloring.move_lists[n];
+    for (int i = 0; i < moves->size; ++i) {
+        int state = coloring.move_states[moves->items[i]];
+        if (state == MOVE_ACTIVE || state == MOVE_WORKLIST)
+            return 1;
+    }
+    return 0;
+}
+
+void color_set_state(int n, int state)
+{
+    coloring.states[n] = state;
+    if (state == NODE_SIMPLIFY)
+        intlist_push(&coloring.simplify_stack, n);
+    else if (state == NODE_FREEZE)
+        intlist_push(&coloring.freeze_stack, n);
+}
+
+void color_make_worklists()
+{
+    for (int n = K; n < coloring.n_nodes; ++n) {
+        if (coloring.states[n] != NODE_INITIAL)
+            continue;
+        if (coloring.degrees[n] >= K)
+            color_set_state(n, NODE_SPILL);
+        else if (color_is_move_related(n))
+            color_set_state(n, NODE_FREEZE);
+        else
+            color_set_state(n, NODE_SIMPLIFY);
+    }
+}
+
+/* Whether 'm' is still in the graph as a neighbour of some node. */
+int color_is_present(int m)
+{
+    int state = coloring.states[m];
+    return state != NODE_SELECT && state != NODE_COALESCED;
+}
+
+void color_enable_moves(int n)
+{
+    intlist_t *moves = &coloring.move_lists[n];
+    for (int i = 0; i < moves->size; ++i) {
+        int m = moves->items[i];
+        if (coloring.move_states[m] == MOVE_ACTIVE) {
+            coloring.move_states[m] = MOVE_WORKLIST;
+            intlist_push(&coloring.move_stack, m);
+        }
+    }
+}
+
+void color_decrement_degree(int m)
+{
+    if (color_is_precolored(m))
+        return;
+    if (coloring.degrees[m]-- != K)
+        return;
+    color_enable_moves(m);
+    intlist_t *adj = &coloring.adj_lists[m];
+    for (int i = 0; i < adj->size; ++i)
+        if (color_is_present(adj->items[i]))
+            color_enable_moves(adj->items[i]);
+    if (coloring.states[m] != NODE_SPILL)
+        return;
+    color_set_state(m, color_is_move_related(m) ? NODE_FREEZE : NODE_SIMPLIFY);
+}
+
+void color_simplify(int n)
+{
+    coloring.states[n] = NODE_SELECT;
+    intlist_push(&coloring.select_stack, n);
+    intlist_t *adj = &coloring.adj_lists[n];
+    for (int i = 0; i < adj->size; ++i)
+        if (color_is_present(adj->items[i]))
+            color_decrement_degree(adj->items[i]);
+}
+
+/* ------------------------------------ *
+ *              coalescing              *
+ * ------------------------------------ */
+
+int color_get_alias(int n)
+{
+    while (coloring.states[n] == NODE_COALESCED)
+        n = coloring.aliases[n];
+    return n;
+}
+
+void color_add_worklist(int u)
+{
+    if (!color_is_precolored(u) && !color_is_move_related(u) && coloring.degrees[u] < K &&
+        coloring.states[u] == NODE_FREEZE)
+        color_set_state(u, NODE_SIMPLIFY);
+}
+
+/* The test of George: every neighbour of 'v' is harmless to 'u'. */
+int color_george(int u, int v)
+{
+    intlist_t *adj = &coloring.adj_lists[v];
+    for (int i = 0; i < adj->size; ++i) {
+        int t = adj->items[i];
+        if (color_is_present(t) && coloring.degrees[t] >= K &&
+            !color_is_precolored(t) && !color_adjacent(t, u))
+            return 0;
+    }
+    return 1;
+}
+
+/* The test of Briggs: the merged node has fewer than K neighbours of
+ * significant degree. */
+int color_briggs(int u, int v)
+{
+    int k = 0;
+    for (int pass = 0; pass < 2; ++pass) {
+        int n = (pass == 0 ? u : v);
+        intlist_t *adj = &coloring.adj_lists[n];
+        for (int i = 0; i < adj->size; ++i) {
+            int t = adj->items[i];
+            if (!color_is_present(t) || (pass == 1 && color_adjacent(t, u)))
+                continue;
+            if (color_is_precolored(t) || coloring.degrees[t] >= K)
+                k++;
+        }
+    }
+    return k < K;
+}
+
+void color_combine(int u, int v)
+{
+    coloring.states[v] = NODE_COALESCED;
+    coloring.aliases[v] = u;
+    intlist_t *moves = &coloring.move_lists[v];
+    for (int i = 0; i < moves->size; ++i)
+        intlist_push(&coloring.move_lists[u], moves->items[i]);
+    color_enable_moves(v);
+    coloring.costs[u] += coloring.costs[v];
+    coloring.crosses_call[u] |= coloring.crosses_call[v];
+
+    intlist_t *adj = &coloring.adj_lists[v];
+    for (int i = 0; i < adj->size; ++i) {
+        int t = adj->items[i];
+        if (!color_is_present(t))
+            continue;
+        color_add_edge(t, u);
+        color_decrement_degree(t);
+    }
+    if (coloring.degrees[u] >= K && coloring.states[u] == NODE_FREEZE)
+        color_set_state(u, NODE_SPILL);
+}
+
+void color_coalesce(int m)
+{
+    int x = color_get_alias(coloring.move_dsts[m]);
+    int y = color_get_alias(coloring.move_srcs[m]);
+    int u = x, v = y;
+    if (color_is_precolored(y)) {
+        u = y;
+        v = x;
+    }
+
+    if (u == v) {
+        coloring.move_states[m] = MOVE_COALESCED;
+        color_add_worklist(u);
+    }
+    else if (color_is_precolored(v) || color_adjacent(u, v)) {
+        coloring.move_states[m] = MOVE_CONSTRAINED;
+        color_add_worklist(u);
+        color_add_worklist(v);
+    }
+    else if (color_is_precolored(u) ? color_george(u, v) : color_briggs(u, v)) {
+        coloring.move_states[m] = MOVE_COALESCED;
+        color_combine(u, v);
+        color_add_worklist(u);
+    }
+    else {
+        coloring.move_states[m] = MOVE_ACTIVE;
+    }
+}
+
+void color_freeze_moves(int u)
+{
+    intlist_t *moves = &coloring.move_lists[u];
+    for (int i = 0; i < moves->size; ++i) {
+        int m = moves->items[i];
+        int state = coloring.move_states[m];
+        if (state != MOVE_ACTIVE && state != MOVE_WORKLIST)
+            continue;
+        int x = color_get_alias(coloring.move_dsts[m]);
+        int y = color_get_alias(coloring.move_srcs[m]);
+        int v = (y == color_get_alias(u) ? x : y);
+        coloring.move_states[m] = MOVE_FROZEN;
+        if (!color_is_precolored(v) && coloring.states[v] == NODE_FREEZE &&
+            !color_is_move_related(v) && coloring.degrees[v] < K)
+            color_set_state(v, NODE_SIMPLIFY);
+    }
+}
+
+/* Pick the variable cheapest to spill for its degree. It is only spilled
+ * if no colour is left for it in the end. */
+void color_select_spill()
+{
+    int best = -1;
+    for (int n = K; n < coloring.n_nodes; ++n) {
+        if (coloring.states[n] != NODE_SPILL)
+            continue;
+        if (best < 0 || coloring.costs[n] * coloring.degrees[best] <
+                        coloring.costs[best] * coloring.degrees[n])
+            best = n;
+    }
+    assert(best >= 0);
+    color_set_state(best, NODE_SIMPLIFY);
+    color_freeze_moves(best);
+}
+
+int color_pop(intlist_t *stack, int state)
+{
+    while (stack->size > 0) {
+        int n = stack->items[--stack->size];
+        if (coloring.states[n] == state)
+            return n;
+    }
+    return -1;
+}
+
+int color_has_spill()
+{
+    for (int n = K; n < coloring.n_nodes; ++n)
+        if (coloring.states[n] == NODE_SPILL)
+            return 1;
+    return 0;
+}
+
+/* Values live across calls take the callee-saved registers first, and
+ * the others take them last, since using one costs a save. */
+int color_pick(int *is_taken, int crosses_call)
+{
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int c = 0; c < K; ++c) {
+            if (!is_taken[c] &&
+                regalloc_is_callee_saved(colors[c]) == (pass == 0 ? crosses_call : !crosses_call))
+                return c;
+        }
+    }
+    return K;
+}
+
+void color_assign()
+{
+    while (coloring.select_stack.size > 0) {
+        int n = coloring.select_stack.items[--coloring.select_stack.size];
+        int is_taken[K];
+        memset(is_taken, 0, sizeof(is_taken));
+        intlist_t *adj = &coloring.adj_lists[n];
+        for (int i = 0; i < adj->size; ++i) {
+            int w = color_get_alias(adj->items[i]);
+            int state = coloring.states[w];
+            if (state == NODE_COLORED || state == NODE_PRECOLORED)
+                is_taken[coloring.node_colors[w]] = 1;
+        }
+        int c = color_pick(is_taken, coloring.crosses_call[n]);
+        if (c == K) {
+            coloring.states[n] = NODE_SPILLED;
+        }
+        else {
+            coloring.states[n] = NODE_COLORED;
+            coloring.node_colors[n] = c;
+        }
+    }
+}
+
+/* ------------------------------------ *
+ *              allocation              *
+ * ------------------------------------ */
+
+void color_init(regalloc_t *ra)
+{
+    int n = coloring.n_nodes = K + ra->cfg->n_vars;
+    coloring.ra = ra;
+    coloring.adj_set = malloc(n * sizeof(bitset_t *));
+    coloring.adj_lists = calloc(n, sizeof(intlist_t));
+    coloring.move_lists = calloc(n, sizeof(intlist_t));
+    coloring.degrees = calloc(n, sizeof(int));
+    coloring.states = malloc(n * sizeof(int));
+    coloring.aliases = malloc(n * sizeof(int));
+    coloring.node_colors = malloc(n * sizeof(int));
+    coloring.costs = calloc(n, sizeof(double));
+    coloring.crosses_call = calloc(n, sizeof(char));
+    assert(coloring.adj_set && coloring.adj_lists && coloring.move_lists &&
+           coloring.degrees && coloring.states && coloring.aliases &&
+           coloring.node_colors && coloring.costs && coloring.crosses_call);
+    for (int i = 0; i < n; ++i) {
+        coloring.adj_set[i] = create_bitset(n);
+        coloring.states[i] = (i < K ? NODE_PRECOLORED : NODE_INITIAL);
+        coloring.aliases[i] = i;
+        coloring.node_colors[i] = (i < K ? i : -1);
+    }
+    /* Variables never live, such as arrays, stay out of the graph. */
+    for (int v = 0; v < ra->cfg->n_vars; ++v) {
+        if (ra->intervals[v].start < 0)
+            coloring.states[K + v] = NODE_SPILLED;
+        coloring.crosses_call[K + v] = ra->intervals[v].crosses_call;
+    }
+
+    coloring.n_moves = coloring.move_capacity = 0;
+    coloring.move_dsts = coloring.move_srcs = coloring.move_states = NULL;
+    memset(&coloring.simplify_stack, 0, sizeof(intlist_t));
+    memset(&coloring.freeze_stack, 0, sizeof(intlist_t));
+    memset(&coloring.move_stack, 0, sizeof(intlist_t));
+    memset(&coloring.select_stack, 0, sizeof(intlist_t));
+}
+
+void color_destroy()
+{
+    for (int i = 0; i < coloring.n_nodes; ++i) {
+        destroy_bitset(coloring.adj_set[i]);
+        free(coloring.adj_lists[i].items);
+        free(coloring.move_lists[i].items);
+    }
+    free(coloring.adj_set);
+    free(coloring.adj_lists);
+    free(coloring.move_lists);
+    free(coloring.degrees);
+    free(coloring.states);
+    free(coloring.aliases);
+    free(coloring.node_colors);
+    free(coloring.costs);
+    free(coloring.crosses_call);
+    free(coloring.move_dsts);
+    free(coloring.move_srcs);
+    free(coloring.move_states);
+    free(coloring.simplify_stack.items);
+    free(coloring.freeze_stack.items);
+    free(coloring.move_stack.items);
+    free(coloring.select_stack.items);
+}
+
+void graph_coloring(regalloc_t *ra)
+{
+    color_init(ra);
+    loopnest_t *nest = create_loopnest(ra->cfg);
+    color_build(ra, nest);
+    destroy_loopnest(nest);
+    color_make_worklists();
+
+    for (;;) {
+        int n, m;
+        if ((n = color_pop(&coloring.simplify_stack, NODE_SIMPLIFY)) >= 0) {
+            color_simplify(n);
+        }
+        else if (coloring.move_stack.size > 0) {
+            m = coloring.move_stack.items[--coloring.move_stack.size];
+            if (coloring.move_states[m] == MOVE_WORKLIST)
+                color_coalesce(m);
+        }
+        else if ((n = color_pop(&coloring.freeze_stack, NODE_FREEZE)) >= 0) {
+            color_set_state(n, NODE_SIMPLIFY);
+            color_freeze_moves(n);
+        }
+        else if (color_has_spill()) {
+            color_select_spill();
+        }
+        else {
+            break;
+        }
+    }
+    color_assign();
+
+    for (int v = 0; v < ra->cfg->n_vars; ++v) {
+        interval_t *it = &ra->intervals[v];
+        int n = color_get_alias(K + v);
+        it->spill_pos = 2 * ra->n_codes;
+        if (coloring.states[n] == NODE_COLORED || coloring.states[n] == NODE_PRECOLORED) {
+            it->reg = colors[coloring.node_colors[n]];
+        }
+        else {
+            it->reg = R_NONE;
+            if (it->start >= 0)
+                ra->n_spilled++;
+        }
+    }
+    color_destroy();
+}
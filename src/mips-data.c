@@ -5,20 +5,15 @@
 #include <assert.h>
 
 /* ------------------------------------ *
- *            var info list             *
+ *            var info table            *
  * ------------------------------------ */
 
-typedef struct vilistnode {
-    varinfo_t *varinfo;
-    struct vilistnode *prev;
-    struct vilistnode *next;
-} vilistnode_t;
-
 static struct {
+    int capacity;
+    varinfo_t **table;  /* indexed by varid */
     int size;
-    vilistnode_t *front;
-    vilistnode_t *back;
-} varinfolist;
+    int *varids;        /* varids in the order they are added */
+} varinfo_table;
 
 varinfo_t *create_varinfo(operand_t *var, int reg, int offset)
 {
@@ -27,6 +22,7 @@ varinfo_t *create_varinfo(operand_t *var, int reg, int offset)
         new_varinfo->var = *var;
         new_varinfo->reg = reg;
         new_varinfo->offset = offset;
+        new_varinfo->remat.kind = OPERAND_NONE;
     }
     return new_varinfo;
 }
@@ -34,76 +30,83 @@ varinfo_t *create_varinfo(operand_t *var, int reg, int offset)
 void print_varinfo(varinfo_t *vi)
 {
     fprint_operand(stdout, &vi->var);
+    if (vi->remat.kind != OPERAND_NONE) {
+        printf(" remat: ");
+        fprint_operand(stdout, &vi->remat);
+        return;
+    }
     printf(" reg: %s, offset %d", get_regalias(vi->reg), vi->offset);
 }
 
-vilistnode_t *create_vilistnode(varinfo_t *vi)
+void init_varinfo_table()
 {
-    vilistnode_t *newnode = malloc(sizeof(vilistnode_t));
-    if (newnode) {
-        newnode->varinfo = vi;
-        newnode->next = newnode->prev = NULL;
-    }
-    return newnode;
+    varinfo_table.capacity = 0;
+    varinfo_table.table = NULL;
+    varinfo_table.size = 0;
+    varinfo_table.varids = NULL;
 }
 
-varinfo_t *destroy_vilistnode(vilistnode_t *node)
+void varinfo_table_clear()
 {
-    varinfo_t *ret = node->varinfo;
-    free(node);
-    return ret;
+    for (int i = 0; i < varinfo_table.size; ++i) {
+        int varid = varinfo_table.varids[i];
+        free(varinfo_table.table[varid]);
+        varinfo_table.table[varid] = NULL;
+    }
+    varinfo_table.size = 0;
 }
 
-void init_varinfolist()
+void varinfo_table_reserve(int varid)
 {
-    varinfolist.size = 0;
-    varinfolist.front = varinfolist.back = NULL;
-}
+    if (varid < varinfo_table.capacity)
+        return;
 
-void varinfolist_clear()
-{
-    vilistnode_t *cur = varinfolist.front;
-    while (cur) {
-        vilistnode_t *save = cur->next;
-        free(cur);
-        cur = save;
-    }
-    init_varinfolist();
+    int capacity = 2 * varinfo_table.capacity;
+    if (capacity <= varid)
+        capacity = varid + 1;
+    if (capacity < varid_bound())
+        capacity = varid_bound();
+
+    varinfo_table.table = realloc(varinfo_table.table,
+                                  capacity * sizeof(varinfo_t *));
+    varinfo_table.varids = realloc(varinfo_table.varids,
+                                   capacity * sizeof(int));
+    assert(varinfo_table.table && varinfo_table.varids);
+    for (int i = varinfo_table.capacity; i < capacity; ++i)
+        varinfo_table.table[i] = NULL;
+    varinfo_table.capacity = capacity;
 }
 
-void varinfolist_push_back(varinfo_t *vi)
+void varinfo_table_add(varinfo_t *vi)
 {
     assert(vi);
-    vilistnode_t *newnode = create_vilistnode(vi);
-    assert(newnode);
+    assert(!is_const_operand(&vi->var));
+    int varid = vi->var.varid;
+    varinfo_table_reserve(varid);
+    assert(!varinfo_table.table[varid]);
 
-    if (varinfolist.size == 0)
-        varinfolist.front = newnode;
-    else
-        varinfolist.back->next = newnode;
-    newnode->prev = varinfolist.back;
-    varinfolist.back = newnode;
-    varinfolist.size++;
+    varinfo_table.table[varid] = vi;
+    varinfo_table.varids[varinfo_table.size++] = varid;
 }
 
-varinfo_t *varinfolist_find(operand_t *var)
+varinfo_t *varinfo_table_find(operand_t *var)
 {
-    for (vilistnode_t *cur = varinfolist.front; cur != NULL; cur = cur->next) {
-        if (operand_is_equal(&cur->varinfo->var, var))
-            return cur->varinfo;
-    }
-    return NULL;
+    if (is_const_operand(var) || var->varid >= varinfo_table.capacity)
+        return NULL;
+    return varinfo_table.table[var->varid];
 }
 
-void print_varinfolist()
+void print_varinfo_table()
 {
-    for (vilistnode_t *cur = varinfolist.front; cur != NULL; cur = cur->next) {
-        print_varinfo(cur->varinfo);
+    for (int i = 0; i < varinfo_table.size; ++i) {
+        print_varinfo(varinfo_table.table[varinfo_table.varids[i]]);
         printf("\n");
     }
 }
 
-int varinfolist_try_add_var(operand_t *var, int size, int offset);
+void collect_needed_vars(iclistnode_t *funcdefnode);
+void needed_vars_clear_marks();
+int varinfo_table_try_add_var(operand_t *var, int size, int offset);
 int collect_varinfo_param(ic_param_t *ic, int n_param, int offset);
 int collect_varinfo_dec(ic_dec_t *ic, int offset);
 int collect_varinfo_assign(ic_assign_t *ic, int offset);
@@ -124,6 +127,7 @@ int collect_varinfo(iclistnode_t *funcdefnode)
     int offset = 0;
     int n_param = 1;
 
+    collect_needed_vars(funcdefnode);
     for (iclistnode_t *cur = funcdefnode->next; cur != NULL; cur = cur->next) {
         intercode_t *ic = cur->ic;
         if (ic->kind == IC_FUNCDEF)
@@ -161,109 +165,256 @@ int collect_varinfo(iclistnode_t *funcdefnode)
             break;
         }
     }
+    needed_vars_clear_marks();
 
     return offset; /* the total offset that should be added to $SP. */
 }
 
-int varinfolist_try_add_var(operand_t *var, int size, int offset)
+/* Variables never read in the function are dead wherever they are
+ * written, so they are never written back and need no slot. Arrays and
+ * parameters always get theirs unless kept in registers. */
+static struct {
+    int capacity;
+    char *table;        /* indexed by varid */
+    char *in_reg;       /* marked by 'varinfo_table_keep_in_reg' */
+    int *slots;         /* marked by 'varinfo_table_share_slot', or -1 */
+    int *slot_offsets;  /* indexed by slot number, or 0 if not given */
+    int shared_bytes;
+    char *n_defs;       /* up to 2 */
+    operand_t *remats;  /* the operands of the last definitions */
+} needed_vars;
+
+void needed_vars_reserve(int varid)
+{
+    if (varid < needed_vars.capacity)
+        return;
+    int old = needed_vars.capacity, capacity = 2 * old;
+    if (capacity <= varid)
+        capacity = varid + 1;
+    if (capacity < varid_bound())
+        capacity = varid_bound();
+    needed_vars.table = realloc(needed_vars.table, capacity);
+    needed_vars.in_reg = realloc(needed_vars.in_reg, capacity);
+    needed_vars.slots = realloc(needed_vars.slots, capacity * sizeof(int));
+    needed_vars.slot_offsets = realloc(needed_vars.slot_offsets, capacity * sizeof(int));
+    needed_vars.n_defs = realloc(needed_vars.n_defs, capacity);
+    needed_vars.remats = realloc(needed_vars.remats, capacity * sizeof(operand_t));
+    assert(needed_vars.table && needed_vars.in_reg &&
+           needed_vars.slots && needed_vars.slot_offsets &&
+           needed_vars.n_defs && needed_vars.remats);
+    memset(needed_vars.table + old, 0, capacity - old);
+    memset(needed_vars.in_reg + old, 0, capacity - old);
+    memset(needed_vars.n_defs + old, 0, capacity - old);
+    for (int i = old; i < capacity; ++i) {
+        needed_vars.slots[i] = -1;
+        needed_vars.slot_offsets[i] = 0;
+    }
+    needed_vars.capacity = capacity;
+}
+
+void needed_vars_add(operand_t *var)
 {
     if (is_const_operand(var))
+        return;
+    needed_vars_reserve(var->varid);
+    needed_vars.table[var->varid] = 1;
+}
+
+void needed_vars_define(operand_t *var, intercode_t *ic)
+{
+    needed_vars_reserve(var->varid);
+    if (needed_vars.n_defs[var->varid] < 2)
+        needed_vars.n_defs[var->varid]++;
+    operand_t *remat = &needed_vars.remats[var->varid];
+    remat->kind = OPERAND_NONE;
+    if (ic->kind == IC_ASSIGN && is_const_operand(&((ic_assign_t *)ic)->rhs))
+        *remat = ((ic_assign_t *)ic)->rhs;
+    else if (ic->kind == IC_REF)
+        *remat = ((ic_ref_t *)ic)->rhs;
+}
+
+int needed_vars_is_remat(operand_t *var)
+{
+    return needed_vars.n_defs[var->varid] == 1 &&
+           needed_vars.remats[var->varid].kind != OPERAND_NONE;
+}
+
+void varinfo_table_keep_in_reg(operand_t *var)
+{
+    assert(!is_const_operand(var));
+    needed_vars_reserve(var->varid);
+    needed_vars.in_reg[var->varid] = 1;
+}
+
+void varinfo_table_share_slot(operand_t *var, int slot)
+{
+    assert(!is_const_operand(var) && slot >= 0);
+    needed_vars_reserve(var->varid > slot ? var->varid : slot);
+    needed_vars.slots[var->varid] = slot;
+}
+
+int varinfo_table_shared_bytes()
+{
+    return needed_vars.shared_bytes;
+}
+
+void needed_vars_clear_marks()
+{
+    if (needed_vars.capacity)
+        memset(needed_vars.in_reg, 0, needed_vars.capacity);
+    for (int i = 0; i < needed_vars.capacity; ++i) {
+        needed_vars.slots[i] = -1;
+        needed_vars.slot_offsets[i] = 0;
+    }
+}
+
+void collect_needed_vars(iclistnode_t *funcdefnode)
+{
+    memset(needed_vars.table, 0, needed_vars.capacity);
+    memset(needed_vars.n_defs, 0, needed_vars.capacity);
+    needed_vars.shared_bytes = 0;
+    for (iclistnode_t *cur = funcdefnode->next; cur != NULL; cur = cur->next) {
+        intercode_t *ic = cur->ic;
+        if (ic->kind == IC_FUNCDEF)
+            break;
+        operand_t *uses[2];
+        int n_uses = intercode_uses(ic, uses);
+        for (int i = 0; i < n_uses; ++i)
+            needed_vars_add(uses[i]);
+        operand_t *def = intercode_def(ic);
+        if (def)
+            needed_vars_define(def, ic);
+        if (ic->kind == IC_PARAM)
+            needed_vars_add(&((ic_param_t *)ic)->var);
+        else if (ic->kind == IC_DEC)
+            needed_vars_add(&((ic_dec_t *)ic)->var);
+        else if (ic->kind == IC_REF) {
+            /* It may be changed through its address, so it is never
+             * rematerialized. */
+            operand_t *rhs = &((ic_ref_t *)ic)->rhs;
+            needed_vars_add(rhs);
+            needed_vars.n_defs[rhs->varid] = 2;
+        }
+    }
+}
+
+int varinfo_table_try_add_var(operand_t *var, int size, int offset)
+{
+    if (is_const_operand(var))
+        return offset;
+    if (var->varid >= needed_vars.capacity || !needed_vars.table[var->varid] ||
+        needed_vars.in_reg[var->varid])
         return offset;
 
-    if (varinfolist_find(var))
+    if (varinfo_table_find(var))
         return offset;
 
+    if (needed_vars_is_remat(var)) {
+        varinfo_t *varinfo = create_varinfo(var, R_NONE, 0);
+        assert(varinfo);
+        varinfo->remat = needed_vars.remats[var->varid];
+        varinfo_table_add(varinfo);
+        return offset;
+    }
+    int slot = needed_vars.slots[var->varid];
+    if (slot >= 0 && size == 4 && needed_vars.slot_offsets[slot]) {
+        varinfo_table_add(create_varinfo(var, R_FP, needed_vars.slot_offsets[slot]));
+        needed_vars.shared_bytes += 4;
+        return offset;
+    }
     offset -= size;
-    varinfolist_push_back(create_varinfo(var, R_FP, offset));
+    varinfo_table_add(create_varinfo(var, R_FP, offset));
+    if (slot >= 0 && size == 4)
+        needed_vars.slot_offsets[slot] = offset;
     return offset;
 }
 
 int collect_varinfo_param(ic_param_t *ic, int n_param, int offset)
 {
     if (n_param <= 4) {
-        offset = varinfolist_try_add_var(&ic->var, 4, offset);
+        offset = varinfo_table_try_add_var(&ic->var, 4, offset);
         int reg = R_A0 + n_param - 1;
         reginfo_table_alloc_reg(reg, &ic->var);
         reginfo_table_set_dirty(reg);
         return offset;
     }
     else {
-        varinfolist_push_back(create_varinfo(&ic->var, R_FP, 8 + 4 * (n_param - 5)));
+        varinfo_table_add(create_varinfo(&ic->var, R_FP, 8 + 4 * (n_param - 5)));
         return offset;
     }
 }
 
 int collect_varinfo_dec(ic_dec_t *ic, int offset)
 {
-    return varinfolist_try_add_var(&ic->var, ic->size, offset);
+    return varinfo_table_try_add_var(&ic->var, ic->size, offset);
 }
 
 int collect_varinfo_assign(ic_assign_t *ic, int offset)
 {
-    offset = varinfolist_try_add_var(&ic->lhs, 4, offset);
-    offset = varinfolist_try_add_var(&ic->rhs, 4, offset);
+    offset = varinfo_table_try_add_var(&ic->lhs, 4, offset);
+    offset = varinfo_table_try_add_var(&ic->rhs, 4, offset);
     return offset;
 }
 
 int collect_varinfo_arithbop(ic_arithbop_t *ic, int offset)
 {
-    offset = varinfolist_try_add_var(&ic->lhs, 4, offset);
-    offset = varinfolist_try_add_var(&ic->rhs, 4, offset);
-    offset = varinfolist_try_add_var(&ic->target, 4, offset);
+    offset = varinfo_table_try_add_var(&ic->lhs, 4, offset);
+    offset = varinfo_table_try_add_var(&ic->rhs, 4, offset);
+    offset = varinfo_table_try_add_var(&ic->target, 4, offset);
     return offset;
 }
 
 int collect_varinfo_ref(ic_ref_t *ic, int offset)
 {
-    offset = varinfolist_try_add_var(&ic->lhs, 4, offset);
-    offset = varinfolist_try_add_var(&ic->rhs, 4, offset);
+    offset = varinfo_table_try_add_var(&ic->lhs, 4, offset);
+    offset = varinfo_table_try_add_var(&ic->rhs, 4, offset);
     return offset;
 }
 
 int collect_varinfo_dref(ic_dref_t *ic, int offset)
 {
-    offset = varinfolist_try_add_var(&ic->lhs, 4, offset);
-    offset = varinfolist_try_add_var(&ic->rhs, 4, offset);
+    offset = varinfo_table_try_add_var(&ic->lhs, 4, offset);
+    offset = varinfo_table_try_add_var(&ic->rhs, 4, offset);
     return offset;
 }
 
 int collect_varinfo_drefassign(ic_drefassign_t *ic, int offset)
 {
-    offset = varinfolist_try_add_var(&ic->lhs, 4, offset);
-    offset = varinfolist_try_add_var(&ic->rhs, 4, offset);
+    offset = varinfo_table_try_add_var(&ic->lhs, 4, offset);
+    offset = varinfo_table_try_add_var(&ic->rhs, 4, offset);
     return offset;
 }
 
 int collect_varinfo_condgoto(ic_condgoto_t *ic, int offset)
 {
-    offset = varinfolist_try_add_var(&ic->lhs, 4, offset);
-    offset = varinfolist_try_add_var(&ic->rhs, 4, offset);
+    offset = varinfo_table_try_add_var(&ic->lhs, 4, offset);
+    offset = varinfo_table_try_add_var(&ic->rhs, 4, offset);
     return offset;
 }
 
 int collect_varinfo_return(ic_return_t *ic, int offset)
 {
-    return varinfolist_try_add_var(&ic->ret, 4, offset);
+    return varinfo_table_try_add_var(&ic->ret, 4, offset);
 }
 
 int collect_varinfo_arg(ic_arg_t *ic, int offset)
 {
-    return varinfolist_try_add_var(&ic->arg, 4, offset);
+    return varinfo_table_try_add_var(&ic->arg, 4, offset);
 }
 
 int collect_varinfo_call(ic_call_t *ic, int offset)
 {
-    return varinfolist_try_add_var(&ic->ret, 4, offset);
+    return varinfo_table_try_add_var(&ic->ret, 4, offset);
 }
 
 int collect_varinfo_read(ic_read_t *ic, int offset)
 {
-    return varinfolist_try_add_var(&ic->var, 4, offset);
+    return varinfo_table_try_add_var(&ic->var, 4, offset);
 }
 
 int collect_varinfo_write(ic_write_t *ic, int offset)
 {
-    return varinfolist_try_add_var(&ic->var, 4, offset);
+    return varinfo_table_try_add_var(&ic->var, 4, offset);
 }
 
 /* ------------------------------------ *
@@ -272,6 +423,47 @@ int collect_varinfo_write(ic_write_t *ic, int offset)
 
 static reginfo_t reginfo_table[REG_SIZE];
 
+#define REG_BEGIN   R_T0
+#define REG_END     R_T9
+
+/* The registers handed out by the local allocator. A global allocator
+ * keeps most of them for itself, leaving a few to load the variables
+ * living in memory. */
+static struct {
+    int is_set;
+    int is_leaf;
+    char regs[REG_SIZE];
+} reg_pool;
+
+/* Map from varid to the reg where the var is loaded, or R_NONE. */
+static struct {
+    int capacity;
+    int *table;
+} var_reg_map;
+
+void var_reg_map_reserve(int varid)
+{
+    if (varid < var_reg_map.capacity)
+        return;
+
+    int capacity = 2 * var_reg_map.capacity;
+    if (capacity <= varid)
+        capacity = varid + 1;
+    if (capacity < varid_bound())
+        capacity = varid_bound();
+
+    var_reg_map.table = realloc(var_reg_map.table, capacity * sizeof(int));
+    assert(var_reg_map.table);
+    for (int i = var_reg_map.capacity; i < capacity; ++i)
+        var_reg_map.table[i] = R_NONE;
+    var_reg_map.capacity = capacity;
+}
+
+int is_mapped_operand(operand_t *var)
+{
+    return var->kind == OPERAND_VAR || var->kind == OPERAND_ADDR;
+}
+
 const char *get_regalias(int reg)
 {
     static const char *regalias[REG_SIZE] = {
@@ -289,9 +481,16 @@ const char *get_regalias(int reg)
 
 void init_reginfo_table()
 {
+    for (int reg = R_ZERO; reg <= R_RA; ++reg) {
+        operand_t *var = &reginfo_table[reg].var_loaded;
+        if (!reginfo_table[reg].is_empty && is_mapped_operand(var) &&
+            var->varid < var_reg_map.capacity)
+            var_reg_map.table[var->varid] = R_NONE;
+    }
+
     memset(&reginfo_table, 0, sizeof(reginfo_table));
     for (int reg = R_ZERO; reg <= R_RA; ++reg) {
-        if (reg >= R_A0 && reg <= R_T9) {
+        if (reginfo_table_is_local(reg)) {
             reginfo_table[reg].is_empty = 1;
             reginfo_table[reg].is_locked = 0;
         }
@@ -302,6 +501,33 @@ void init_reginfo_table()
     }
 }
 
+void reginfo_table_set_pool(const int *regs, int n_regs)
+{
+    memset(reg_pool.regs, 0, sizeof(reg_pool.regs));
+    for (int i = 0; i < n_regs; ++i)
+        reg_pool.regs[regs[i]] = 1;
+    reg_pool.is_set = 1;
+    init_reginfo_table();
+}
+
+void reginfo_table_set_leaf(int is_leaf)
+{
+    reg_pool.is_leaf = is_leaf;
+}
+
+int reginfo_table_in_pool(int reg)
+{
+    if (!reg_pool.is_set)
+        return (reg >= REG_BEGIN && reg <= REG_END) ||
+               (reg_pool.is_leaf && (reg == R_V0 || (reg >= R_A0 && reg <= R_A3)));
+    return reg_pool.regs[reg];
+}
+
+int reginfo_table_is_local(int reg)
+{
+    return (reg >= R_A0 && reg <= R_A3) || reginfo_table_in_pool(reg);
+}
+
 void reginfo_table_clear()
 {
     init_reginfo_table();
@@ -309,7 +535,9 @@ void reginfo_table_clear()
 
 void print_reginfo_table()
 {
-    for (int reg = R_A0; reg <= R_T9; ++reg) {
+    for (int reg = R_ZERO; reg <= R_RA; ++reg) {
+        if (!reginfo_table_is_local(reg))
+            continue;
         printf("%s(%c%c%c): ", get_regalias(reg),
                reginfo_table[reg].is_empty ? '-' : 'f',
                reginfo_table[reg].is_locked ? 'l' : '-',
@@ -354,56 +582,58 @@ void reginfo_table_clear_dirty(int reg)
 
 int reginfo_table_find_var(operand_t *var)
 {
-    for (int reg = R_A0; reg <= R_T9; ++reg)
-        if (!reginfo_table[reg].is_empty &&
+    if (is_mapped_operand(var)) {
+        if (var->varid >= var_reg_map.capacity)
+            return R_NONE;
+        return var_reg_map.table[var->varid];
+    }
+
+    /* Only constants are left, and there are few of them in regs. */
+    for (int reg = R_ZERO; reg <= R_RA; ++reg)
+        if (reginfo_table_is_local(reg) && !reginfo_table[reg].is_empty &&
             operand_is_equal(&reginfo_table[reg].var_loaded, var))
             return reg;
     return R_NONE;
 }
 
-#define REG_BEGIN   R_T0
-#define REG_END     R_T9
-
 int reginfo_table_find_empty()
 {
-    for (int reg = REG_BEGIN; reg <= REG_END; ++reg)
-        if (reginfo_table[reg].is_empty)
+    for (int reg = R_ZERO; reg <= R_RA; ++reg)
+        if (reginfo_table_in_pool(reg) && reginfo_table[reg].is_empty)
             return reg;
     return R_NONE;
 }
 
+/* The value evicted is the one read furthest away, as Belady would have
+ * it. Among those, a clean value, a constant or a rematerialized one
+ * costs nothing to drop, and a dirty temporary is likely dead. */
+int reginfo_table_evict_score(int reg)
+{
+    reginfo_t *info = &reginfo_table[reg];
+    int is_const = is_const_operand(&info->var_loaded);
+    int distance = (is_const ? NEXTUSE_NONE : nextuse_table_distance(&info->var_loaded));
+    varinfo_t *varinfo = (is_const ? NULL : varinfo_table_find(&info->var_loaded));
+    int rank = 1;
+    if (is_const || !info->is_dirty || (varinfo && varinfo->remat.kind != OPERAND_NONE))
+        rank = 3;
+    else if (info->var_loaded.is_temp)
+        rank = 2;
+    return 4 * distance + rank;
+}
+
 int reginfo_table_find_expellable()
 {
     int best_reg = R_NONE;
     int best_score = 0;
 
-    for (int reg = REG_BEGIN; reg <= REG_END; ++reg) {
-        if (!reginfo_table[reg].is_empty && !reginfo_table[reg].is_locked) {
-            if (is_const_operand(&reginfo_table[reg].var_loaded)) {
-                if (best_score < 4) {
-                    best_reg = reg;
-                    best_score = 4;
-                }
-            }
-            else if (!reginfo_table[reg].is_dirty) {
-                if (best_score < 3) {
-                    best_reg = reg;
-                    best_score = 3;
-                }
-            }
-            else if (reginfo_table[reg].var_loaded.is_temp) {
-                if (best_score < 2) {
-                    best_reg = reg;
-                    best_score = 2;
-                }
-            }
-            else {
-                if (best_score < 1) {
-                    best_reg = reg;
-                    best_score = 1;
-                }
+    for (int reg = R_ZERO; reg <= R_RA; ++reg) {
+        if (reginfo_table_in_pool(reg) && !reginfo_table[reg].is_empty &&
+            !reginfo_table[reg].is_locked) {
+            int score = reginfo_table_evict_score(reg);
+            if (score > best_score) {
+                best_reg = reg;
+                best_score = score;
             }
-            return reg;
         }
     }
     return best_reg;
@@ -417,6 +647,14 @@ operand_t reginfo_table_get_var(int reg)
 
 void reginfo_table_alloc_reg(int reg, operand_t *var)
 {
+    if (!reginfo_table[reg].is_empty)
+        reginfo_table_free_reg(reg);
+    if (is_mapped_operand(var)) {
+        var_reg_map_reserve(var->varid);
+        assert(var_reg_map.table[var->varid] == R_NONE);
+        var_reg_map.table[var->varid] = reg;
+    }
+
     reginfo_table[reg].is_empty = 0;
     reginfo_table[reg].is_locked = 0;
     reginfo_table[reg].is_dirty = 0;
@@ -426,7 +664,141 @@ void reginfo_table_alloc_reg(int reg, operand_t *var)
 operand_t reginfo_table_free_reg(int reg)
 {
     operand_t ret = reginfo_table[reg].var_loaded;
+    if (!reginfo_table[reg].is_empty && is_mapped_operand(&ret))
+        var_reg_map.table[ret.varid] = R_NONE;
     memset(&reginfo_table[reg], 0, sizeof(reginfo_table[reg]));
     reginfo_table[reg].is_empty = 1;
     return ret;
 }
+
+/* ------------------------------------ *
+ *            next use table            *
+ * ------------------------------------ */
+
+/* The accesses of every variable in ascending order, indexed by varid.
+ * An access is 2 * n for intercode n reading the variable, and 2 * n + 1
+ * for it only writing the variable. */
+static struct {
+    int pos;
+    int n_codes;
+    int *block_ends;    /* the intercode beginning the next block, by intercode */
+    int capacity;
+    int *n_accesses;
+    int *sizes;
+    int **accesses;
+} nextuse_table;
+
+void nextuse_table_reserve(int varid)
+{
+    if (varid < nextuse_table.capacity)
+        return;
+
+    int capacity = 2 * nextuse_table.capacity;
+    if (capacity <= varid)
+        capacity = varid + 1;
+    if (capacity < varid_bound())
+        capacity = varid_bound();
+
+    nextuse_table.n_accesses = realloc(nextuse_table.n_accesses, capacity * sizeof(int));
+    nextuse_table.sizes = realloc(nextuse_table.sizes, capacity * sizeof(int));
+    nextuse_table.accesses = realloc(nextuse_table.accesses, capacity * sizeof(int *));
+    assert(nextuse_table.n_accesses && nextuse_table.sizes && nextuse_table.accesses);
+    for (int i = nextuse_table.capacity; i < capacity; ++i) {
+        nextuse_table.n_accesses[i] = nextuse_table.sizes[i] = 0;
+        nextuse_table.accesses[i] = NULL;
+    }
+    nextuse_table.capacity = capacity;
+}
+
+void nextuse_table_add(operand_t *var, int access)
+{
+    if (!is_mapped_operand(var))
+        return;
+    int id = var->varid;
+    nextuse_table_reserve(id);
+    int n = nextuse_table.n_accesses[id];
+    if (n > 0 && nextuse_table.accesses[id][n - 1] / 2 == access / 2)
+        return;     /* Read and written by the same intercode */
+    if (n == nextuse_table.sizes[id]) {
+        nextuse_table.sizes[id] = (n ? 2 * n : 4);
+        nextuse_table.accesses[id] = realloc(nextuse_table.accesses[id],
+                                             nextuse_table.sizes[id] * sizeof(int));
+        assert(nextuse_table.accesses[id]);
+    }
+    nextuse_table.accesses[id][nextuse_table.n_accesses[id]++] = access;
+}
+
+int nextuse_is_block_end(intercode_t *ic)
+{
+    return ic->kind == IC_GOTO || ic->kind == IC_CONDGOTO ||
+           ic->kind == IC_RETURN;
+}
+
+void nextuse_table_end_block(int *start, int end)
+{
+    for (int i = *start; i < end; ++i)
+        nextuse_table.block_ends[i] = end;
+    *start = end;
+}
+
+void collect_nextuse(iclistnode_t *funcdefnode)
+{
+    assert(funcdefnode->ic->kind == IC_FUNCDEF);
+    for (int i = 0; i < nextuse_table.capacity; ++i)
+        nextuse_table.n_accesses[i] = 0;
+
+    int n = 0;
+    for (iclistnode_t *cur = funcdefnode; cur != NULL; cur = cur->next, ++n) {
+        intercode_t *ic = cur->ic;
+        if (ic->kind == IC_FUNCDEF && cur != funcdefnode)
+            break;
+        operand_t *uses[2];
+        int n_uses = intercode_uses(ic, uses);
+        for (int i = 0; i < n_uses; ++i)
+            nextuse_table_add(uses[i], 2 * n);
+        operand_t *def = intercode_def(ic);
+        if (def)
+            nextuse_table_add(def, 2 * n + 1);
+    }
+    nextuse_table.n_codes = n;
+    nextuse_table.pos = 0;
+
+    nextuse_table.block_ends = realloc(nextuse_table.block_ends, (n ? n : 1) * sizeof(int));
+    assert(nextuse_table.block_ends);
+    int start = 0, i = 0;
+    for (iclistnode_t *cur = funcdefnode; i < n; cur = cur->next, ++i) {
+        if (cur->ic->kind == IC_LABEL)
+            nextuse_table_end_block(&start, i);
+        if (nextuse_is_block_end(cur->ic))
+            nextuse_table_end_block(&start, i + 1);
+    }
+    nextuse_table_end_block(&start, n);
+}
+
+void nextuse_table_set_pos(int pos)
+{
+    nextuse_table.pos = pos;
+}
+
+int nextuse_table_distance(operand_t *var)
+{
+    if (!is_mapped_operand(var) || var->varid >= nextuse_table.capacity)
+        return NEXTUSE_NONE;
+
+    /* Find the first access at or after the current intercode. */
+    int *accesses = nextuse_table.accesses[var->varid];
+    int lo = 0, hi = nextuse_table.n_accesses[var->varid];
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (accesses[mid] < 2 * nextuse_table.pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == nextuse_table.n_accesses[var->varid] || nextuse_table.pos >= nextuse_table.n_codes)
+        return NEXTUSE_NONE;
+    int next = accesses[lo];
+    if (next % 2 == 1 || next / 2 >= nextuse_table.block_ends[nextuse_table.pos])
+        return NEXTUSE_NONE;
+    return next / 2 - nextuse_table.pos;
+}
@@ -4,7 +4,7 @@
 #include "intercodes.h"
 
 /* ------------------------------------ *
- *            var info list             *
+ *            var info table            *
  * ------------------------------------ */
 
 typedef struct varinfo
@@ -15,18 +15,36 @@ typedef struct varinfo
      * its relative position in the stack. */
     int reg;
     int offset;
+    /* A variable only ever assigned a constant, or the address of another
+     * variable in the frame, is recomputed from that operand instead of
+     * being stored and loaded, and needs no slot. Otherwise the operand is
+     * OPERAND_NONE. */
+    operand_t remat;
 } varinfo_t;
 
 varinfo_t *create_varinfo(operand_t *var, int reg, int offset);
 void print_varinfo(varinfo_t *vi);
 
-void init_varinfolist();
-void varinfolist_clear();
-void varinfolist_push_back(varinfo_t *vi);
-varinfo_t *varinfolist_find(operand_t *var);
-void print_varinfolist();
-
+/* The table is indexed by varid directly, so finding where a variable
+ * lives in the stack takes constant time. */
+void init_varinfo_table();
+void varinfo_table_clear();
+void varinfo_table_add(varinfo_t *vi);
+varinfo_t *varinfo_table_find(operand_t *var);
+void print_varinfo_table();
+
+/* Variables never read in the function get no slot, and neither do
+ * those rematerialized or kept in registers all along by the global
+ * allocator. Variables
+ * whose lives do not overlap may be given the same slot number to share
+ * a slot. Both are marked before and unmarked by 'collect_varinfo'. The
+ * parameters passed in $a0..$a3 are left there dirty for the local
+ * allocator. */
+void varinfo_table_keep_in_reg(operand_t *var);
+void varinfo_table_share_slot(operand_t *var, int slot);
 int collect_varinfo(iclistnode_t *funcdefnode);
+/* The bytes saved by sharing slots in the last 'collect_varinfo'. */
+int varinfo_table_shared_bytes();
 
 
 /* ------------------------------------ *
@@ -58,6 +76,16 @@ void init_reginfo_table();
 void reginfo_table_clear();
 void print_reginfo_table();
 
+/* By default the local allocator hands out $t0..$t9, taking $s0..$s7 in
+ * between as well, since nothing is kept in registers across calls.
+ * $a0..$a3 are always in the table for the parameters. */
+void reginfo_table_set_pool(const int *regs, int n_regs);
+/* In a leaf function nothing clobbers $v0 and $a0..$a3, so the default
+ * pool takes them as well. $v1 is left to break cycles of moves. */
+void reginfo_table_set_leaf(int is_leaf);
+int reginfo_table_in_pool(int reg);
+int reginfo_table_is_local(int reg);
+
 int reginfo_table_is_empty(int reg);
 void reginfo_table_lock(int reg);
 void reginfo_table_unlock(int reg);
@@ -65,6 +93,8 @@ int reginfo_table_is_dirty(int reg);
 void reginfo_table_set_dirty(int reg);
 void reginfo_table_clear_dirty(int reg);
 
+/* Variables are looked up through a varid-indexed map that is kept in
+ * sync by 'reginfo_table_alloc_reg' and 'reginfo_table_free_reg'. */
 int reginfo_table_find_var(operand_t *var);
 int reginfo_table_find_empty();
 int reginfo_table_find_expellable();
@@ -73,4 +103,23 @@ operand_t reginfo_table_get_var(int reg);
 void reginfo_table_alloc_reg(int reg, operand_t *var);
 operand_t reginfo_table_free_reg(int reg);
 
+
+/* ------------------------------------ *
+ *            next use table            *
+ * ------------------------------------ */
+
+/* The intercodes of a function are numbered from its FUNCDEF, and every
+ * variable keeps the intercodes reading or writing it, so that the local
+ * allocator evicts the value read furthest away in the current block.
+ * Blocks end where every register is written back: at labels and jumps.
+ * Calls write back only the registers the callee clobbers. */
+
+#define NEXTUSE_NONE    (1 << 20)
+
+void collect_nextuse(iclistnode_t *funcdefnode);
+void nextuse_table_set_pos(int pos);
+/* Return how many intercodes ahead 'var' is read in the current block,
+ * or NEXTUSE_NONE if it is written first or not read at all. */
+int nextuse_table_distance(operand_t *var);
+
 #endif
\ No newline at end of file
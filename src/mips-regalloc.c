@@ -0,0 +1,392 @@
+#include "mips-regalloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* ------------------------------------ *
+ *            live intervals            *
+ * ------------------------------------ */
+
+int regalloc_is_allocatable(int reg, int is_leaf)
+{
+    if (is_leaf && (reg == R_V0 || (reg >= R_A0 && reg <= R_A3)))
+        return 1;
+    return (reg >= R_T0 && reg <= R_T7) || (reg >= R_S0 && reg <= R_S7);
+}
+
+int regalloc_is_callee_saved(int reg)
+{
+    return reg >= R_S0 && reg <= R_S7;
+}
+
+void regalloc_extend(regalloc_t *ra, operand_t *var, int pos)
+{
+    int i = cfg_var_index(ra->cfg, var);
+    if (i < 0)
+        return;
+    interval_t *it = &ra->intervals[i];
+    if (it->start < 0 || pos < it->start)
+        it->start = pos;
+    if (pos > it->end)
+        it->end = pos;
+}
+
+/* Number the intercodes by blocks and build the intervals, walking every
+ * block backward from the variables live out of it. */
+void regalloc_build_intervals(regalloc_t *ra)
+{
+    cfg_t *cfg = ra->cfg;
+    ra->n_codes = ra->func->body.size;
+    ra->block_of = malloc(ra->n_codes * sizeof(int));
+    ra->block_first = malloc((cfg->n_blocks + 1) * sizeof(int));
+    ra->call_lives = calloc(ra->n_codes, sizeof(bitset_t *));
+    ra->intervals = malloc((cfg->n_vars ? cfg->n_vars : 1) * sizeof(interval_t));
+    assert(ra->block_of && ra->block_first && ra->call_lives && ra->intervals);
+    for (int i = 0; i < cfg->n_vars; ++i) {
+        ra->intervals[i].start = ra->intervals[i].end = -1;
+        ra->intervals[i].reg = R_NONE;
+        ra->intervals[i].spill_pos = 0;
+        ra->intervals[i].crosses_call = 0;
+    }
+
+    int n = 0;
+    for (int b = 0; b < cfg->n_blocks; ++b) {
+        ra->block_first[b] = n;
+        block_foreach(node, cfg->blocks[b])
+            ra->block_of[n++] = b;
+    }
+    ra->block_first[cfg->n_blocks] = n;
+    assert(n == ra->n_codes);
+
+    bitset_t *state = create_bitset(cfg->n_vars);
+    for (int b = 0; b < cfg->n_blocks; ++b) {
+        block_t *block = cfg->blocks[b];
+        int pos = 2 * ra->block_first[b + 1] - 1;
+        for (int v = 0; v < cfg->n_vars; ++v) {
+            operand_t var;
+            init_var_operand(&var, cfg->varids[v]);
+            if (bitset_contains(ra->live->out[b], v))
+                regalloc_extend(ra, &var, pos);
+            if (bitset_contains(ra->live->in[b], v))
+                regalloc_extend(ra, &var, 2 * ra->block_first[b] - 1);
+        }
+
+        bitset_copy(state, ra->live->out[b]);
+        pos -= 1;
+        for (iclistnode_t *cur = block->last; cur != block->first->prev;
+             cur = cur->prev, pos -= 2) {
+            intercode_t *ic = cur->ic;
+            operand_t *def = intercode_def(ic);
+            if (ic->kind == IC_CALL) {
+                bitset_t *lives = create_bitset(cfg->n_vars);
+                bitset_copy(lives, state);
+                if (def)
+                    bitset_remove(lives, cfg_var_index(cfg, def));
+                ra->call_lives[pos / 2] = lives;
+                for (int v = 0; v < cfg->n_vars; ++v)
+                    if (bitset_contains(lives, v))
+                        ra->intervals[v].crosses_call = 1;
+            }
+            if (def)
+                regalloc_extend(ra, def, pos);
+            operand_t *uses[2];
+            int n_uses = intercode_uses(ic, uses);
+            for (int i = 0; i < n_uses; ++i)
+                regalloc_extend(ra, uses[i], pos);
+            liveness_transfer(cfg, ic, state);
+        }
+    }
+    destroy_bitset(state);
+}
+
+/* ------------------------------------ *
+ *             linear scan              *
+ * ------------------------------------ */
+
+/* The intervals are visited by their starts, keeping the active ones,
+ * which hold registers, in the order of their ends. When no register is
+ * free, the interval ending last is split at the current position: it
+ * keeps its register before, and lives in its stack slot after. The
+ * code generator stores it at the split, and moves values on the edges
+ * of the blocks whose ends disagree about where a variable is. */
+
+static struct {
+    regalloc_t *ra;
+    int n_active;
+    int active[REG_SIZE];
+    int is_free[REG_SIZE];
+} linscan;
+
+int compare_interval_start(const void *lhs, const void *rhs)
+{
+    interval_t *intervals = linscan.ra->intervals;
+    interval_t *a = &intervals[*(int *)lhs], *b = &intervals[*(int *)rhs];
+    if (a->start != b->start)
+        return a->start - b->start;
+    return *(int *)lhs - *(int *)rhs;
+}
+
+int compare_split_pos(const void *lhs, const void *rhs)
+{
+    interval_t *intervals = linscan.ra->intervals;
+    return intervals[*(int *)lhs].spill_pos - intervals[*(int *)rhs].spill_pos;
+}
+
+void linscan_add_active(int v)
+{
+    interval_t *intervals = linscan.ra->intervals;
+    int i = linscan.n_active++;
+    for (; i > 0 && intervals[linscan.active[i - 1]].end > intervals[v].end; --i)
+        linscan.active[i] = linscan.active[i - 1];
+    linscan.active[i] = v;
+}
+
+void linscan_expire(int pos)
+{
+    interval_t *intervals = linscan.ra->intervals;
+    int n = 0;
+    for (int i = 0; i < linscan.n_active; ++i) {
+        int v = linscan.active[i];
+        if (intervals[v].end <= pos)
+            linscan.is_free[intervals[v].reg] = 1;
+        else
+            linscan.active[n++] = v;
+    }
+    linscan.n_active = n;
+}
+
+void linscan_split(int v, int pos)
+{
+    regalloc_t *ra = linscan.ra;
+    interval_t *it = &ra->intervals[v];
+    it->spill_pos = pos;
+    if (pos <= it->start)
+        it->reg = R_NONE;
+    else if (pos % 2 == 0)
+        ra->splits[ra->n_splits++] = v;
+    ra->n_spilled++;
+}
+
+/* Values live across calls go to callee-saved registers first, and the
+ * others to the rest first. */
+int linscan_find_free(int crosses_call)
+{
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int reg = 0; reg < REG_SIZE; ++reg) {
+            if (linscan.is_free[reg] &&
+                regalloc_is_callee_saved(reg) == (pass == 0 ? crosses_call : !crosses_call))
+                return reg;
+        }
+    }
+    return R_NONE;
+}
+
+void linear_scan(regalloc_t *ra)
+{
+    int n_vars = ra->cfg->n_vars, n = 0;
+    int *order = malloc((n_vars ? n_vars : 1) * sizeof(int));
+    assert(order);
+    for (int v = 0; v < n_vars; ++v) {
+        ra->intervals[v].spill_pos = 2 * ra->n_codes;
+        if (ra->intervals[v].start >= 0)
+            order[n++] = v;
+    }
+    linscan.ra = ra;
+    qsort(order, n, sizeof(int), compare_interval_start);
+
+    linscan.n_active = 0;
+    for (int reg = 0; reg < REG_SIZE; ++reg)
+        linscan.is_free[reg] = regalloc_is_allocatable(reg, ra->is_leaf);
+
+    for (int k = 0; k < n; ++k) {
+        int v = order[k];
+        interval_t *it = &ra->intervals[v];
+        linscan_expire(it->start);
+
+        int reg = linscan_find_free(it->crosses_call);
+        if (reg != R_NONE) {
+            linscan.is_free[reg] = 0;
+            it->reg = reg;
+            linscan_add_active(v);
+            continue;
+        }
+
+        int last = linscan.active[linscan.n_active - 1];
+        if (ra->intervals[last].end > it->end) {
+            it->reg = ra->intervals[last].reg;
+            linscan.n_active--;
+            linscan_split(last, it->start);
+            linscan_add_active(v);
+        }
+        else {
+            linscan_split(v, it->start);
+        }
+    }
+    qsort(ra->splits, ra->n_splits, sizeof(int), compare_split_pos);
+    free(order);
+}
+
+/* ------------------------------------ *
+ *          callee-saved saves          *
+ * ------------------------------------ */
+
+/* A callee-saved register is saved in the block dominating all those
+ * touching it, so that paths around them skip the save. The block must
+ * not be on a cycle, which would save it again, and must dominate every
+ * return reachable from it, where it is restored. Otherwise it is saved
+ * on entry. */
+
+void regalloc_reach(block_t *block, char *is_reached)
+{
+    for (int i = 0; i < block->n_succs; ++i) {
+        block_t *succ = block->succs[i];
+        if (!is_reached[succ->id]) {
+            is_reached[succ->id] = 1;
+            regalloc_reach(succ, is_reached);
+        }
+    }
+}
+
+int regalloc_common_dominator(int *idoms, int a, int b)
+{
+    while (!idoms_dominate(idoms, a, b))
+        a = idoms[a];
+    return a;
+}
+
+int regalloc_is_in(regalloc_t *ra, operand_t *var, int reg)
+{
+    int v = cfg_var_index(ra->cfg, var);
+    return v >= 0 && ra->intervals[v].reg == reg;
+}
+
+/* Whether the block touches a variable in 'reg'. */
+int regalloc_touches(regalloc_t *ra, int b, int reg)
+{
+    cfg_t *cfg = ra->cfg;
+    for (int v = 0; v < cfg->n_vars; ++v) {
+        if (ra->intervals[v].reg == reg &&
+            (bitset_contains(ra->live->in[b], v) || bitset_contains(ra->live->out[b], v)))
+            return 1;
+    }
+    block_foreach(node, cfg->blocks[b]) {
+        operand_t *def = intercode_def(node->ic), *uses[2];
+        int n_uses = intercode_uses(node->ic, uses);
+        if (def && regalloc_is_in(ra, def, reg))
+            return 1;
+        for (int i = 0; i < n_uses; ++i)
+            if (regalloc_is_in(ra, uses[i], reg))
+                return 1;
+    }
+    return 0;
+}
+
+int regalloc_find_save_block(regalloc_t *ra, int *idoms, int reg, char *is_saved)
+{
+    cfg_t *cfg = ra->cfg;
+    int save = -1;
+    for (int b = 0; b < cfg->n_blocks; ++b) {
+        if (idoms[b] == -1 || !regalloc_touches(ra, b, reg))
+            continue;
+        save = (save < 0 ? b : regalloc_common_dominator(idoms, save, b));
+    }
+
+    char *is_reached = malloc(cfg->n_blocks ? cfg->n_blocks : 1);
+    assert(is_reached);
+    while (save > 0) {
+        memset(is_reached, 0, cfg->n_blocks);
+        regalloc_reach(cfg->blocks[save], is_reached);
+        if (!is_reached[save])
+            break;
+        save = idoms[save];
+    }
+    for (int b = 0; save > 0 && b < cfg->n_blocks; ++b) {
+        intercode_t *last = cfg->blocks[b]->last->ic;
+        if (is_reached[b] && last->kind == IC_RETURN && !idoms_dominate(idoms, save, b))
+            save = 0;
+    }
+    for (int b = 0; b < cfg->n_blocks; ++b)
+        is_saved[b] = (save >= 0 && idoms[b] != -1 && idoms_dominate(idoms, save, b));
+    free(is_reached);
+    return save;
+}
+
+void regalloc_plan_saves(regalloc_t *ra)
+{
+    cfg_t *cfg = ra->cfg;
+    int *idoms = cfg_idoms(cfg);
+    ra->n_saved = 0;
+    for (int reg = R_S0; reg <= R_S7; ++reg) {
+        int v;
+        for (v = 0; v < cfg->n_vars; ++v)
+            if (ra->intervals[v].reg == reg)
+                break;
+        if (v == cfg->n_vars)
+            continue;
+        int i = ra->n_saved++;
+        ra->saved_regs[i] = reg;
+        ra->is_saved[i] = malloc(cfg->n_blocks ? cfg->n_blocks : 1);
+        assert(ra->is_saved[i]);
+        ra->save_blocks[i] = regalloc_find_save_block(ra, idoms, reg, ra->is_saved[i]);
+    }
+    free(idoms);
+}
+
+/* ------------------------------------ *
+ *              allocation              *
+ * ------------------------------------ */
+
+regalloc_t *create_regalloc(icfunc_t *func, int kind)
+{
+    regalloc_t *ra = malloc(sizeof(regalloc_t));
+    assert(ra);
+    ra->func = func;
+    ra->cfg = create_cfg(func);
+    ra->live = create_liveness(ra->cfg);
+    ra->is_leaf = 1;
+    for (iclistnode_t *node = func->body.front; node != NULL; node = node->next) {
+        int kind = node->ic->kind;
+        if (kind == IC_CALL || kind == IC_READ || kind == IC_WRITE)
+            ra->is_leaf = 0;
+    }
+    regalloc_build_intervals(ra);
+    ra->n_splits = ra->n_spilled = 0;
+    ra->splits = malloc((ra->cfg->n_vars ? ra->cfg->n_vars : 1) * sizeof(int));
+    assert(ra->splits);
+
+    if (kind == REGALLOC_GRAPH)
+        graph_coloring(ra);
+    else if (kind == REGALLOC_LINEAR)
+        linear_scan(ra);
+    else
+        assert(0);
+    regalloc_plan_saves(ra);
+    return ra;
+}
+
+void destroy_regalloc(regalloc_t *ra)
+{
+    for (int i = 0; i < ra->n_codes; ++i)
+        if (ra->call_lives[i])
+            destroy_bitset(ra->call_lives[i]);
+    free(ra->call_lives);
+    free(ra->block_of);
+    free(ra->block_first);
+    free(ra->intervals);
+    free(ra->splits);
+    for (int i = 0; i < ra->n_saved; ++i)
+        free(ra->is_saved[i]);
+    destroy_liveness(ra->live);
+    destroy_cfg(ra->cfg);
+    free(ra);
+}
+
+int regalloc_reg_at(regalloc_t *ra, operand_t *var, int pos)
+{
+    int i = cfg_var_index(ra->cfg, var);
+    if (i < 0)
+        return R_NONE;
+    interval_t *it = &ra->intervals[i];
+    return (pos < it->spill_pos ? it->reg : R_NONE);
+}
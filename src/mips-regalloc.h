@@ -0,0 +1,80 @@
+#ifndef _MIPS_REGALLOC_H
+#define _MIPS_REGALLOC_H
+
+#include "cfg.h"
+#include "mips-data.h"
+
+/* ------------------------------------ *
+ *      global register allocation      *
+ * ------------------------------------ */
+
+enum {
+    REGALLOC_DEFAULT, REGALLOC_LOCAL, REGALLOC_LINEAR, REGALLOC_GRAPH
+};
+
+/* The intercodes of a function are numbered in order, and intercode i
+ * is at position 2 * i. Position 2 * i - 1 is just before it, where the
+ * variables live into a block beginning with it are. */
+
+typedef struct interval {
+    /* The positions where the variable is live are within [start, end],
+     * and start is -1 if there are none. */
+    int start;
+    int end;
+    /* The variable is in 'reg' before 'spill_pos', and in its stack slot
+     * from there on. 'reg' is R_NONE if it is always in memory. */
+    int reg;
+    int spill_pos;
+    /* Whether the variable is live across a call, and so had better be
+     * in a callee-saved register. */
+    int crosses_call;
+} interval_t;
+
+typedef struct regalloc {
+    icfunc_t *func;
+    cfg_t *cfg;
+    liveness_t *live;
+    int n_codes;
+    int *block_of;      /* the block id of every intercode */
+    int *block_first;   /* the first intercode of every block, and n_codes */
+    int is_leaf;        /* calling nothing, not even read and write */
+    /* The intervals of the variables, indexed by dense index. */
+    interval_t *intervals;
+    /* The variables live across every CALL, except the one it defines,
+     * indexed by intercode. Other intercodes have NULL. */
+    bitset_t **call_lives;
+    /* The variables split in the middle of a block, by position. The
+     * code generator stores them to memory there. */
+    int n_splits;
+    int *splits;
+    int n_spilled;      /* the intervals split or left in memory */
+    /* The callee-saved registers used. Each is saved at the beginning of
+     * its save block, and restored before returning from the blocks in
+     * its 'is_saved'. The block is the entry unless a later one is
+     * enough, or -1 if the register is only used in unreachable code. */
+    int n_saved;
+    int saved_regs[8];
+    int save_blocks[8];
+    char *is_saved[8];      /* indexed by block id */
+} regalloc_t;
+
+regalloc_t *create_regalloc(icfunc_t *func, int kind);
+void destroy_regalloc(regalloc_t *ra);
+
+/* Return the register holding 'var' at 'pos', or R_NONE if it is in
+ * memory or a constant. */
+int regalloc_reg_at(regalloc_t *ra, operand_t *var, int pos);
+
+/* The allocators, filling in the registers of the intervals. Linear scan
+ * splits them and graph coloring keeps every variable in one place. */
+void linear_scan(regalloc_t *ra);
+void graph_coloring(regalloc_t *ra);
+
+/* Registers given out by linear scan, with $a0..$a3 and $v0 in leaf
+ * functions. The local allocator keeps the others to load the variables
+ * in memory. */
+int regalloc_is_allocatable(int reg, int is_leaf);
+/* $s0..$s7 are preserved across calls by the callees using them. */
+int regalloc_is_callee_saved(int reg);
+
+#endif
@@ -1,13 +1,18 @@
 #include "mips.h"
 #include "mips-data.h"
+#include "mips-regalloc.h"
+#include "callgraph.h"
+#include "optim.h"
 
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
 
 /* core */
 void gen_mips_framework(FILE *fp);
+void gen_mips_func(FILE *fp, icfunc_t *func, int kind);
 iclistnode_t *gen_mips_dispatch(FILE *fp, iclistnode_t *cur);
 iclistnode_t *gen_mips_funcdef(FILE *fp, iclistnode_t *cur);
 iclistnode_t *gen_mips_param(FILE *fp, iclistnode_t *cur);
@@ -53,32 +58,209 @@ void gen_mips_move(FILE *fp, int rd, int rs);
 
 /* utils */
 void gen_mips_add_sp(FILE *fp, int offset);
-void gen_mips_push(FILE *fp, int reg);
-void gen_mips_pop(FILE *fp, int reg);
 void gen_mips_load_var(FILE *fp, int reg, operand_t *var);
 void gen_mips_store_var(FILE *fp, int reg, operand_t *var);
+int gen_mips_is_remat(operand_t *var);
+int gen_mips_find_reg(operand_t *var);
 int gen_mips_get_reg(FILE *fp, operand_t *var, int is_lval);
 
 void gen_mips_prologue(FILE *fp);
 void gen_mips_epilogue(FILE *fp);
-void gen_mips_before_call(FILE *fp);
-void gen_mips_after_call(FILE *fp);
+int gen_mips_is_tail_call(iclistnode_t *cur);
+void gen_mips_scan_frame(iclistnode_t *funcdefnode);
+void gen_mips_frameless_params(iclistnode_t *funcdefnode);
 
 void gen_mips_writeback(FILE *fp, int reg);
 void gen_mips_writeback_args(FILE *fp);
 void gen_mips_writeback_vars(FILE *fp);
+void gen_mips_writeback_regs(FILE *fp, unsigned regs);
+
+/* global allocation */
+block_t *gen_mips_cur_block();
+void gen_mips_split(FILE *fp);
+void gen_mips_spill_lives(FILE *fp, int is_store, unsigned clobbers);
+void gen_mips_parallel_move(FILE *fp, int *dsts, int *srcs, int n);
+int gen_mips_edge_is_clean(int from, int to);
+void gen_mips_resolve(FILE *fp, int from, int to);
+int gen_mips_add_stub(int from, int to);
+void gen_mips_stubs(FILE *fp);
+void gen_mips_save_callee(FILE *fp, int block, int is_store);
+int gen_mips_is_kept_in_reg(int v);
+void gen_mips_keep_in_reg();
+
+void gen_mips_init_liveness(icfunc_t *func);
+void gen_mips_destroy_liveness();
+int gen_mips_is_live_at(operand_t *var, int index);
+int gen_mips_is_live(operand_t *var);
+
+void gen_mips_color_slots(iclistnode_t *funcdefnode);
+
+void gen_mips_clobber(int reg);
+unsigned gen_mips_callee_clobbers(const char *fname);
 
 /* ------------------------------------ *
  *          generate mips asm           *
  * ------------------------------------ */
 
+/* The frame of the current function. $fp points to the saved $fp, with
+ * the saved $ra above it and the arguments beyond the fourth above that.
+ * The variables are below, then the callee-saved registers, and the
+ * arguments beyond the fourth of the calls made are stored at the bottom
+ * from $sp. $ra is saved only if the function makes calls. A leaf with
+ * nothing in memory has no frame at all, and finds its arguments beyond
+ * the fourth from $sp. */
+static struct {
+    int is_referred;    /* the address of something in it is taken, so it
+                           cannot be given to a tail call */
+    int is_leaf;
+    int is_frameless;
+    int size;           /* below $fp */
+    int out_size;       /* of the outgoing arguments */
+} frame;
+
+/* The allocation of the current function by a global allocator, which
+ * is NULL if the local allocator works alone, and the position of the
+ * intercode being translated. Branches needing moves on their edges
+ * jump to stubs emitted after the function. */
+static struct {
+    int kind;
+    regalloc_t *ra;
+    int pos;
+    int next_split;
+    int n_stubs;
+    int capacity;
+    int *stub_labels;
+    int *stub_edges;    /* two blocks for each stub */
+    int save_offset;    /* of the callee-saved registers from $fp */
+    /* For --stats */
+    int n_funcs;
+    int n_spilled;
+    double seconds;
+} global_alloc;
+
+/* The liveness of the current function, by which only the variables read
+ * later are written back. The variables live before every intercode of
+ * a block are computed when the block is first asked about. */
+static struct {
+    cfg_t *cfg;
+    liveness_t *live;
+    int is_shared;      /* with the global allocator */
+    int n_codes;
+    int *block_of;
+    int *block_first;
+    int block;          /* the block of 'states', or -1 */
+    int capacity;
+    bitset_t **states;
+} func_live;
+
+/* The registers written by every function generated, and by those it
+ * calls, so that a caller keeps its values in the others across a call.
+ * The functions are generated bottom-up over the call graph, and a call
+ * to one not generated yet, as in recursion, clobbers every register. */
+#define REGS_ALL        0xffffffffu
+#define REGS_READ_WRITE ((1u << R_V0) | (1u << R_A0))
+
+static struct {
+    callgraph_t *cg;
+    unsigned *clobbers;     /* indexed by node id */
+    char *is_done;
+    unsigned cur;           /* of the function being generated */
+} reg_usage;
+
+int mips_set_regalloc(const char *name)
+{
+    if (!strcmp(name, "local"))
+        global_alloc.kind = REGALLOC_LOCAL;
+    else if (!strcmp(name, "linear"))
+        global_alloc.kind = REGALLOC_LINEAR;
+    else if (!strcmp(name, "graph"))
+        global_alloc.kind = REGALLOC_GRAPH;
+    else
+        return -1;
+    return 0;
+}
+
+int mips_get_regalloc()
+{
+    if (global_alloc.kind != REGALLOC_DEFAULT)
+        return global_alloc.kind;
+    if (optim_get_level() > 1)
+        return REGALLOC_GRAPH;
+    return (optim_get_level() > 0 ? REGALLOC_LINEAR : REGALLOC_LOCAL);
+}
+
 void gen_mips(FILE *fp)
 {
     gen_mips_framework(fp);
 
-    iclistnode_t *cur = get_intercodes()->front;
+    /* The variables in memory are loaded to the registers left over by
+     * the global allocator. */
+    int kind = mips_get_regalloc();
+    if (kind != REGALLOC_LOCAL) {
+        static const int scratch[] = { R_V1, R_T8, R_T9 };
+        reginfo_table_set_pool(scratch, 3);
+    }
+
+    icprog_t prog;
+    icprog_split(&prog, get_intercodes());
+    callgraph_t *cg = reg_usage.cg = create_callgraph(&prog);
+    reg_usage.clobbers = malloc((cg->n_nodes ? cg->n_nodes : 1) * sizeof(unsigned));
+    reg_usage.is_done = calloc(cg->n_nodes ? cg->n_nodes : 1, 1);
+    assert(reg_usage.clobbers && reg_usage.is_done);
+    for (int i = 0; i < cg->n_nodes; ++i) {
+        cgnode_t *node = cg->bottom_up[i];
+        reg_usage.cur = 0;
+        gen_mips_func(fp, node->func, kind);
+        reg_usage.clobbers[node->id] = reg_usage.cur;
+        reg_usage.is_done[node->id] = 1;
+    }
+    free(reg_usage.clobbers);
+    free(reg_usage.is_done);
+    destroy_callgraph(cg);
+    icprog_join(&prog, get_intercodes());
+
+    if (optim_stats_enabled() && kind != REGALLOC_LOCAL) {
+        fprintf(stderr, "regalloc: %d functions, %d intervals spilled, "
+                "%.3f ms\n", global_alloc.n_funcs, global_alloc.n_spilled,
+                global_alloc.seconds * 1000);
+    }
+}
+
+void gen_mips_func(FILE *fp, icfunc_t *func, int kind)
+{
+    global_alloc.ra = NULL;
+    if (kind != REGALLOC_LOCAL) {
+        clock_t start = clock();
+        global_alloc.ra = create_regalloc(func, kind);
+        global_alloc.seconds += (double)(clock() - start) / CLOCKS_PER_SEC;
+        global_alloc.n_funcs++;
+        global_alloc.n_spilled += global_alloc.ra->n_spilled;
+    }
+    global_alloc.pos = 0;
+    global_alloc.next_split = 0;
+    global_alloc.n_stubs = 0;
+    gen_mips_init_liveness(func);
+
+    iclistnode_t *cur = func->body.front;
     while (cur) {
-        cur = gen_mips_dispatch(fp, cur);
+        if (global_alloc.ra) {
+            gen_mips_split(fp);
+            /* A block beginning with a label saves after it. */
+            block_t *block = gen_mips_cur_block();
+            if (block->first == cur && cur->ic->kind != IC_FUNCDEF && cur->ic->kind != IC_LABEL)
+                gen_mips_save_callee(fp, block->id, 1);
+        }
+        nextuse_table_set_pos(global_alloc.pos / 2);
+        iclistnode_t *next = gen_mips_dispatch(fp, cur);
+        for (; cur != next; cur = cur->next)
+            global_alloc.pos += 2;
+    }
+
+    gen_mips_destroy_liveness();
+    if (global_alloc.ra) {
+        gen_mips_stubs(fp);
+        destroy_regalloc(global_alloc.ra);
+        global_alloc.ra = NULL;
     }
 }
 
@@ -135,15 +317,35 @@ iclistnode_t *gen_mips_funcdef(FILE *fp, iclistnode_t *cur)
 {
     ic_funcdef_t *ic = (ic_funcdef_t *)cur->ic;
     gen_mips_tag(fp, ic->fname);
-    gen_mips_prologue(fp);
+    gen_mips_scan_frame(cur);
 
     /* Remember to clear the information used by the last function. */
-    varinfolist_clear();
+    varinfo_table_clear();
+    reginfo_table_set_leaf(frame.is_leaf);
     reginfo_table_clear();
 
     /* Collect variable information in this function and allocate memory for them. */
+    if (global_alloc.ra)
+        gen_mips_keep_in_reg();
+    gen_mips_color_slots(cur);
     int offset = collect_varinfo(cur);
-    gen_mips_add_sp(fp, offset);
+    if (global_alloc.ra) {
+        global_alloc.save_offset = offset;
+        offset -= 4 * global_alloc.ra->n_saved;
+    }
+    frame.size = frame.out_size - offset;
+    frame.is_frameless = (frame.is_leaf && frame.size == 0);
+    if (optim_stats_enabled()) {
+        fprintf(stderr, "frame: %s %d bytes, %d saved by sharing slots\n",
+                ic->fname, frame.is_frameless ? 0 : frame.size + 8,
+                varinfo_table_shared_bytes());
+    }
+    if (frame.is_frameless)
+        gen_mips_frameless_params(cur);
+    gen_mips_prologue(fp);
+    if (global_alloc.ra)
+        gen_mips_save_callee(fp, 0, 1);
+    collect_nextuse(cur);
 
     return cur->next;
 }
@@ -155,7 +357,56 @@ iclistnode_t *gen_mips_dec(FILE *fp, iclistnode_t *cur)
 
 iclistnode_t *gen_mips_param(FILE *fp, iclistnode_t *cur)
 {
-    return cur->next; /* Do nothing. */
+    iclistnode_t *end;
+    for (end = cur->next; end != NULL; end = end->next)
+        if (end->ic->kind != IC_PARAM)
+            break;
+    if (!global_alloc.ra)
+        return end;
+
+    /* The parameters given registers by the global allocator are moved
+     * there all at once, since the registers may be those of other
+     * parameters. Those left in memory are stored to their slots first,
+     * freeing $a0..$a3, and parameters never used are dropped. The place
+     * of a parameter is taken after the PARAMs, since one split among
+     * them is in memory by then. */
+    regalloc_t *ra = global_alloc.ra;
+    int n_params = 0, n_moves = 0, dsts[4], srcs[4];
+    for (iclistnode_t *iter = cur; iter != end; iter = iter->next)
+        n_params++;
+    int n = 1;
+    for (iclistnode_t *iter = cur; iter != end; iter = iter->next, ++n) {
+        operand_t *var = &((ic_param_t *)iter->ic)->var;
+        interval_t *it = &ra->intervals[cfg_var_index(ra->cfg, var)];
+        int reg = regalloc_reg_at(ra, var, 2 * n_params + 1);
+        if (n > 4)
+            continue;
+        if (reg == R_NONE) {
+            operand_t param = reginfo_table_free_reg(R_A0 + n - 1);
+            if (gen_mips_is_live_at(&param, n_params + 1))
+                gen_mips_store_var(fp, R_A0 + n - 1, &param);
+            continue;
+        }
+        reginfo_table_free_reg(R_A0 + n - 1);
+        if (it->end > 2 * n_params) {
+            dsts[n_moves] = reg;
+            srcs[n_moves++] = R_A0 + n - 1;
+        }
+    }
+    gen_mips_parallel_move(fp, dsts, srcs, n_moves);
+
+    n = 1;
+    for (iclistnode_t *iter = cur; iter != end; iter = iter->next, ++n) {
+        operand_t *var = &((ic_param_t *)iter->ic)->var;
+        interval_t *it = &ra->intervals[cfg_var_index(ra->cfg, var)];
+        int reg = regalloc_reg_at(ra, var, 2 * n_params + 1);
+        if (n > 4 && reg != R_NONE && it->end > 2 * n_params)
+            gen_mips_load_var(fp, reg, var);
+    }
+    while (global_alloc.next_split < ra->n_splits &&
+           ra->intervals[ra->splits[global_alloc.next_split]].spill_pos <= 2 * n_params)
+        global_alloc.next_split++;
+    return end;
 }
 
 iclistnode_t *gen_mips_return(FILE *fp, iclistnode_t *cur)
@@ -182,6 +433,8 @@ iclistnode_t *gen_mips_assign(FILE *fp, iclistnode_t *cur)
     ic_assign_t *ic = (ic_assign_t *)cur->ic;
     assert(!is_const_operand(&ic->lhs));
 
+    if (gen_mips_is_remat(&ic->lhs))
+        return cur->next;
     if (is_const_operand(&ic->rhs)) {
         int reg = gen_mips_get_reg(fp, &ic->lhs, 1);
         gen_mips_li(fp, reg, ic->rhs.val);
@@ -326,7 +579,9 @@ void gen_mips_arithbop_div(FILE *fp, operand_t *target,
 iclistnode_t *gen_mips_ref(FILE *fp, iclistnode_t *cur)
 {
     ic_ref_t *ic = (ic_ref_t *)cur->ic;
-    varinfo_t *varinfo = varinfolist_find(&ic->rhs);
+    if (gen_mips_is_remat(&ic->lhs))
+        return cur->next;
+    varinfo_t *varinfo = varinfo_table_find(&ic->rhs);
     assert(varinfo);
     int reg = gen_mips_get_reg(fp, &ic->lhs, 1);
     gen_mips_addi(fp, reg, varinfo->reg, varinfo->offset);
@@ -365,7 +620,17 @@ iclistnode_t *gen_mips_label(FILE *fp, iclistnode_t *cur)
     ic_label_t *ic = (ic_label_t *)cur->ic;
 
     gen_mips_writeback_vars(fp);    /* Write back at the end of the basic block. */
+
+    /* Falling into the label is an edge as well. */
+    if (global_alloc.ra) {
+        block_t *block = gen_mips_cur_block();
+        block_t *prev = (block->id > 0 ? global_alloc.ra->cfg->blocks[block->id - 1] : NULL);
+        if (prev && prev->fall == block && prev->last->ic->kind != IC_CONDGOTO)
+            gen_mips_resolve(fp, prev->id, block->id);
+    }
     gen_mips_tag(fp, "L%d", ic->labelid);
+    if (global_alloc.ra)
+        gen_mips_save_callee(fp, gen_mips_cur_block()->id, 1);
 
     return cur->next;
 }
@@ -375,6 +640,10 @@ iclistnode_t *gen_mips_goto(FILE *fp, iclistnode_t *cur)
     ic_goto_t *ic = (ic_goto_t *)cur->ic;
 
     gen_mips_writeback_vars(fp);    /* Write back at the end of the basic block. */
+    if (global_alloc.ra) {
+        block_t *block = gen_mips_cur_block();
+        gen_mips_resolve(fp, block->id, block->jump->id);
+    }
     gen_mips_jmp_tag(fp, "j", "L%d", ic->labelid);
 
     return cur->next;
@@ -390,58 +659,78 @@ iclistnode_t *gen_mips_condgoto(FILE *fp, iclistnode_t *cur)
 
     gen_mips_writeback_vars(fp);    /* Write back at the end of the basic block. */
 
+    block_t *block = NULL;
+    int labelid = ic->labelid;
+    if (global_alloc.ra) {
+        block = gen_mips_cur_block();
+        if (!gen_mips_edge_is_clean(block->id, block->jump->id))
+            labelid = gen_mips_add_stub(block->id, block->jump->id);
+    }
+
     switch (ic->relop) {
     case ICOP_EQ:
-        gen_mips_b_tag(fp, "beq", rs, rt, "L%d", ic->labelid); break;
+        gen_mips_b_tag(fp, "beq", rs, rt, "L%d", labelid); break;
     case ICOP_NEQ:
-        gen_mips_b_tag(fp, "bne", rs, rt, "L%d", ic->labelid); break;
+        gen_mips_b_tag(fp, "bne", rs, rt, "L%d", labelid); break;
     case ICOP_G:
-        gen_mips_b_tag(fp, "bgt", rs, rt, "L%d", ic->labelid); break;
+        gen_mips_b_tag(fp, "bgt", rs, rt, "L%d", labelid); break;
     case ICOP_GE:
-        gen_mips_b_tag(fp, "bge", rs, rt, "L%d", ic->labelid); break;
+        gen_mips_b_tag(fp, "bge", rs, rt, "L%d", labelid); break;
     case ICOP_L:
-        gen_mips_b_tag(fp, "blt", rs, rt, "L%d", ic->labelid); break;
+        gen_mips_b_tag(fp, "blt", rs, rt, "L%d", labelid); break;
     case ICOP_LE:
-        gen_mips_b_tag(fp, "ble", rs, rt, "L%d", ic->labelid); break;
+        gen_mips_b_tag(fp, "ble", rs, rt, "L%d", labelid); break;
     default:
         assert(0); break; /* Should not reach here. */
     }
+
+    if (block && block->fall)
+        gen_mips_resolve(fp, block->id, block->fall->id);
     return cur->next;
 }
 
+/* The arguments beyond the fourth are stored to the bottom of the frame
+ * first, since that may take registers. The others are moved from their
+ * registers all at once, as some may be in $a0..$a3 themselves, and then
+ * the constants and those in memory are loaded. The scratch registers of
+ * the global allocator are written back before, since $v1 breaks the
+ * cycles of the moves. */
 iclistnode_t *gen_mips_args(FILE *fp, iclistnode_t *cur)
 {
-    gen_mips_writeback_args(fp);
-
     iclistnode_t *end;
     for (end = cur->next; end != NULL; end = end->next)
         if (end->ic->kind != IC_ARG)
             break;
 
     int i = 1;
-    for (iclistnode_t *iter = end->prev; iter != cur->prev; iter = iter->prev) {
-        ic_arg_t *ic = (ic_arg_t *)iter->ic;
-
-        if (i <= 4) {
-            int rd = R_A0 + i - 1, rs = R_NONE;
-            assert(reginfo_table_is_empty(rd));
-            if (is_const_operand(&ic->arg)) {
-                gen_mips_li(fp, rd, ic->arg.val);
-            }
-            else {
-                if ((rs = reginfo_table_find_var(&ic->arg)) != R_NONE)
-                    gen_mips_move(fp, rd, rs);
-                else
-                    gen_mips_load_var(fp, rd, &ic->arg);
-            }
+    for (iclistnode_t *iter = end->prev; iter != cur->prev; iter = iter->prev, ++i) {
+        if (i > 4) {
+            int reg = gen_mips_get_reg(fp, &((ic_arg_t *)iter->ic)->arg, 0);
+            gen_mips_sw(fp, reg, R_SP, 4 * (i - 5));
         }
-        else {
-            int reg = gen_mips_get_reg(fp, &ic->arg, 0);
-            gen_mips_push(fp, reg);
+    }
+    if (global_alloc.ra)
+        gen_mips_writeback_vars(fp);
+
+    int n_moves = 0, dsts[4], srcs[4], is_moved[4] = { 0 };
+    i = 1;
+    for (iclistnode_t *iter = end->prev; iter != cur->prev && i <= 4; iter = iter->prev, ++i) {
+        operand_t *arg = &((ic_arg_t *)iter->ic)->arg;
+        int rs = (is_const_operand(arg) ? R_NONE : gen_mips_find_reg(arg));
+        if (rs != R_NONE) {
+            is_moved[i - 1] = 1;
+            dsts[n_moves] = R_A0 + i - 1;
+            srcs[n_moves++] = rs;
         }
-        i++;
     }
+    gen_mips_writeback_args(fp);
+    gen_mips_parallel_move(fp, dsts, srcs, n_moves);
 
+    i = 1;
+    for (iclistnode_t *iter = end->prev; iter != cur->prev && i <= 4; iter = iter->prev, ++i) {
+        if (!is_moved[i - 1])
+            gen_mips_load_var(fp, R_A0 + i - 1, &((ic_arg_t *)iter->ic)->arg);
+    }
     return end;
 }
 
@@ -449,11 +738,27 @@ iclistnode_t *gen_mips_call(FILE *fp, iclistnode_t *cur)
 {
     ic_call_t *ic = (ic_call_t *)cur->ic;
 
-    gen_mips_writeback_vars(fp);
+    unsigned clobbers = gen_mips_callee_clobbers(ic->fname);
+    reg_usage.cur |= clobbers;
+
+    /* A tail call jumps to the callee after freeing the frame, so that
+     * the callee returns to our caller with $ra untouched. The variables
+     * are dead and never written back. */
+    if (gen_mips_is_tail_call(cur)) {
+        reginfo_table_clear();
+        gen_mips_epilogue(fp);
+        gen_mips_jmp_tag(fp, "j", ic->fname);
+        return cur->next->next;
+    }
+
+    /* Only the values in registers the callee writes are saved. */
+    gen_mips_writeback_regs(fp, clobbers);
+    gen_mips_spill_lives(fp, 1, clobbers);
 
-    gen_mips_before_call(fp);
     gen_mips_jmp_tag(fp, "jal", ic->fname);
-    gen_mips_after_call(fp);
+    gen_mips_clobber(R_RA);
+
+    gen_mips_spill_lives(fp, 0, clobbers);
 
     int reg = gen_mips_get_reg(fp, &ic->ret, 1);
     gen_mips_move(fp, reg, R_V0);
@@ -462,15 +767,25 @@ iclistnode_t *gen_mips_call(FILE *fp, iclistnode_t *cur)
     return cur->next;
 }
 
+/* A call with all arguments in registers is made a tail call when
+ * optimizing. */
+int gen_mips_is_tail_call(iclistnode_t *cur)
+{
+    int n_args = 0;
+    for (iclistnode_t *iter = cur->prev; iter->ic->kind == IC_ARG; iter = iter->prev)
+        n_args++;
+    return optim_get_level() > 0 && iclist_is_tail_call(cur) &&
+           !frame.is_referred && n_args <= 4;
+}
+
 iclistnode_t *gen_mips_read(FILE *fp, iclistnode_t *cur)
 {
     ic_read_t *ic = (ic_read_t *)cur->ic;
 
     gen_mips_writeback(fp, R_A0);
 
-    gen_mips_before_call(fp);
     gen_mips_jmp_tag(fp, "jal", "read");
-    gen_mips_after_call(fp);
+    reg_usage.cur |= REGS_READ_WRITE | (1u << R_RA);
 
     int reg = gen_mips_get_reg(fp, &ic->var, 1);
     gen_mips_move(fp, reg, R_V0);
@@ -487,9 +802,8 @@ iclistnode_t *gen_mips_write(FILE *fp, iclistnode_t *cur)
     int reg = gen_mips_get_reg(fp, &ic->var, 0);
     gen_mips_move(fp, R_A0, reg);
 
-    gen_mips_before_call(fp);
     gen_mips_jmp_tag(fp, "jal", "write");
-    gen_mips_after_call(fp);
+    reg_usage.cur |= REGS_READ_WRITE | (1u << R_RA);
 
     return cur->next;
 }
@@ -535,24 +849,28 @@ void gen_mips_b_tag(FILE *fp, const char *bcmd, int rs, int rt,
 
 void gen_mips_addi(FILE *fp, int rt, int rs, int i)
 {
+    gen_mips_clobber(rt);
     fprintf(fp, "addi $%s, $%s, %d\n", get_regalias(rt),
             get_regalias(rs), i);
 }
 
 void gen_mips_add(FILE *fp, int rd, int rs, int rt)
 {
+    gen_mips_clobber(rd);
     fprintf(fp, "add $%s, $%s, $%s\n", get_regalias(rd),
             get_regalias(rs), get_regalias(rt));
 }
 
 void gen_mips_sub(FILE *fp, int rd, int rs, int rt)
 {
+    gen_mips_clobber(rd);
     fprintf(fp, "sub $%s, $%s, $%s\n", get_regalias(rd),
             get_regalias(rs), get_regalias(rt));
 }
 
 void gen_mips_mul(FILE *fp, int rd, int rs, int rt)
 {
+    gen_mips_clobber(rd);
     fprintf(fp, "mul $%s, $%s, $%s\n", get_regalias(rd),
             get_regalias(rs), get_regalias(rt));
 }
@@ -564,11 +882,13 @@ void gen_mips_div(FILE *fp, int rs, int rt)
 
 void gen_mips_mflo(FILE *fp, int rs)
 {
+    gen_mips_clobber(rs);
     fprintf(fp, "mflo $%s\n", get_regalias(rs));
 }
 
 void gen_mips_lw(FILE *fp, int rt, int rs, int offset)
 {
+    gen_mips_clobber(rt);
     fprintf(fp, "lw $%s, %d($%s)\n", get_regalias(rt),
             offset, get_regalias(rs));
 }
@@ -581,11 +901,15 @@ void gen_mips_sw(FILE *fp, int rt, int rs, int offset)
 
 void gen_mips_li(FILE *fp, int rd, int i)
 {
+    gen_mips_clobber(rd);
     fprintf(fp, "li $%s, %d\n", get_regalias(rd), i);
 }
 
 void gen_mips_move(FILE *fp, int rd, int rs)
 {
+    if (rd == rs)
+        return;
+    gen_mips_clobber(rd);
     fprintf(fp, "move $%s, $%s\n", get_regalias(rd), get_regalias(rs));
 }
 
@@ -598,28 +922,26 @@ void gen_mips_add_sp(FILE *fp, int offset)
     gen_mips_addi(fp, R_SP, R_SP, offset);
 }
 
-void gen_mips_push(FILE *fp, int reg)
-{
-    gen_mips_add_sp(fp, -4);
-    gen_mips_sw(fp, reg, R_SP, 0);
-}
-
-void gen_mips_pop(FILE *fp, int reg)
-{
-    gen_mips_lw(fp, reg, R_SP, 0);
-    gen_mips_add_sp(fp, 4);
-}
-
 void gen_mips_load_var(FILE *fp, int reg, operand_t *var)
 {
     if (is_const_operand(var)) {
         gen_mips_li(fp, reg, var->val);
     }
     else {
-        varinfo_t *varinfo = varinfolist_find(var);
+        varinfo_t *varinfo = varinfo_table_find(var);
         assert(varinfo);
-        assert(varinfo->reg == R_FP || varinfo->reg == R_SP);
-        gen_mips_lw(fp, reg, varinfo->reg, varinfo->offset);
+        if (is_const_operand(&varinfo->remat)) {
+            gen_mips_li(fp, reg, varinfo->remat.val);
+        }
+        else if (varinfo->remat.kind != OPERAND_NONE) {
+            varinfo_t *target = varinfo_table_find(&varinfo->remat);
+            assert(target);
+            gen_mips_addi(fp, reg, target->reg, target->offset);
+        }
+        else {
+            assert(varinfo->reg == R_FP || varinfo->reg == R_SP);
+            gen_mips_lw(fp, reg, varinfo->reg, varinfo->offset);
+        }
     }
 }
 
@@ -628,15 +950,35 @@ void gen_mips_store_var(FILE *fp, int reg, operand_t *var)
     if (is_const_operand(var))
         return;
 
-    varinfo_t *varinfo = varinfolist_find(var);
+    varinfo_t *varinfo = varinfo_table_find(var);
     if (!varinfo) {
         fprint_operand(stdout, var);
     }
     assert(varinfo);
+    if (varinfo->remat.kind != OPERAND_NONE)
+        return;
     assert(varinfo->reg == R_FP || varinfo->reg == R_SP);
     gen_mips_sw(fp, reg, varinfo->reg, varinfo->offset);
 }
 
+/* Whether 'var' is recomputed when loaded and not in a register now, so
+ * that its definition need not be emitted. */
+int gen_mips_is_remat(operand_t *var)
+{
+    varinfo_t *varinfo = varinfo_table_find(var);
+    return varinfo && varinfo->remat.kind != OPERAND_NONE &&
+           gen_mips_find_reg(var) == R_NONE;
+}
+
+int gen_mips_find_reg(operand_t *var)
+{
+    int reg;
+    if (global_alloc.ra &&
+        (reg = regalloc_reg_at(global_alloc.ra, var, global_alloc.pos)) != R_NONE)
+        return reg;
+    return reginfo_table_find_var(var);
+}
+
 int gen_mips_get_reg(FILE *fp, operand_t *var, int is_lval)
 {
     assert(var);
@@ -644,7 +986,7 @@ int gen_mips_get_reg(FILE *fp, operand_t *var, int is_lval)
 
     int reg;
 
-    if ((reg = reginfo_table_find_var(var)) != R_NONE)
+    if ((reg = gen_mips_find_reg(var)) != R_NONE)
         return reg;
 
     if ((reg = reginfo_table_find_empty()) != R_NONE) {
@@ -670,24 +1012,74 @@ int gen_mips_get_reg(FILE *fp, operand_t *var, int is_lval)
 
 void gen_mips_prologue(FILE *fp)
 {
-    gen_mips_push(fp, R_FP);
+    if (frame.is_frameless)
+        return;
+    gen_mips_add_sp(fp, -8);
+    gen_mips_sw(fp, R_FP, R_SP, 0);
+    if (!frame.is_leaf)
+        gen_mips_sw(fp, R_RA, R_SP, 4);
     gen_mips_move(fp, R_FP, R_SP);
+    if (frame.size)
+        gen_mips_add_sp(fp, -frame.size);
 }
 
 void gen_mips_epilogue(FILE *fp)
 {
+    if (frame.is_frameless)
+        return;
+    if (global_alloc.ra)
+        gen_mips_save_callee(fp, gen_mips_cur_block()->id, 0);
     gen_mips_move(fp, R_SP, R_FP);
-    gen_mips_pop(fp, R_FP);
+    if (!frame.is_leaf)
+        gen_mips_lw(fp, R_RA, R_SP, 4);
+    gen_mips_lw(fp, R_FP, R_SP, 0);
+    gen_mips_add_sp(fp, 8);
 }
 
-void gen_mips_before_call(FILE *fp)
+/* Find what the frame of the function needs. The tail calls and the
+ * calls of the framework to read and write are not counted, as they do
+ * not take the stack. */
+void gen_mips_scan_frame(iclistnode_t *funcdefnode)
 {
-    gen_mips_push(fp, R_RA);
+    frame.is_referred = 0;
+    frame.is_leaf = 1;
+    frame.out_size = 0;
+    for (iclistnode_t *iter = funcdefnode->next; iter != NULL; iter = iter->next) {
+        if (iter->ic->kind == IC_FUNCDEF)
+            break;
+        if (iter->ic->kind == IC_REF)
+            frame.is_referred = 1;
+    }
+    for (iclistnode_t *iter = funcdefnode->next; iter != NULL; iter = iter->next) {
+        intercode_t *ic = iter->ic;
+        if (ic->kind == IC_FUNCDEF)
+            break;
+        if (ic->kind == IC_READ || ic->kind == IC_WRITE)
+            frame.is_leaf = 0;
+        if (ic->kind != IC_CALL || gen_mips_is_tail_call(iter))
+            continue;
+        frame.is_leaf = 0;
+        int n_args = 0;
+        for (iclistnode_t *arg = iter->prev; arg->ic->kind == IC_ARG; arg = arg->prev)
+            n_args++;
+        if (n_args > 4 && 4 * (n_args - 4) > frame.out_size)
+            frame.out_size = 4 * (n_args - 4);
+    }
 }
 
-void gen_mips_after_call(FILE *fp)
+/* Without a frame, $sp is where $fp would be plus 8. */
+void gen_mips_frameless_params(iclistnode_t *funcdefnode)
 {
-    gen_mips_pop(fp, R_RA);
+    int n = 1;
+    for (iclistnode_t *iter = funcdefnode->next; iter != NULL; iter = iter->next, ++n) {
+        if (iter->ic->kind != IC_PARAM)
+            break;
+        varinfo_t *varinfo = varinfo_table_find(&((ic_param_t *)iter->ic)->var);
+        if (n > 4 && varinfo) {
+            varinfo->reg = R_SP;
+            varinfo->offset -= 8;
+        }
+    }
 }
 
 void gen_mips_writeback(FILE *fp, int reg)
@@ -695,7 +1087,7 @@ void gen_mips_writeback(FILE *fp, int reg)
     if (!reginfo_table_is_empty(reg)) {
         int is_dirty = reginfo_table_is_dirty(reg);
         operand_t var = reginfo_table_free_reg(reg);
-        if (is_dirty)
+        if (is_dirty && gen_mips_is_live(&var))
             gen_mips_store_var(fp, reg, &var);
     }
     assert(reginfo_table_is_empty(reg) && !reginfo_table_is_dirty(reg));
@@ -709,6 +1101,410 @@ void gen_mips_writeback_args(FILE *fp)
 
 void gen_mips_writeback_vars(FILE *fp)
 {
-    for (int reg = R_A0; reg <= R_T9; ++reg)
-        gen_mips_writeback(fp, reg);
+    gen_mips_writeback_regs(fp, REGS_ALL);
+}
+
+void gen_mips_writeback_regs(FILE *fp, unsigned regs)
+{
+    for (int reg = R_ZERO; reg <= R_RA; ++reg)
+        if (reginfo_table_is_local(reg) && (regs & (1u << reg)))
+            gen_mips_writeback(fp, reg);
+}
+
+/* ------------------------------------ *
+ *          global allocation           *
+ * ------------------------------------ */
+
+block_t *gen_mips_cur_block()
+{
+    regalloc_t *ra = global_alloc.ra;
+    return ra->cfg->blocks[ra->block_of[global_alloc.pos / 2]];
+}
+
+/* Store the variables whose intervals are split at the current position,
+ * since they are in memory from there on. */
+void gen_mips_split(FILE *fp)
+{
+    regalloc_t *ra = global_alloc.ra;
+    for (; global_alloc.next_split < ra->n_splits; ++global_alloc.next_split) {
+        int v = ra->splits[global_alloc.next_split];
+        if (ra->intervals[v].spill_pos > global_alloc.pos)
+            break;
+        operand_t var;
+        init_var_operand(&var, ra->cfg->varids[v]);
+        if (gen_mips_is_live(&var))
+            gen_mips_store_var(fp, ra->intervals[v].reg, &var);
+    }
+}
+
+/* Store the variables in caller-saved registers live across the current
+ * call, or load them back, if the callee clobbers them. */
+void gen_mips_spill_lives(FILE *fp, int is_store, unsigned clobbers)
+{
+    regalloc_t *ra = global_alloc.ra;
+    if (!ra)
+        return;
+    bitset_t *lives = ra->call_lives[global_alloc.pos / 2];
+    assert(lives);
+    for (int v = 0; v < ra->cfg->n_vars; ++v) {
+        if (!bitset_contains(lives, v))
+            continue;
+        operand_t var;
+        init_var_operand(&var, ra->cfg->varids[v]);
+        int reg = regalloc_reg_at(ra, &var, global_alloc.pos);
+        if (reg == R_NONE || regalloc_is_callee_saved(reg) || !(clobbers & (1u << reg)))
+            continue;
+        if (is_store)
+            gen_mips_store_var(fp, reg, &var);
+        else
+            gen_mips_load_var(fp, reg, &var);
+    }
+}
+
+/* Move 'srcs' to 'dsts' as if at once. A move is emitted once its target
+ * is not read by the others, and a cycle is broken by saving one target
+ * in $v1, which the global allocators never give out. */
+void gen_mips_parallel_move(FILE *fp, int *dsts, int *srcs, int n)
+{
+    while (n > 0) {
+        int i, j;
+        for (i = 0; i < n && dsts[i] != srcs[i]; ++i) {
+            for (j = 0; j < n; ++j)
+                if (j != i && srcs[j] == dsts[i])
+                    break;
+            if (j == n)
+                break;
+        }
+        if (i == n) {
+            i = 0;
+            gen_mips_move(fp, R_V1, dsts[i]);
+            for (j = 0; j < n; ++j)
+                if (srcs[j] == dsts[i])
+                    srcs[j] = R_V1;
+        }
+        gen_mips_move(fp, dsts[i], srcs[i]);
+        dsts[i] = dsts[n - 1];
+        srcs[i] = srcs[n - 1];
+        n--;
+    }
+}
+
+/* Whether the variables live on the edge are in the same places at the
+ * end of 'from' and at the beginning of 'to'. */
+int gen_mips_edge_is_clean(int from, int to)
+{
+    regalloc_t *ra = global_alloc.ra;
+    int end = 2 * ra->block_first[from + 1] - 1, begin = 2 * ra->block_first[to] - 1;
+    for (int v = 0; v < ra->cfg->n_vars; ++v) {
+        if (!bitset_contains(ra->live->in[to], v))
+            continue;
+        operand_t var;
+        init_var_operand(&var, ra->cfg->varids[v]);
+        if (regalloc_reg_at(ra, &var, end) != regalloc_reg_at(ra, &var, begin))
+            return 0;
+    }
+    return 1;
+}
+
+/* Move the variables live on the edge to where 'to' expects them. The
+ * stores go first, since a register may be given to another variable
+ * loaded at the beginning of 'to'. */
+void gen_mips_resolve(FILE *fp, int from, int to)
+{
+    regalloc_t *ra = global_alloc.ra;
+    int end = 2 * ra->block_first[from + 1] - 1, begin = 2 * ra->block_first[to] - 1;
+    for (int is_store = 1; is_store >= 0; --is_store) {
+        for (int v = 0; v < ra->cfg->n_vars; ++v) {
+            if (!bitset_contains(ra->live->in[to], v))
+                continue;
+            operand_t var;
+            init_var_operand(&var, ra->cfg->varids[v]);
+            int src = regalloc_reg_at(ra, &var, end);
+            int dst = regalloc_reg_at(ra, &var, begin);
+            assert(src == dst || src == R_NONE || dst == R_NONE);
+            if (is_store && src != R_NONE && dst == R_NONE)
+                gen_mips_store_var(fp, src, &var);
+            else if (!is_store && src == R_NONE && dst != R_NONE)
+                gen_mips_load_var(fp, dst, &var);
+        }
+    }
+}
+
+/* Save the callee-saved registers whose save block is 'block' below the
+ * variables of the function, or restore those saved when returning from
+ * 'block'. */
+void gen_mips_save_callee(FILE *fp, int block, int is_store)
+{
+    regalloc_t *ra = global_alloc.ra;
+    for (int i = 0; i < ra->n_saved; ++i) {
+        int offset = global_alloc.save_offset - 4 * (i + 1);
+        if (is_store && ra->save_blocks[i] == block)
+            gen_mips_sw(fp, ra->saved_regs[i], R_FP, offset);
+        else if (!is_store && ra->is_saved[i][block])
+            gen_mips_lw(fp, ra->saved_regs[i], R_FP, offset);
+    }
+}
+
+/* Whether the code generator never stores the variable of dense index
+ * 'v', which is kept in one register all along, unless it is a
+ * caller-saved one across a call. */
+int gen_mips_is_kept_in_reg(int v)
+{
+    interval_t *it = &global_alloc.ra->intervals[v];
+    return it->reg != R_NONE && it->spill_pos > it->end &&
+           (!it->crosses_call || regalloc_is_callee_saved(it->reg));
+}
+
+/* Mark the variables never stored, so that they get no slot. */
+void gen_mips_keep_in_reg()
+{
+    regalloc_t *ra = global_alloc.ra;
+    for (int v = 0; v < ra->cfg->n_vars; ++v) {
+        if (!gen_mips_is_kept_in_reg(v))
+            continue;
+        operand_t var;
+        init_var_operand(&var, ra->cfg->varids[v]);
+        varinfo_table_keep_in_reg(&var);
+    }
+}
+
+int gen_mips_add_stub(int from, int to)
+{
+    if (global_alloc.n_stubs == global_alloc.capacity) {
+        global_alloc.capacity = (global_alloc.capacity ? 2 * global_alloc.capacity : 8);
+        global_alloc.stub_labels = realloc(global_alloc.stub_labels,
+                                           global_alloc.capacity * sizeof(int));
+        global_alloc.stub_edges = realloc(global_alloc.stub_edges,
+                                          2 * global_alloc.capacity * sizeof(int));
+        assert(global_alloc.stub_labels && global_alloc.stub_edges);
+    }
+    int i = global_alloc.n_stubs++;
+    global_alloc.stub_labels[i] = alloc_labelid();
+    global_alloc.stub_edges[2 * i] = from;
+    global_alloc.stub_edges[2 * i + 1] = to;
+    return global_alloc.stub_labels[i];
+}
+
+void gen_mips_stubs(FILE *fp)
+{
+    cfg_t *cfg = global_alloc.ra->cfg;
+    for (int i = 0; i < global_alloc.n_stubs; ++i) {
+        int from = global_alloc.stub_edges[2 * i], to = global_alloc.stub_edges[2 * i + 1];
+        intercode_t *ic = cfg->blocks[to]->first->ic;
+        assert(ic->kind == IC_LABEL);
+        gen_mips_tag(fp, "L%d", global_alloc.stub_labels[i]);
+        gen_mips_resolve(fp, from, to);
+        gen_mips_jmp_tag(fp, "j", "L%d", ((ic_label_t *)ic)->labelid);
+    }
+}
+
+/* ------------------------------------ *
+ *               liveness               *
+ * ------------------------------------ */
+
+void gen_mips_init_liveness(icfunc_t *func)
+{
+    func_live.is_shared = (global_alloc.ra != NULL);
+    if (func_live.is_shared) {
+        func_live.cfg = global_alloc.ra->cfg;
+        func_live.live = global_alloc.ra->live;
+    }
+    else {
+        func_live.cfg = create_cfg(func);
+        func_live.live = create_liveness(func_live.cfg);
+    }
+
+    cfg_t *cfg = func_live.cfg;
+    func_live.n_codes = func->body.size;
+    func_live.block_of = malloc((func_live.n_codes ? func_live.n_codes : 1) * sizeof(int));
+    func_live.block_first = malloc((cfg->n_blocks + 1) * sizeof(int));
+    assert(func_live.block_of && func_live.block_first);
+    int n = 0;
+    for (int b = 0; b < cfg->n_blocks; ++b) {
+        func_live.block_first[b] = n;
+        block_foreach(node, cfg->blocks[b])
+            func_live.block_of[n++] = b;
+    }
+    func_live.block_first[cfg->n_blocks] = n;
+    assert(n == func_live.n_codes);
+    func_live.block = -1;
+}
+
+void gen_mips_destroy_liveness()
+{
+    for (int i = 0; i < func_live.capacity; ++i)
+        destroy_bitset(func_live.states[i]);
+    free(func_live.states);
+    func_live.states = NULL;
+    func_live.capacity = 0;
+    free(func_live.block_of);
+    free(func_live.block_first);
+    if (!func_live.is_shared) {
+        destroy_liveness(func_live.live);
+        destroy_cfg(func_live.cfg);
+    }
+}
+
+/* Whether 'var' is live before the intercode numbered 'index', that is,
+ * whether its value may still be read. */
+int gen_mips_is_live_at(operand_t *var, int index)
+{
+    cfg_t *cfg = func_live.cfg;
+    if (is_const_operand(var))
+        return 1;
+    if (index >= func_live.n_codes)
+        return 0;
+
+    int b = func_live.block_of[index], first = func_live.block_first[b];
+    if (b != func_live.block) {
+        int size = func_live.block_first[b + 1] - first;
+        for (int i = 0; i < func_live.capacity; ++i)
+            destroy_bitset(func_live.states[i]);
+        func_live.states = realloc(func_live.states, size * sizeof(bitset_t *));
+        assert(func_live.states);
+        func_live.capacity = size;
+
+        bitset_t *state = create_bitset(cfg->n_vars);
+        bitset_copy(state, func_live.live->out[b]);
+        iclistnode_t *cur = cfg->blocks[b]->last;
+        for (int i = size - 1; i >= 0; --i, cur = cur->prev) {
+            liveness_transfer(cfg, cur->ic, state);
+            func_live.states[i] = create_bitset(cfg->n_vars);
+            bitset_copy(func_live.states[i], state);
+        }
+        destroy_bitset(state);
+        func_live.block = b;
+    }
+    return bitset_contains(func_live.states[index - first], cfg_var_index(cfg, var));
+}
+
+int gen_mips_is_live(operand_t *var)
+{
+    return gen_mips_is_live_at(var, global_alloc.pos / 2);
+}
+
+/* ------------------------------------ *
+ *             stack slots              *
+ * ------------------------------------ */
+
+void gen_mips_extend_slot(int *starts, int *ends, operand_t *var, int index)
+{
+    int v = cfg_var_index(func_live.cfg, var);
+    if (v < 0)
+        return;
+    if (starts[v] < 0 || index < starts[v])
+        starts[v] = index;
+    if (index > ends[v])
+        ends[v] = index;
+}
+
+/* Let the variables whose lives do not overlap share slots. A variable
+ * is only stored or loaded where it is live, so it may take the slot of
+ * another one dead by then. Every variable gets the interval from the
+ * first to the last intercode where it is live, defined or used, and the
+ * intervals are coloured greedily by their starts, which takes as many
+ * slots as there are intervals overlapping at an intercode. Arrays, the
+ * variables whose addresses are taken and the parameters on the stack
+ * keep slots of their own. */
+void gen_mips_color_slots(iclistnode_t *funcdefnode)
+{
+    cfg_t *cfg = func_live.cfg;
+    int n_vars = cfg->n_vars, size = (n_vars ? n_vars : 1);
+    int *starts = malloc(size * sizeof(int)), *ends = malloc(size * sizeof(int));
+    int *order = malloc(size * sizeof(int)), *color_ends = malloc(size * sizeof(int));
+    int *counts = calloc(func_live.n_codes + 1, sizeof(int));
+    char *is_shared = malloc(size);
+    assert(starts && ends && order && color_ends && counts && is_shared);
+    for (int v = 0; v < n_vars; ++v) {
+        starts[v] = ends[v] = -1;
+        is_shared[v] = !(global_alloc.ra && gen_mips_is_kept_in_reg(v));
+    }
+
+    int n_params = 0;
+    for (iclistnode_t *iter = funcdefnode->next; iter != NULL; iter = iter->next) {
+        intercode_t *ic = iter->ic;
+        if (ic->kind == IC_FUNCDEF)
+            break;
+        if (ic->kind == IC_DEC)
+            is_shared[cfg_var_index(cfg, &((ic_dec_t *)ic)->var)] = 0;
+        else if (ic->kind == IC_REF)
+            is_shared[cfg_var_index(cfg, &((ic_ref_t *)ic)->rhs)] = 0;
+        else if (ic->kind == IC_PARAM && ++n_params > 4)
+            is_shared[cfg_var_index(cfg, &((ic_param_t *)ic)->var)] = 0;
+    }
+
+    for (int b = 0; b < cfg->n_blocks; ++b) {
+        int first = func_live.block_first[b], last = func_live.block_first[b + 1] - 1;
+        for (int v = 0; v < n_vars; ++v) {
+            operand_t var;
+            init_var_operand(&var, cfg->varids[v]);
+            if (bitset_contains(func_live.live->in[b], v))
+                gen_mips_extend_slot(starts, ends, &var, first);
+            if (bitset_contains(func_live.live->out[b], v))
+                gen_mips_extend_slot(starts, ends, &var, last);
+        }
+        int index = first;
+        block_foreach(node, cfg->blocks[b]) {
+            operand_t *def = intercode_def(node->ic), *uses[2];
+            if (def)
+                gen_mips_extend_slot(starts, ends, def, index);
+            int n_uses = intercode_uses(node->ic, uses);
+            for (int i = 0; i < n_uses; ++i)
+                gen_mips_extend_slot(starts, ends, uses[i], index);
+            index++;
+        }
+    }
+
+    /* Sort the intervals by their starts, counting them. */
+    int n_intervals = 0, n_colors = 0;
+    for (int v = 0; v < n_vars; ++v) {
+        if (is_shared[v] && starts[v] >= 0) {
+            counts[starts[v] + 1]++;
+            n_intervals++;
+        }
+    }
+    for (int i = 0; i < func_live.n_codes; ++i)
+        counts[i + 1] += counts[i];
+    for (int v = 0; v < n_vars; ++v)
+        if (is_shared[v] && starts[v] >= 0)
+            order[counts[starts[v]]++] = v;
+
+    for (int k = 0; k < n_intervals; ++k) {
+        int v = order[k], c;
+        for (c = 0; c < n_colors; ++c)
+            if (color_ends[c] < starts[v])
+                break;
+        if (c == n_colors)
+            n_colors++;
+        color_ends[c] = ends[v];
+        operand_t var;
+        init_var_operand(&var, cfg->varids[v]);
+        varinfo_table_share_slot(&var, c);
+    }
+
+    free(starts);
+    free(ends);
+    free(order);
+    free(color_ends);
+    free(counts);
+    free(is_shared);
+}
+
+/* ------------------------------------ *
+ *            register usage            *
+ * ------------------------------------ */
+
+void gen_mips_clobber(int reg)
+{
+    reg_usage.cur |= 1u << reg;
+}
+
+/* Return the registers written by calling 'fname', which include $v0
+ * for the value returned and $ra. */
+unsigned gen_mips_callee_clobbers(const char *fname)
+{
+    cgnode_t *node = callgraph_find(reg_usage.cg, fname);
+    if (!node || !reg_usage.is_done[node->id])
+        return REGS_ALL;
+    return reg_usage.clobbers[node->id] | (1u << R_V0) | (1u << R_RA);
 }
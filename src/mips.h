@@ -5,4 +5,10 @@
 
 void gen_mips(FILE *fp);
 
+/* Choose the register allocator, 'local', 'linear' or 'graph'. By
+ * default it is the local one without optimization, linear scan at -O1
+ * and graph coloring above. Return 0 on success. */
+int mips_set_regalloc(const char *name);
+int mips_get_regalloc();
+
 #endif
\ No newline at end of file
@@ -0,0 +1,249 @@
+#include "optim.h"
+#include "callgraph.h"
+#include "loop.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* ------------------------------------ *
+ *        function specialization       *
+ * ------------------------------------ */
+
+/* The calls of a function are grouped by the arguments that are
+ * constants and their values. A group with constant arguments gets its
+ * own copy of the function, where those parameters are assigned the
+ * constants instead of being passed, and its calls go to the copy. The
+ * copy is named 'f__s<n>'. Groups are chosen by their benefit, the
+ * number of constants passed weighted by how deep in loops the calls
+ * are, within a budget of intercodes added to the program. Calls that
+ * all pass the same constants are left to ipcp, and recursive functions
+ * are not copied. */
+
+#define CLONE_MAX_SIZE      80
+#define CLONE_BUDGET        240
+#define CLONE_MIN_BENEFIT   2
+#define CLONE_LOOP_WEIGHT   8
+#define CLONE_MAX_DEPTH     3
+
+typedef struct spec {
+    cgnode_t *callee;
+    int n_params;
+    char *is_const;
+    int *values;
+    int n_consts;
+    int n_sites;
+    iclistnode_t **sites;
+    icfunc_t **callers;
+    int benefit;
+} spec_t;
+
+static struct {
+    callgraph_t *cg;
+    int n_specs;
+    spec_t **specs;
+    int *weights;   /* of the call sites of the current caller */
+} clone;
+
+int clone_n_params(icfunc_t *func)
+{
+    int n = 0;
+    for (iclistnode_t *cur = func->body.front->next; cur && cur->ic->kind == IC_PARAM;
+         cur = cur->next)
+        n++;
+    return n;
+}
+
+/* Estimate how often each call site of the caller runs by the depth of
+ * the loops around it. */
+void clone_weigh_sites(cgnode_t *caller)
+{
+    cfg_t *cfg = create_cfg(caller->func);
+    loopnest_t *nest = create_loopnest(cfg);
+    for (int i = 0; i < cfg->n_blocks; ++i) {
+        loop_t *loop = nest->block_loops[i];
+        int depth = (loop ? loop->depth : 0), weight = 1;
+        for (int d = 0; d < depth && d < CLONE_MAX_DEPTH; ++d)
+            weight *= CLONE_LOOP_WEIGHT;
+        block_foreach(node, cfg->blocks[i]) {
+            for (int k = 0; k < caller->n_sites; ++k)
+                if (caller->sites[k] == node)
+                    clone.weights[k] = weight;
+        }
+    }
+    destroy_loopnest(nest);
+    destroy_cfg(cfg);
+}
+
+spec_t *clone_find_spec(cgnode_t *callee, char *is_const, int *values)
+{
+    for (int i = 0; i < clone.n_specs; ++i) {
+        spec_t *spec = clone.specs[i];
+        if (spec->callee != callee)
+            continue;
+        int j;
+        for (j = 0; j < spec->n_params; ++j) {
+            if (spec->is_const[j] != is_const[j] ||
+                (is_const[j] && spec->values[j] != values[j]))
+                break;
+        }
+        if (j == spec->n_params)
+            return spec;
+    }
+
+    spec_t *spec = malloc(sizeof(spec_t));
+    assert(spec);
+    spec->callee = callee;
+    spec->n_params = clone_n_params(callee->func);
+    int n = (spec->n_params ? spec->n_params : 1);
+    spec->is_const = malloc(n * sizeof(char));
+    spec->values = malloc(n * sizeof(int));
+    assert(spec->is_const && spec->values);
+    spec->n_consts = 0;
+    for (int j = 0; j < spec->n_params; ++j) {
+        spec->is_const[j] = is_const[j];
+        spec->values[j] = values[j];
+        spec->n_consts += is_const[j];
+    }
+    spec->n_sites = 0;
+    spec->sites = malloc(callee->n_callers * sizeof(iclistnode_t *));
+    spec->callers = malloc(callee->n_callers * sizeof(icfunc_t *));
+    assert(spec->sites && spec->callers);
+    spec->benefit = 0;
+    clone.specs = realloc(clone.specs, (clone.n_specs + 1) * sizeof(spec_t *));
+    assert(clone.specs);
+    clone.specs[clone.n_specs++] = spec;
+    return spec;
+}
+
+void destroy_spec(spec_t *spec)
+{
+    free(spec->is_const);
+    free(spec->values);
+    free(spec->sites);
+    free(spec->callers);
+    free(spec);
+}
+
+int clone_is_candidate(cgnode_t *node)
+{
+    return node && !node->is_recursive && strcmp(node->func->fname, "main") &&
+           icfunc_size(node->func) <= CLONE_MAX_SIZE;
+}
+
+void clone_collect_specs(cgnode_t *caller)
+{
+    clone.weights = malloc((caller->n_sites ? caller->n_sites : 1) * sizeof(int));
+    assert(clone.weights);
+    clone_weigh_sites(caller);
+
+    for (int k = 0; k < caller->n_sites; ++k) {
+        cgnode_t *callee = caller->callees[k];
+        if (!clone_is_candidate(callee))
+            continue;
+        int n_params = clone_n_params(callee->func);
+        char *is_const = malloc(n_params ? n_params : 1);
+        int *values = malloc((n_params ? n_params : 1) * sizeof(int));
+        assert(is_const && values);
+        iclistnode_t *arg = caller->sites[k]->prev;
+        for (int j = 0; j < n_params; ++j, arg = arg->prev) {
+            operand_t *op = &((ic_arg_t *)arg->ic)->arg;
+            is_const[j] = is_const_operand(op);
+            values[j] = (is_const[j] ? op->val : 0);
+        }
+
+        spec_t *spec = clone_find_spec(callee, is_const, values);
+        spec->sites[spec->n_sites] = caller->sites[k];
+        spec->callers[spec->n_sites++] = caller->func;
+        spec->benefit += clone.weights[k] * spec->n_consts;
+        free(is_const);
+        free(values);
+    }
+    free(clone.weights);
+}
+
+int compare_spec_benefit(const void *lhs, const void *rhs)
+{
+    return (*(spec_t **)rhs)->benefit - (*(spec_t **)lhs)->benefit;
+}
+
+const char *clone_mangle(icprog_t *prog, const char *fname)
+{
+    size_t len = strlen(fname) + 16;
+    char *name = malloc(len);
+    assert(name);
+    /* The names live as long as the intercodes, like those of the parser. */
+    for (int n = 1; ; ++n) {
+        snprintf(name, len, "%s__s%d", fname, n);
+        if (!icprog_find_func(prog, name))
+            return name;
+    }
+}
+
+void clone_make(icprog_t *prog, spec_t *spec)
+{
+    icfunc_t *func = spec->callee->func;
+    icfunc_t *copy = icprog_add_func(prog, clone_mangle(prog, func->fname));
+    iclist_copy_range(&copy->body, NULL, func->body.front->next, func->body.back);
+
+    /* Constant parameters become assignments after the others. */
+    iclistnode_t *cur = copy->body.front->next;
+    operand_t *params = malloc((spec->n_params ? spec->n_params : 1) * sizeof(operand_t));
+    assert(params);
+    for (int j = 0; j < spec->n_params; ++j) {
+        params[j] = ((ic_param_t *)cur->ic)->var;
+        if (spec->is_const[j])
+            cur = iclist_remove(&copy->body, cur);
+        else
+            cur = cur->next;
+    }
+    for (int j = 0; j < spec->n_params; ++j) {
+        if (!spec->is_const[j])
+            continue;
+        operand_t value;
+        init_const_operand(&value, spec->values[j]);
+        iclist_insert_before(&copy->body, cur, create_ic_assign(&params[j], &value));
+    }
+    free(params);
+
+    for (int i = 0; i < spec->n_sites; ++i) {
+        iclistnode_t *site = spec->sites[i], *arg = site->prev;
+        for (int j = 0; j < spec->n_params; ++j) {
+            iclistnode_t *prev = arg->prev;
+            if (spec->is_const[j])
+                iclist_remove(&spec->callers[i]->body, arg);
+            arg = prev;
+        }
+        ((ic_call_t *)site->ic)->fname = copy->fname;
+    }
+}
+
+int optim_clone(icprog_t *prog)
+{
+    callgraph_t *cg = clone.cg = create_callgraph(prog);
+    clone.n_specs = 0;
+    clone.specs = NULL;
+    for (int i = 0; i < cg->n_nodes; ++i)
+        clone_collect_specs(cg->nodes[i]);
+    if (clone.n_specs > 0)
+        qsort(clone.specs, clone.n_specs, sizeof(spec_t *), compare_spec_benefit);
+
+    int budget = CLONE_BUDGET, changed = 0;
+    for (int i = 0; i < clone.n_specs; ++i) {
+        spec_t *spec = clone.specs[i];
+        int size = icfunc_size(spec->callee->func);
+        if (spec->n_consts == 0 || spec->n_sites == spec->callee->n_callers ||
+            spec->benefit < CLONE_MIN_BENEFIT || size > budget)
+            continue;
+        budget -= size;
+        clone_make(prog, spec);
+        changed = 1;
+    }
+
+    for (int i = 0; i < clone.n_specs; ++i)
+        destroy_spec(clone.specs[i]);
+    free(clone.specs);
+    destroy_callgraph(cg);
+    return changed;
+}
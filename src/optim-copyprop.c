@@ -0,0 +1,316 @@
+#include "optim.h"
+#include "cfg.h"
+#include "bitset.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+/* ------------------------------------ *
+ *          copy propagation            *
+ * ------------------------------------ */
+
+/* A copy 'x := y' is available at a point if it is executed on every
+ * path reaching the point and neither x nor y is redefined after it.
+ * Then every use of x at the point can be replaced by y. The copies
+ * are numbered so that the sets of available copies are bitsets. */
+
+typedef struct copy {
+    operand_t rhs;
+    int lhs_index;
+    int rhs_index;
+} copy_t;
+
+static struct {
+    cfg_t *cfg;
+    int n_copies;
+    copy_t *copies;
+    int *copy_of_node;  /* indexed by the order of intercodes, -1 if none */
+    bitset_t **kill;    /* copies mentioning each variable */
+    bitset_t **in;
+    bitset_t **out;
+    bitset_t *state;
+} copyprop;
+
+int is_copy(intercode_t *ic)
+{
+    if (ic->kind != IC_ASSIGN)
+        return 0;
+    ic_assign_t *assign = (ic_assign_t *)ic;
+    return !is_const_operand(&assign->rhs) &&
+           !operand_is_equal(&assign->lhs, &assign->rhs);
+}
+
+void copyprop_collect()
+{
+    cfg_t *cfg = copyprop.cfg;
+    iclist_t *body = &cfg->func->body;
+    copyprop.copies = malloc((body->size ? body->size : 1) * sizeof(copy_t));
+    copyprop.copy_of_node = malloc((body->size ? body->size : 1) * sizeof(int));
+    assert(copyprop.copies && copyprop.copy_of_node);
+
+    int n = 0, i = 0;
+    for (iclistnode_t *cur = body->front; cur; cur = cur->next, ++i) {
+        copyprop.copy_of_node[i] = -1;
+        if (!is_copy(cur->ic))
+            continue;
+        ic_assign_t *assign = (ic_assign_t *)cur->ic;
+        copy_t *copy = &copyprop.copies[n];
+        copy->rhs = assign->rhs;
+        copy->lhs_index = cfg_var_index(cfg, &assign->lhs);
+        copy->rhs_index = cfg_var_index(cfg, &assign->rhs);
+        copyprop.copy_of_node[i] = n++;
+    }
+    copyprop.n_copies = n;
+    copyprop.in = copyprop.out = NULL;
+
+    copyprop.kill = malloc((cfg->n_vars ? cfg->n_vars : 1) * sizeof(bitset_t *));
+    assert(copyprop.kill);
+    for (int v = 0; v < cfg->n_vars; ++v)
+        copyprop.kill[v] = create_bitset(n);
+    for (int c = 0; c < n; ++c) {
+        bitset_add(copyprop.kill[copyprop.copies[c].lhs_index], c);
+        bitset_add(copyprop.kill[copyprop.copies[c].rhs_index], c);
+    }
+}
+
+/* The index of the first intercode of every block in the body. */
+int *copyprop_block_offsets()
+{
+    cfg_t *cfg = copyprop.cfg;
+    int *offsets = malloc(cfg->n_blocks * sizeof(int));
+    assert(offsets);
+    int i = 0, b = 0;
+    for (iclistnode_t *cur = cfg->func->body.front; cur; cur = cur->next, ++i)
+        if (b < cfg->n_blocks && cur == cfg->blocks[b]->first)
+            offsets[b++] = i;
+    assert(b == cfg->n_blocks);
+    return offsets;
+}
+
+void copyprop_transfer(intercode_t *ic, int copy)
+{
+    operand_t *def = intercode_def(ic);
+    if (def)
+        bitset_subtract(copyprop.state, copyprop.kill[cfg_var_index(copyprop.cfg, def)]);
+    if (copy >= 0)
+        bitset_add(copyprop.state, copy);
+}
+
+void copyprop_analyse(block_t **order, int n_order, int *offsets)
+{
+    cfg_t *cfg = copyprop.cfg;
+    copyprop.in = malloc(cfg->n_blocks * sizeof(bitset_t *));
+    copyprop.out = malloc(cfg->n_blocks * sizeof(bitset_t *));
+    assert(copyprop.in && copyprop.out);
+    for (int i = 0; i < cfg->n_blocks; ++i) {
+        copyprop.in[i] = create_bitset(copyprop.n_copies);
+        copyprop.out[i] = create_bitset(copyprop.n_copies);
+        /* Blocks not visited yet do not restrict the intersection. */
+        bitset_fill(copyprop.out[i]);
+    }
+    copyprop.state = create_bitset(copyprop.n_copies);
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = 0; i < n_order; ++i) {
+            block_t *block = order[i];
+            bitset_t *in = copyprop.in[block->id];
+            if (block->id == 0)
+                bitset_clear(in);
+            else
+                bitset_fill(in);
+            for (int j = 0; j < block->n_preds; ++j)
+                bitset_intersect(in, copyprop.out[block->preds[j]->id]);
+
+            bitset_copy(copyprop.state, in);
+            int k = offsets[block->id];
+            block_foreach(node, block)
+                copyprop_transfer(node->ic, copyprop.copy_of_node[k++]);
+            if (!bitset_equal(copyprop.state, copyprop.out[block->id])) {
+                bitset_copy(copyprop.out[block->id], copyprop.state);
+                changed = 1;
+            }
+        }
+    }
+}
+
+int copyprop_substitute(operand_t *op)
+{
+    int v = cfg_var_index(copyprop.cfg, op);
+    if (v < 0)
+        return 0;
+    for (int c = 0; c < copyprop.n_copies; ++c) {
+        copy_t *copy = &copyprop.copies[c];
+        if (copy->lhs_index == v && bitset_contains(copyprop.state, c)) {
+            *op = copy->rhs;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int copyprop_rewrite_block(block_t *block, int offset)
+{
+    int changed = 0;
+    bitset_copy(copyprop.state, copyprop.in[block->id]);
+    block_foreach(node, block) {
+        operand_t *uses[2];
+        int n_uses = intercode_uses(node->ic, uses);
+        for (int i = 0; i < n_uses; ++i)
+            changed |= copyprop_substitute(uses[i]);
+        /* The recorded copy still holds even if its rhs was replaced. */
+        copyprop_transfer(node->ic, copyprop.copy_of_node[offset++]);
+    }
+    return changed;
+}
+
+void copyprop_free()
+{
+    cfg_t *cfg = copyprop.cfg;
+    for (int v = 0; v < cfg->n_vars; ++v)
+        destroy_bitset(copyprop.kill[v]);
+    if (copyprop.in) {
+        for (int i = 0; i < cfg->n_blocks; ++i) {
+            destroy_bitset(copyprop.in[i]);
+            destroy_bitset(copyprop.out[i]);
+        }
+        destroy_bitset(copyprop.state);
+        free(copyprop.in);
+        free(copyprop.out);
+    }
+    free(copyprop.kill);
+    free(copyprop.copies);
+    free(copyprop.copy_of_node);
+}
+
+int propagate_copies(icfunc_t *func)
+{
+    cfg_t *cfg = create_cfg(func);
+    copyprop.cfg = cfg;
+    copyprop_collect();
+
+    int changed = 0;
+    if (copyprop.n_copies > 0) {
+        int n_order;
+        block_t **order = cfg_reverse_postorder(cfg, &n_order);
+        int *offsets = copyprop_block_offsets();
+        copyprop_analyse(order, n_order, offsets);
+        for (int i = 0; i < n_order; ++i)
+            changed |= copyprop_rewrite_block(order[i], offsets[order[i]->id]);
+        free(order);
+        free(offsets);
+    }
+
+    copyprop_free();
+    destroy_cfg(cfg);
+    return changed;
+}
+
+/* ------------------------------------ *
+ *          copy coalescing             *
+ * ------------------------------------ */
+
+/* For 't := expr; ...; v := t' in a block where the copy is the only use
+ * of the temporary t, compute expr into v directly if v is neither used
+ * nor defined in between. This removes the copies left by translating
+ * assignments, which propagation cannot remove since v is the variable
+ * living on. */
+
+int coalesce_copies(icfunc_t *func)
+{
+    cfg_t *cfg = create_cfg(func);
+    int n_vars = cfg->n_vars ? cfg->n_vars : 1;
+    int *n_uses = calloc(n_vars, sizeof(int));
+    int *n_defs = calloc(n_vars, sizeof(int));
+    assert(n_uses && n_defs);
+
+    for (iclistnode_t *cur = func->body.front; cur; cur = cur->next) {
+        operand_t *uses[2];
+        int n = intercode_uses(cur->ic, uses);
+        for (int i = 0; i < n; ++i)
+            if (!is_const_operand(uses[i]))
+                n_uses[cfg_var_index(cfg, uses[i])]++;
+        operand_t *def = intercode_def(cur->ic);
+        if (def)
+            n_defs[cfg_var_index(cfg, def)]++;
+    }
+
+    int changed = 0;
+    for (int b = 0; b < cfg->n_blocks; ++b) {
+        block_t *block = cfg->blocks[b];
+        iclistnode_t *end = block->last->next;
+        for (iclistnode_t *cur = block->first, *next; cur != end; cur = next) {
+            next = cur->next;
+            if (!is_copy(cur->ic))
+                continue;
+            ic_assign_t *copy = (ic_assign_t *)cur->ic;
+            int t = cfg_var_index(cfg, &copy->rhs);
+            int v = cfg_var_index(cfg, &copy->lhs);
+            if (!copy->rhs.is_temp || n_uses[t] != 1 || n_defs[t] != 1)
+                continue;
+
+            /* Search backward for the definition of t. */
+            iclistnode_t *def_node = NULL;
+            for (iclistnode_t *p = cur->prev; p != block->first->prev; p = p->prev) {
+                operand_t *def = intercode_def(p->ic);
+                if (def && cfg_var_index(cfg, def) == t) {
+                    def_node = p;
+                    break;
+                }
+                operand_t *uses[2];
+                int n = intercode_uses(p->ic, uses);
+                int conflict = (def && cfg_var_index(cfg, def) == v);
+                for (int i = 0; i < n; ++i)
+                    if (!is_const_operand(uses[i]) && cfg_var_index(cfg, uses[i]) == v)
+                        conflict = 1;
+                if (conflict)
+                    break;
+            }
+            if (!def_node || def_node->ic->kind == IC_PARAM)
+                continue;
+
+            *intercode_def(def_node->ic) = copy->lhs;
+            if (cur == block->last)
+                block->last = cur->prev;
+            iclist_remove(&func->body, cur);
+            n_defs[v]++;
+            changed = 1;
+        }
+    }
+
+    free(n_uses);
+    free(n_defs);
+    destroy_cfg(cfg);
+    return changed;
+}
+
+/* Propagation may turn a copy into 'x := x'. */
+int remove_self_copies(icfunc_t *func)
+{
+    int changed = 0;
+    for (iclistnode_t *cur = func->body.front, *next; cur; cur = next) {
+        next = cur->next;
+        intercode_t *ic = cur->ic;
+        if (ic->kind == IC_ASSIGN &&
+            operand_is_equal(&((ic_assign_t *)ic)->lhs, &((ic_assign_t *)ic)->rhs)) {
+            iclist_remove(&func->body, cur);
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+/* Every round replaces uses by the sources of older copies, so a few
+ * rounds are enough for the chains made by the translator. */
+#define COPYPROP_MAX_ROUNDS 8
+
+int optim_copyprop(icfunc_t *func)
+{
+    int changed = 0;
+    for (int i = 0; i < COPYPROP_MAX_ROUNDS && propagate_copies(func); ++i)
+        changed = 1;
+    changed |= remove_self_copies(func);
+    changed |= coalesce_copies(func);
+    return changed;
+}
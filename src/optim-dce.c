@@ -0,0 +1,511 @@
+#include "optim.h"
+#include "cfg.h"
+#include "bitset.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+/* ------------------------------------ *
+ *        dead code elimination         *
+ * ------------------------------------ */
+
+/* Mark and sweep. Intercodes with side effects are live at first. An
+ * intercode defining a variable used by a live one is live, and so is
+ * the branch that a live intercode is control dependent on. The rest
+ * is removed, and dead branches jump to their post-dominators. Reaching
+ * definitions link every use to its definitions. */
+
+static struct {
+    cfg_t *cfg;
+    int n_nodes;
+    iclistnode_t **nodes;   /* intercodes in the order of the body */
+    int *block_of;
+    int *offsets;           /* index of the first intercode of blocks */
+    int n_defs;
+    int *def_node;          /* intercode index of every definition */
+    int *def_of_node;       /* -1 if the intercode defines nothing */
+    bitset_t **var_defs;    /* definitions of every variable */
+    int *ud_begin;          /* definitions reaching the uses of intercode */
+    int *ud_chains;         /* i are ud_chains[ud_begin[i], ud_begin[i+1]) */
+    int *ipdoms;
+    int *n_deps;            /* blocks whose branches a block depends on */
+    int **deps;
+    char *marked;
+    char *block_marked;
+    int *worklist;
+    int size;
+} dce;
+
+int is_dce_root(intercode_t *ic)
+{
+    switch (ic->kind) {
+    case IC_CALL: case IC_ARG: case IC_READ: case IC_WRITE:
+    case IC_DREFASSIGN: case IC_RETURN:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* Intercodes that are never removed, though not live by themselves. */
+int is_dce_kept(intercode_t *ic)
+{
+    switch (ic->kind) {
+    case IC_FUNCDEF: case IC_PARAM: case IC_DEC:
+    case IC_LABEL: case IC_GOTO:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+void dce_number_nodes()
+{
+    cfg_t *cfg = dce.cfg;
+    iclist_t *body = &cfg->func->body;
+    dce.n_nodes = body->size;
+    dce.nodes = malloc(body->size * sizeof(iclistnode_t *));
+    dce.block_of = malloc(body->size * sizeof(int));
+    dce.offsets = malloc((cfg->n_blocks + 1) * sizeof(int));
+    dce.def_of_node = malloc(body->size * sizeof(int));
+    dce.def_node = malloc(body->size * sizeof(int));
+    assert(dce.nodes && dce.block_of && dce.offsets &&
+           dce.def_of_node && dce.def_node);
+
+    int i = 0;
+    for (int b = 0; b < cfg->n_blocks; ++b) {
+        dce.offsets[b] = i;
+        block_foreach(node, cfg->blocks[b]) {
+            dce.nodes[i] = node;
+            dce.block_of[i++] = b;
+        }
+    }
+    dce.offsets[cfg->n_blocks] = i;
+    assert(i == dce.n_nodes);
+
+    /* Definitions are numbered apart from intercodes, but there are at
+     * most as many of them. */
+    dce.var_defs = malloc((cfg->n_vars ? cfg->n_vars : 1) * sizeof(bitset_t *));
+    assert(dce.var_defs);
+    for (int v = 0; v < cfg->n_vars; ++v)
+        dce.var_defs[v] = create_bitset(dce.n_nodes);
+
+    dce.n_defs = 0;
+    for (i = 0; i < dce.n_nodes; ++i) {
+        operand_t *def = intercode_def(dce.nodes[i]->ic);
+        dce.def_of_node[i] = -1;
+        if (!def)
+            continue;
+        dce.def_node[dce.n_defs] = i;
+        dce.def_of_node[i] = dce.n_defs;
+        bitset_add(dce.var_defs[cfg_var_index(cfg, def)], dce.n_defs++);
+    }
+}
+
+void dce_transfer(bitset_t *state, int i)
+{
+    int d = dce.def_of_node[i];
+    if (d < 0)
+        return;
+    operand_t *def = intercode_def(dce.nodes[i]->ic);
+    bitset_subtract(state, dce.var_defs[cfg_var_index(dce.cfg, def)]);
+    bitset_add(state, d);
+}
+
+void dce_build_ud_chains()
+{
+    cfg_t *cfg = dce.cfg;
+    bitset_t **in = malloc(cfg->n_blocks * sizeof(bitset_t *));
+    bitset_t **out = malloc(cfg->n_blocks * sizeof(bitset_t *));
+    assert(in && out);
+    for (int b = 0; b < cfg->n_blocks; ++b) {
+        in[b] = create_bitset(dce.n_nodes);
+        out[b] = create_bitset(dce.n_nodes);
+    }
+    bitset_t *state = create_bitset(dce.n_nodes);
+
+    int n_order;
+    block_t **order = cfg_reverse_postorder(cfg, &n_order);
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int k = 0; k < n_order; ++k) {
+            int b = order[k]->id;
+            block_t *block = order[k];
+            for (int j = 0; j < block->n_preds; ++j)
+                bitset_union(in[b], out[block->preds[j]->id]);
+            bitset_copy(state, in[b]);
+            for (int i = dce.offsets[b]; i < dce.offsets[b + 1]; ++i)
+                dce_transfer(state, i);
+            changed |= bitset_union(out[b], state);
+        }
+    }
+    free(order);
+
+    /* Walk the blocks again and record the definitions reaching every
+     * use. Unreachable blocks get no chains, and are dead anyway. */
+    int capacity = 64, size = 0;
+    dce.ud_begin = malloc((dce.n_nodes + 1) * sizeof(int));
+    dce.ud_chains = malloc(capacity * sizeof(int));
+    assert(dce.ud_begin && dce.ud_chains);
+    for (int b = 0; b < cfg->n_blocks; ++b) {
+        bitset_copy(state, in[b]);
+        for (int i = dce.offsets[b]; i < dce.offsets[b + 1]; ++i) {
+            dce.ud_begin[i] = size;
+            operand_t *uses[2];
+            int n_uses = intercode_uses(dce.nodes[i]->ic, uses);
+            for (int u = 0; u < n_uses; ++u) {
+                int v = cfg_var_index(cfg, uses[u]);
+                if (v < 0)
+                    continue;
+                for (int d = 0; d < dce.n_defs; ++d) {
+                    if (!bitset_contains(state, d) || !bitset_contains(dce.var_defs[v], d))
+                        continue;
+                    if (size == capacity) {
+                        capacity *= 2;
+                        dce.ud_chains = realloc(dce.ud_chains, capacity * sizeof(int));
+                        assert(dce.ud_chains);
+                    }
+                    dce.ud_chains[size++] = d;
+                }
+            }
+            dce_transfer(state, i);
+        }
+    }
+    dce.ud_begin[dce.n_nodes] = size;
+
+    for (int b = 0; b < cfg->n_blocks; ++b) {
+        destroy_bitset(in[b]);
+        destroy_bitset(out[b]);
+    }
+    destroy_bitset(state);
+    free(in);
+    free(out);
+}
+
+/* Block y is control dependent on the branch of x if y post-dominates a
+ * successor of x but not x itself. These are found by walking up the
+ * post-dominator tree from every successor of x. */
+void dce_build_control_deps()
+{
+    cfg_t *cfg = dce.cfg;
+    int exit = cfg->n_blocks;
+    dce.ipdoms = cfg_ipdoms(cfg);
+    dce.n_deps = calloc(cfg->n_blocks, sizeof(int));
+    dce.deps = calloc(cfg->n_blocks, sizeof(int *));
+    assert(dce.n_deps && dce.deps);
+
+    for (int x = 0; x < cfg->n_blocks; ++x) {
+        block_t *block = cfg->blocks[x];
+        if (block->n_succs < 2)
+            continue;
+        for (int j = 0; j < block->n_succs; ++j) {
+            int y = block->succs[j]->id;
+            while (y != dce.ipdoms[x] && y != exit && y != -1) {
+                dce.deps[y] = realloc(dce.deps[y], (dce.n_deps[y] + 1) * sizeof(int));
+                assert(dce.deps[y]);
+                dce.deps[y][dce.n_deps[y]++] = x;
+                y = dce.ipdoms[y];
+            }
+        }
+    }
+}
+
+void dce_mark(int i)
+{
+    if (dce.marked[i])
+        return;
+    dce.marked[i] = 1;
+    dce.worklist[dce.size++] = i;
+}
+
+void dce_mark_block(int b)
+{
+    if (dce.block_marked[b])
+        return;
+    dce.block_marked[b] = 1;
+    for (int j = 0; j < dce.n_deps[b]; ++j) {
+        int x = dce.deps[b][j];
+        dce_mark(dce.offsets[x + 1] - 1);
+    }
+}
+
+void dce_propagate()
+{
+    cfg_t *cfg = dce.cfg;
+    int exit = cfg->n_blocks;
+    dce.marked = calloc(dce.n_nodes, sizeof(char));
+    dce.block_marked = calloc(cfg->n_blocks, sizeof(char));
+    dce.worklist = malloc(dce.n_nodes * sizeof(int));
+    assert(dce.marked && dce.block_marked && dce.worklist);
+    dce.size = 0;
+
+    for (int i = 0; i < dce.n_nodes; ++i) {
+        intercode_t *ic = dce.nodes[i]->ic;
+        if (is_dce_root(ic))
+            dce_mark(i);
+        /* Branches without a post-dominator to jump to, or leading to
+         * code that never returns, may decide whether the function
+         * terminates at all, so they are kept. */
+        if (ic->kind == IC_CONDGOTO) {
+            block_t *block = cfg->blocks[dce.block_of[i]];
+            int ipdom = dce.ipdoms[block->id];
+            int keep = (ipdom == -1 || ipdom == exit);
+            for (int j = 0; j < block->n_succs; ++j)
+                if (dce.ipdoms[block->succs[j]->id] == -1)
+                    keep = 1;
+            if (keep)
+                dce_mark(i);
+        }
+    }
+
+    while (dce.size > 0) {
+        int i = dce.worklist[--dce.size];
+        dce_mark_block(dce.block_of[i]);
+        for (int k = dce.ud_begin[i]; k < dce.ud_begin[i + 1]; ++k)
+            dce_mark(dce.def_node[dce.ud_chains[k]]);
+    }
+}
+
+/* Return the label beginning the block, adding one if there is none. */
+int dce_block_label(block_t *block)
+{
+    intercode_t *ic = block->first->ic;
+    if (ic->kind == IC_LABEL)
+        return ((ic_label_t *)ic)->labelid;
+    assert(ic->kind != IC_FUNCDEF);
+    int labelid = alloc_labelid();
+    block->first = iclist_insert_before(&dce.cfg->func->body, block->first,
+                                        create_ic_label(labelid));
+    return labelid;
+}
+
+int dce_sweep()
+{
+    cfg_t *cfg = dce.cfg;
+    iclist_t *body = &cfg->func->body;
+    int changed = 0;
+
+    for (int i = 0; i < dce.n_nodes; ++i) {
+        if (dce.marked[i])
+            continue;
+        iclistnode_t *node = dce.nodes[i];
+        intercode_t *ic = node->ic;
+        if (is_dce_kept(ic))
+            continue;
+        if (ic->kind == IC_CONDGOTO) {
+            block_t *target = cfg->blocks[dce.ipdoms[dce.block_of[i]]];
+            iclist_replace(node, create_ic_goto(dce_block_label(target)));
+        }
+        else {
+            iclist_remove(body, node);
+        }
+        changed = 1;
+    }
+    return changed;
+}
+
+void dce_free()
+{
+    for (int v = 0; v < dce.cfg->n_vars; ++v)
+        destroy_bitset(dce.var_defs[v]);
+    for (int b = 0; b < dce.cfg->n_blocks; ++b)
+        free(dce.deps[b]);
+    free(dce.var_defs);
+    free(dce.nodes);
+    free(dce.block_of);
+    free(dce.offsets);
+    free(dce.def_node);
+    free(dce.def_of_node);
+    free(dce.ud_begin);
+    free(dce.ud_chains);
+    free(dce.ipdoms);
+    free(dce.n_deps);
+    free(dce.deps);
+    free(dce.marked);
+    free(dce.block_marked);
+    free(dce.worklist);
+}
+
+int optim_dce(icfunc_t *func)
+{
+    cfg_t *cfg = create_cfg(func);
+    int changed = cfg_remove_unreachable(cfg);
+    if (changed) {
+        destroy_cfg(cfg);
+        cfg = create_cfg(func);
+    }
+
+    dce.cfg = cfg;
+    dce_number_nodes();
+    dce_build_ud_chains();
+    dce_build_control_deps();
+    dce_propagate();
+    changed |= dce_sweep();
+    dce_free();
+    destroy_cfg(cfg);
+
+    changed |= optim_simplify_cfg(func);
+    return changed;
+}
+
+/* ------------------------------------ *
+ *          cfg simplification          *
+ * ------------------------------------ */
+
+/* Jumps are retargeted past blocks consisting of a single GOTO, jumps to
+ * the next intercode are removed, and 'IF c GOTO L1; GOTO L2; LABEL L1'
+ * becomes 'IF !c GOTO L2; LABEL L1'. Then labels referred to by nothing
+ * are removed. */
+
+static struct {
+    int label_base;
+    int n_labels;
+    iclistnode_t **label_nodes;
+    int *n_refs;
+} simplify;
+
+iclistnode_t *simplify_label_node(int labelid)
+{
+    int i = labelid - simplify.label_base;
+    assert(i >= 0 && i < simplify.n_labels && simplify.label_nodes[i]);
+    return simplify.label_nodes[i];
+}
+
+int *jump_labelid(intercode_t *ic)
+{
+    if (ic->kind == IC_GOTO)
+        return &((ic_goto_t *)ic)->labelid;
+    if (ic->kind == IC_CONDGOTO)
+        return &((ic_condgoto_t *)ic)->labelid;
+    return NULL;
+}
+
+void simplify_index_labels(icfunc_t *func)
+{
+    simplify.label_base = labelid_bound();
+    int max = 0;
+    for (iclistnode_t *cur = func->body.front; cur; cur = cur->next) {
+        if (cur->ic->kind != IC_LABEL)
+            continue;
+        int labelid = ((ic_label_t *)cur->ic)->labelid;
+        if (labelid < simplify.label_base)
+            simplify.label_base = labelid;
+        if (labelid > max)
+            max = labelid;
+    }
+    simplify.n_labels = (max >= simplify.label_base ? max - simplify.label_base + 1 : 0);
+    int n = simplify.n_labels ? simplify.n_labels : 1;
+    simplify.label_nodes = calloc(n, sizeof(iclistnode_t *));
+    simplify.n_refs = calloc(n, sizeof(int));
+    assert(simplify.label_nodes && simplify.n_refs);
+
+    for (iclistnode_t *cur = func->body.front; cur; cur = cur->next) {
+        if (cur->ic->kind == IC_LABEL) {
+            int labelid = ((ic_label_t *)cur->ic)->labelid;
+            simplify.label_nodes[labelid - simplify.label_base] = cur;
+        }
+    }
+}
+
+/* Follow the labels and single GOTOs after a label to the intercode
+ * control finally reaches, and return the first of the labels
+ * immediately before it. */
+int simplify_final_label(int labelid)
+{
+    for (int steps = 0; steps < simplify.n_labels; ++steps) {
+        iclistnode_t *node = simplify_label_node(labelid);
+        while (node->next && node->next->ic->kind == IC_LABEL)
+            node = node->next;
+        if (!node->next || node->next->ic->kind != IC_GOTO)
+            break;
+        int next = ((ic_goto_t *)node->next->ic)->labelid;
+        if (next == labelid)
+            break;
+        labelid = next;
+    }
+    iclistnode_t *node = simplify_label_node(labelid);
+    while (node->prev->ic->kind == IC_LABEL)
+        node = node->prev;
+    return ((ic_label_t *)node->ic)->labelid;
+}
+
+/* Whether the label is among the labels right after the node. */
+int label_follows(iclistnode_t *node, int labelid)
+{
+    for (iclistnode_t *cur = node->next; cur && cur->ic->kind == IC_LABEL; cur = cur->next)
+        if (((ic_label_t *)cur->ic)->labelid == labelid)
+            return 1;
+    return 0;
+}
+
+int simplify_jumps(icfunc_t *func)
+{
+    int changed = 0;
+    for (iclistnode_t *cur = func->body.front, *next; cur; cur = next) {
+        next = cur->next;
+        int *labelid = jump_labelid(cur->ic);
+        if (!labelid)
+            continue;
+
+        int final = simplify_final_label(*labelid);
+        if (final != *labelid) {
+            *labelid = final;
+            changed = 1;
+        }
+        if (label_follows(cur, *labelid)) {
+            iclist_remove(&func->body, cur);
+            changed = 1;
+            continue;
+        }
+        /* Invert the condition to fall through to the next label. */
+        if (cur->ic->kind == IC_CONDGOTO && next && next->ic->kind == IC_GOTO &&
+            label_follows(next, *labelid)) {
+            ic_condgoto_t *cond = (ic_condgoto_t *)cur->ic;
+            cond->relop = complement_rel_icop(cond->relop);
+            cond->labelid = ((ic_goto_t *)next->ic)->labelid;
+            next = iclist_remove(&func->body, next);
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+int simplify_remove_labels(icfunc_t *func)
+{
+    for (iclistnode_t *cur = func->body.front; cur; cur = cur->next) {
+        int *labelid = jump_labelid(cur->ic);
+        if (labelid)
+            simplify.n_refs[*labelid - simplify.label_base]++;
+    }
+
+    int changed = 0;
+    for (iclistnode_t *cur = func->body.front, *next; cur; cur = next) {
+        next = cur->next;
+        if (cur->ic->kind != IC_LABEL)
+            continue;
+        if (simplify.n_refs[((ic_label_t *)cur->ic)->labelid - simplify.label_base] == 0) {
+            iclist_remove(&func->body, cur);
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+int optim_simplify_cfg(icfunc_t *func)
+{
+    int changed = 0, round_changed = 1;
+    while (round_changed) {
+        cfg_t *cfg = create_cfg(func);
+        round_changed = cfg_remove_unreachable(cfg);
+        destroy_cfg(cfg);
+
+        simplify_index_labels(func);
+        round_changed |= simplify_jumps(func);
+        round_changed |= simplify_remove_labels(func);
+        free(simplify.label_nodes);
+        free(simplify.n_refs);
+        changed |= round_changed;
+    }
+    return changed;
+}
@@ -0,0 +1,284 @@
+#include "optim.h"
+#include "callgraph.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* ------------------------------------ *
+ *           function inlining          *
+ * ------------------------------------ */
+
+/* A call is replaced by a copy of the body of the callee, where every
+ * variable and label gets a new id, the parameters are assigned from the
+ * arguments and the returns assign the result and jump to the end:
+ *
+ *     ARG t2; ARG t1; x := CALL f
+ *
+ * becomes
+ *
+ *     v1' := t1; v2' := t2; body'; x := r'; GOTO end; ...; LABEL end
+ *
+ * The declarations of the callee move to the beginning of the caller.
+ * Functions are visited bottom-up in the call graph, so that a callee
+ * has got its own calls inlined before it is measured. A call is inlined
+ * if the size of the callee, less the instructions of the call saved and
+ * a bonus for constant arguments, is within the threshold. A function
+ * called only once gets a bigger threshold, since it is likely to become
+ * dead. Calls inside a recursive SCC inline a copy of the callee taken
+ * before its SCC is visited, and the calls in the inlined code are
+ * inlined again up to a limited depth. */
+
+#define INLINE_DEFAULT_THRESHOLD    16
+#define INLINE_CONST_ARG_BONUS      2
+#define INLINE_SINGLE_CALLER_SCALE  4
+#define INLINE_MAX_FUNC_SIZE        400
+#define INLINE_MAX_DEPTH            2
+
+static int inline_threshold = INLINE_DEFAULT_THRESHOLD;
+
+static struct {
+    callgraph_t *cg;
+    /* Copies of the bodies of the SCC being visited, indexed by node id. */
+    icfunc_t *snapshots;
+    /* The calls to visit in the current function and their depths. */
+    int n_sites;
+    int capacity;
+    iclistnode_t **sites;
+    int *depths;
+    /* New ids of the variables and labels of the inlined callee. */
+    int *var_map;
+    int *label_map;
+} inliner;
+
+void optim_set_inline_threshold(int threshold)
+{
+    assert(threshold >= 0);
+    inline_threshold = threshold;
+}
+
+void inline_push_site(iclistnode_t *site, int depth)
+{
+    if (inliner.n_sites == inliner.capacity) {
+        inliner.capacity = (inliner.capacity ? 2 * inliner.capacity : 16);
+        inliner.sites = realloc(inliner.sites,
+                                inliner.capacity * sizeof(iclistnode_t *));
+        inliner.depths = realloc(inliner.depths, inliner.capacity * sizeof(int));
+        assert(inliner.sites && inliner.depths);
+    }
+    inliner.sites[inliner.n_sites] = site;
+    inliner.depths[inliner.n_sites++] = depth;
+}
+
+void inline_take_snapshot(icfunc_t *snapshot, icfunc_t *func)
+{
+    snapshot->fname = func->fname;
+    init_iclist(&snapshot->body);
+    for (iclistnode_t *cur = func->body.front; cur != NULL; cur = cur->next)
+        iclist_push_back(&snapshot->body, copy_intercode(cur->ic));
+}
+
+void inline_drop_snapshot(icfunc_t *snapshot)
+{
+    while (snapshot->body.size > 0)
+        iclist_remove(&snapshot->body, snapshot->body.front);
+}
+
+/* Whether the call at 'site' with the given depth is worth inlining into
+ * a caller of the given size. */
+int inline_is_profitable(cgnode_t *caller, cgnode_t *callee, iclistnode_t *site,
+                         int depth, int caller_size)
+{
+    if (!callee || !strcmp(callee->func->fname, "main"))
+        return 0;
+    int same_scc = (callee->scc == caller->scc);
+    if (same_scc && depth >= INLINE_MAX_DEPTH)
+        return 0;
+
+    int size = icfunc_size(same_scc ? &inliner.snapshots[callee->id] : callee->func);
+    if (caller_size + size > INLINE_MAX_FUNC_SIZE)
+        return 0;
+
+    /* The ARGs, the CALL and the RETURN are saved. */
+    int cost = size - 2;
+    for (iclistnode_t *arg = site->prev; arg && arg->ic->kind == IC_ARG;
+         arg = arg->prev) {
+        cost--;
+        if (is_const_operand(&((ic_arg_t *)arg->ic)->arg))
+            cost -= INLINE_CONST_ARG_BONUS;
+    }
+    int threshold = inline_threshold;
+    if (!callee->is_recursive && callee->n_callers == 1)
+        threshold *= INLINE_SINGLE_CALLER_SCALE;
+    return cost <= threshold;
+}
+
+void inline_remap_var(operand_t *op)
+{
+    if (op->kind != OPERAND_VAR && op->kind != OPERAND_ADDR)
+        return;
+    if (!inliner.var_map[op->varid])
+        inliner.var_map[op->varid] = alloc_varid();
+    op->varid = inliner.var_map[op->varid];
+}
+
+void inline_remap_label(int *labelid)
+{
+    if (!inliner.label_map[*labelid])
+        inliner.label_map[*labelid] = alloc_labelid();
+    *labelid = inliner.label_map[*labelid];
+}
+
+void inline_remap(intercode_t *ic)
+{
+    operand_t *def = intercode_def(ic);
+    if (def)
+        inline_remap_var(def);
+    operand_t *uses[2];
+    int n_uses = intercode_uses(ic, uses);
+    for (int i = 0; i < n_uses; ++i)
+        inline_remap_var(uses[i]);
+
+    switch (ic->kind) {
+    case IC_REF:
+        inline_remap_var(&((ic_ref_t *)ic)->rhs); break;
+    case IC_DEC:
+        inline_remap_var(&((ic_dec_t *)ic)->var); break;
+    case IC_LABEL:
+        inline_remap_label(&((ic_label_t *)ic)->labelid); break;
+    case IC_GOTO:
+        inline_remap_label(&((ic_goto_t *)ic)->labelid); break;
+    case IC_CONDGOTO:
+        inline_remap_label(&((ic_condgoto_t *)ic)->labelid); break;
+    default:
+        break;
+    }
+}
+
+/* Replace the call at 'site' in 'func' by a copy of 'src', the body of
+ * the callee. The calls copied are pushed as sites of the given depth if
+ * 'depth' is not negative. */
+void inline_call(icfunc_t *func, iclistnode_t *site, iclist_t *src, int depth)
+{
+    iclist_t *body = &func->body;
+    operand_t ret = ((ic_call_t *)site->ic)->ret;
+
+    int n_args = 0;
+    for (iclistnode_t *arg = site->prev; arg->ic->kind == IC_ARG; arg = arg->prev)
+        n_args++;
+    operand_t *args = malloc((n_args ? n_args : 1) * sizeof(operand_t));
+    assert(args);
+    for (int i = 0; i < n_args; ++i) {
+        args[i] = ((ic_arg_t *)site->prev->ic)->arg;
+        iclist_remove(body, site->prev);
+    }
+
+    iclistnode_t *decl_pos = body->front->next;
+    while (decl_pos->ic->kind == IC_PARAM)
+        decl_pos = decl_pos->next;
+
+    inliner.var_map = calloc(varid_bound(), sizeof(int));
+    inliner.label_map = calloc(labelid_bound(), sizeof(int));
+    assert(inliner.var_map && inliner.label_map);
+    int end_label = alloc_labelid(), n_params = 0;
+
+    for (iclistnode_t *cur = src->front->next; cur != NULL; cur = cur->next) {
+        intercode_t *ic = copy_intercode(cur->ic);
+        inline_remap(ic);
+        switch (ic->kind) {
+        case IC_PARAM:
+            assert(n_params < n_args);
+            iclist_insert_before(body, site,
+                                 create_ic_assign(&((ic_param_t *)ic)->var,
+                                                  &args[n_params++]));
+            destroy_intercode(ic);
+            break;
+        case IC_RETURN:
+            iclist_insert_before(body, site,
+                                 create_ic_assign(&ret, &((ic_return_t *)ic)->ret));
+            iclist_insert_before(body, site, create_ic_goto(end_label));
+            destroy_intercode(ic);
+            break;
+        case IC_DEC:
+            iclist_insert_before(body, decl_pos, ic);
+            break;
+        case IC_CALL: {
+            iclistnode_t *node = iclist_insert_before(body, site, ic);
+            if (depth >= 0)
+                inline_push_site(node, depth);
+            break;
+        }
+        default:
+            iclist_insert_before(body, site, ic);
+            break;
+        }
+    }
+    assert(n_params == n_args);
+    iclist_replace(site, create_ic_label(end_label));
+
+    free(inliner.var_map);
+    free(inliner.label_map);
+    free(args);
+}
+
+int inline_into(cgnode_t *caller)
+{
+    inliner.n_sites = 0;
+    for (int i = 0; i < caller->n_sites; ++i)
+        inline_push_site(caller->sites[i], 0);
+
+    int changed = 0, size = icfunc_size(caller->func);
+    for (int i = 0; i < inliner.n_sites; ++i) {
+        iclistnode_t *site = inliner.sites[i];
+        int depth = inliner.depths[i];
+        cgnode_t *callee = callgraph_find(inliner.cg, ((ic_call_t *)site->ic)->fname);
+        if (!inline_is_profitable(caller, callee, site, depth, size))
+            continue;
+        if (callee->scc == caller->scc) {
+            inline_call(caller->func, site, &inliner.snapshots[callee->id].body,
+                        depth + 1);
+        }
+        else {
+            inline_call(caller->func, site, &callee->func->body, -1);
+        }
+        size = icfunc_size(caller->func);
+        changed = 1;
+    }
+    return changed;
+}
+
+int optim_inline(icprog_t *prog)
+{
+    callgraph_t *cg = inliner.cg = create_callgraph(prog);
+    inliner.snapshots = malloc((cg->n_nodes ? cg->n_nodes : 1) * sizeof(icfunc_t));
+    assert(inliner.snapshots);
+    inliner.n_sites = inliner.capacity = 0;
+    inliner.sites = NULL;
+    inliner.depths = NULL;
+
+    int changed = 0;
+    for (int first = 0, last; first < cg->n_nodes; first = last) {
+        int scc = cg->bottom_up[first]->scc;
+        for (last = first; last < cg->n_nodes && cg->bottom_up[last]->scc == scc; ++last)
+            continue;
+        int is_recursive = cg->bottom_up[first]->is_recursive;
+        if (is_recursive) {
+            for (int i = first; i < last; ++i) {
+                cgnode_t *node = cg->bottom_up[i];
+                inline_take_snapshot(&inliner.snapshots[node->id], node->func);
+            }
+        }
+        for (int i = first; i < last; ++i)
+            changed |= inline_into(cg->bottom_up[i]);
+        if (is_recursive) {
+            for (int i = first; i < last; ++i)
+                inline_drop_snapshot(&inliner.snapshots[cg->bottom_up[i]->id]);
+        }
+    }
+
+    free(inliner.sites);
+    free(inliner.depths);
+    free(inliner.snapshots);
+    destroy_callgraph(cg);
+    return changed;
+}
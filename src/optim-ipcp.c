@@ -0,0 +1,238 @@
+#include "optim.h"
+#include "callgraph.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* ------------------------------------ *
+ * interprocedural constant propagation *
+ * ------------------------------------ */
+
+/* A parameter that gets the same constant from every call site is
+ * assigned the constant after the PARAMs, and a function returning the
+ * same constant everywhere has the constant assigned after each call of
+ * it, so that sccp can fold them. Functions are visited top-down for the
+ * parameters, so that an argument which is a parameter of the caller
+ * already known to be constant counts as that constant. This carries
+ * constants down through several levels of calls in one run. A parameter
+ * counts only if it is never assigned in the body. The returns are
+ * visited bottom-up likewise. Calls inside an SCC see only what is known
+ * of the functions visited before. main is never changed, since it is
+ * called from outside. */
+
+typedef struct ipcp_info {
+    int is_known;
+    int n_params;
+    operand_t *params;
+    char *is_assigned;  /* whether a parameter is assigned in the body */
+    char *is_const;
+    int *values;
+} ipcp_info_t;
+
+static struct {
+    callgraph_t *cg;
+    ipcp_info_t *infos;     /* indexed by node id */
+} ipcp;
+
+void ipcp_init_info(cgnode_t *node)
+{
+    ipcp_info_t *info = &ipcp.infos[node->id];
+    iclist_t *body = &node->func->body;
+    info->is_known = 0;
+    info->n_params = 0;
+    for (iclistnode_t *cur = body->front->next; cur && cur->ic->kind == IC_PARAM;
+         cur = cur->next)
+        info->n_params++;
+
+    int n = (info->n_params ? info->n_params : 1);
+    info->params = malloc(n * sizeof(operand_t));
+    info->is_assigned = calloc(n, sizeof(char));
+    info->is_const = calloc(n, sizeof(char));
+    info->values = calloc(n, sizeof(int));
+    assert(info->params && info->is_assigned && info->is_const && info->values);
+
+    iclistnode_t *cur = body->front->next;
+    for (int i = 0; i < info->n_params; ++i, cur = cur->next)
+        info->params[i] = ((ic_param_t *)cur->ic)->var;
+    for (; cur != NULL; cur = cur->next) {
+        operand_t *def = intercode_def(cur->ic);
+        for (int i = 0; def && i < info->n_params; ++i)
+            if (operand_is_equal(def, &info->params[i]))
+                info->is_assigned[i] = 1;
+    }
+}
+
+void ipcp_destroy_info(ipcp_info_t *info)
+{
+    free(info->params);
+    free(info->is_assigned);
+    free(info->is_const);
+    free(info->values);
+}
+
+/* Find the constant value of 'op' in the function of 'node'. */
+int ipcp_resolve(cgnode_t *node, operand_t *op, int *value)
+{
+    if (is_const_operand(op)) {
+        *value = op->val;
+        return 1;
+    }
+    ipcp_info_t *info = &ipcp.infos[node->id];
+    if (!info->is_known)
+        return 0;
+    for (int i = 0; i < info->n_params; ++i) {
+        if (info->is_const[i] && !info->is_assigned[i] &&
+            operand_is_equal(op, &info->params[i])) {
+            *value = info->values[i];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Meet the arguments of every call of 'callee' into its info. */
+void ipcp_meet_args(cgnode_t *callee)
+{
+    ipcp_info_t *info = &ipcp.infos[callee->id];
+    callgraph_t *cg = ipcp.cg;
+    for (int i = 0; i < info->n_params; ++i)
+        info->is_const[i] = 1;
+    int n_calls = 0;
+
+    for (int i = 0; i < cg->n_nodes; ++i) {
+        cgnode_t *caller = cg->nodes[i];
+        for (int k = 0; k < caller->n_sites; ++k) {
+            if (caller->callees[k] != callee)
+                continue;
+            n_calls++;
+            iclistnode_t *arg = caller->sites[k]->prev;
+            for (int j = 0; j < info->n_params; ++j, arg = arg->prev) {
+                assert(arg->ic->kind == IC_ARG);
+                int value;
+                if (!ipcp_resolve(caller, &((ic_arg_t *)arg->ic)->arg, &value))
+                    info->is_const[j] = 0;
+                else if (n_calls == 1)
+                    info->values[j] = value;
+                else if (info->values[j] != value)
+                    info->is_const[j] = 0;
+            }
+        }
+    }
+    if (n_calls == 0) {
+        for (int i = 0; i < info->n_params; ++i)
+            info->is_const[i] = 0;
+    }
+    info->is_known = 1;
+}
+
+/* Whether 'node' is 'var := #value'. */
+int ipcp_is_const_assign(iclistnode_t *node, operand_t *var, int value)
+{
+    if (!node || node->ic->kind != IC_ASSIGN)
+        return 0;
+    ic_assign_t *assign = (ic_assign_t *)node->ic;
+    return operand_is_equal(&assign->lhs, var) && is_const_operand(&assign->rhs) &&
+           assign->rhs.val == value;
+}
+
+int ipcp_bind_params(cgnode_t *node)
+{
+    ipcp_info_t *info = &ipcp.infos[node->id];
+    iclist_t *body = &node->func->body;
+    iclistnode_t *last = body->front;
+    for (int i = 0; i < info->n_params; ++i)
+        last = last->next;
+
+    int changed = 0;
+    for (int i = info->n_params - 1; i >= 0; --i) {
+        if (!info->is_const[i])
+            continue;
+        /* Assignments made by an earlier run follow the PARAMs. */
+        iclistnode_t *cur = last->next;
+        while (cur && !ipcp_is_const_assign(cur, &info->params[i], info->values[i]) &&
+               cur->ic->kind == IC_ASSIGN)
+            cur = cur->next;
+        if (ipcp_is_const_assign(cur, &info->params[i], info->values[i]))
+            continue;
+        operand_t value;
+        init_const_operand(&value, info->values[i]);
+        iclist_insert_after(body, last, create_ic_assign(&info->params[i], &value));
+        changed = 1;
+    }
+    return changed;
+}
+
+/* Store the constant returned by the function of 'node' in 'value', if
+ * every RETURN returns the same one. */
+int ipcp_const_return(cgnode_t *node, int *value)
+{
+    int n_returns = 0;
+    for (iclistnode_t *cur = node->func->body.front; cur != NULL; cur = cur->next) {
+        if (cur->ic->kind != IC_RETURN)
+            continue;
+        int ret;
+        if (!ipcp_resolve(node, &((ic_return_t *)cur->ic)->ret, &ret) ||
+            (n_returns > 0 && ret != *value))
+            return 0;
+        *value = ret;
+        n_returns++;
+    }
+    return n_returns > 0;
+}
+
+int ipcp_bind_returns(cgnode_t *callee, int value)
+{
+    callgraph_t *cg = ipcp.cg;
+    operand_t ret;
+    init_const_operand(&ret, value);
+    int changed = 0;
+    for (int i = 0; i < cg->n_nodes; ++i) {
+        cgnode_t *caller = cg->nodes[i];
+        for (int k = 0; k < caller->n_sites; ++k) {
+            iclistnode_t *site = caller->sites[k];
+            operand_t *var = &((ic_call_t *)site->ic)->ret;
+            if (caller->callees[k] != callee ||
+                ipcp_is_const_assign(site->next, var, value))
+                continue;
+            iclist_insert_after(&caller->func->body, site, create_ic_assign(var, &ret));
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+int optim_ipcp(icprog_t *prog)
+{
+    callgraph_t *cg = ipcp.cg = create_callgraph(prog);
+    ipcp.infos = malloc((cg->n_nodes ? cg->n_nodes : 1) * sizeof(ipcp_info_t));
+    assert(ipcp.infos);
+    for (int i = 0; i < cg->n_nodes; ++i)
+        ipcp_init_info(cg->nodes[i]);
+
+    /* Find the constant parameters of all functions before changing any,
+     * since the call sites are found by the call graph. */
+    for (int i = cg->n_nodes - 1; i >= 0; --i) {
+        cgnode_t *node = cg->bottom_up[i];
+        if (strcmp(node->func->fname, "main"))
+            ipcp_meet_args(node);
+    }
+    int changed = 0;
+    for (int i = 0; i < cg->n_nodes; ++i) {
+        cgnode_t *node = cg->bottom_up[i];
+        int value;
+        if (!strcmp(node->func->fname, "main"))
+            continue;
+        if (ipcp_const_return(node, &value))
+            changed |= ipcp_bind_returns(node, value);
+    }
+    for (int i = 0; i < cg->n_nodes; ++i)
+        if (ipcp.infos[i].is_known)
+            changed |= ipcp_bind_params(cg->nodes[i]);
+
+    for (int i = 0; i < cg->n_nodes; ++i)
+        ipcp_destroy_info(&ipcp.infos[i]);
+    free(ipcp.infos);
+    destroy_callgraph(cg);
+    return changed;
+}
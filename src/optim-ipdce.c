@@ -0,0 +1,134 @@
+#include "optim.h"
+#include "callgraph.h"
+#include "cfg.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* ------------------------------------ *
+ *     dead function elimination        *
+ * ------------------------------------ */
+
+/* Functions not reachable from main in the call graph are removed. */
+
+void deadfunc_mark(cgnode_t *node, char *is_live)
+{
+    if (is_live[node->id])
+        return;
+    is_live[node->id] = 1;
+    for (int i = 0; i < node->n_sites; ++i)
+        if (node->callees[i])
+            deadfunc_mark(node->callees[i], is_live);
+}
+
+int optim_deadfunc(icprog_t *prog)
+{
+    callgraph_t *cg = create_callgraph(prog);
+    cgnode_t *main_node = callgraph_find(cg, "main");
+    if (!main_node) {
+        destroy_callgraph(cg);
+        return 0;
+    }
+    char *is_live = calloc(cg->n_nodes, sizeof(char));
+    assert(is_live);
+    deadfunc_mark(main_node, is_live);
+
+    /* Nodes are in the order of the functions, which shift as they are
+     * removed. */
+    int changed = 0;
+    for (int i = cg->n_nodes - 1; i >= 0; --i) {
+        if (is_live[i])
+            continue;
+        icprog_remove_func(prog, i);
+        changed = 1;
+    }
+    free(is_live);
+    destroy_callgraph(cg);
+    return changed;
+}
+
+/* ------------------------------------ *
+ *     dead argument elimination        *
+ * ------------------------------------ */
+
+/* A parameter whose value on entry is never used is removed from its
+ * function together with the corresponding argument of every call. */
+
+/* Mark the parameters of the function not live after the PARAMs. */
+int deadarg_find(icfunc_t *func, char *is_dead)
+{
+    cfg_t *cfg = create_cfg(func);
+    liveness_t *live = create_liveness(cfg);
+    block_t *entry = cfg->blocks[0];
+
+    bitset_t *state = create_bitset(cfg->n_vars);
+    bitset_copy(state, live->out[0]);
+    iclistnode_t *cur;
+    for (cur = entry->last; cur->ic->kind != IC_PARAM && cur != entry->first;
+         cur = cur->prev)
+        liveness_transfer(cfg, cur->ic, state);
+
+    int n_params = 0, n_dead = 0;
+    for (iclistnode_t *param = entry->first->next;
+         param && param->ic->kind == IC_PARAM; param = param->next) {
+        int index = cfg_var_index(cfg, &((ic_param_t *)param->ic)->var);
+        is_dead[n_params] = !bitset_contains(state, index);
+        n_dead += is_dead[n_params++];
+    }
+
+    destroy_bitset(state);
+    destroy_liveness(live);
+    destroy_cfg(cfg);
+    return n_dead;
+}
+
+int optim_deadarg(icprog_t *prog)
+{
+    callgraph_t *cg = create_callgraph(prog);
+    int changed = 0;
+    for (int i = 0; i < cg->n_nodes; ++i) {
+        cgnode_t *callee = cg->nodes[i];
+        iclist_t *body = &callee->func->body;
+        if (!strcmp(callee->func->fname, "main"))
+            continue;
+        int n_params = 0;
+        for (iclistnode_t *cur = body->front->next; cur && cur->ic->kind == IC_PARAM;
+             cur = cur->next)
+            n_params++;
+        char *is_dead = calloc(n_params ? n_params : 1, sizeof(char));
+        assert(is_dead);
+        if (n_params == 0 || deadarg_find(callee->func, is_dead) == 0) {
+            free(is_dead);
+            continue;
+        }
+
+        /* The ARG just before a CALL is the first argument. */
+        for (int j = 0; j < cg->n_nodes; ++j) {
+            cgnode_t *caller = cg->nodes[j];
+            for (int k = 0; k < caller->n_sites; ++k) {
+                if (caller->callees[k] != callee)
+                    continue;
+                iclistnode_t *arg = caller->sites[k]->prev;
+                for (int p = 0; p < n_params; ++p) {
+                    assert(arg->ic->kind == IC_ARG);
+                    iclistnode_t *prev = arg->prev;
+                    if (is_dead[p])
+                        iclist_remove(&caller->func->body, arg);
+                    arg = prev;
+                }
+            }
+        }
+        iclistnode_t *param = body->front->next;
+        for (int p = 0; p < n_params; ++p) {
+            if (is_dead[p])
+                param = iclist_remove(body, param);
+            else
+                param = param->next;
+        }
+        free(is_dead);
+        changed = 1;
+    }
+    destroy_callgraph(cg);
+    return changed;
+}
@@ -0,0 +1,476 @@
+#include "optim.h"
+#include "loop.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+/* ------------------------------------ *
+ *    induction variable analysis       *
+ * ------------------------------------ */
+
+/* A basic induction variable of a loop is a variable whose definitions
+ * in the loop are all of the form 'i := i + c' with a constant c. An
+ * expression is in terms of it if its value is 'scale * i + offset +
+ * base', where scale and offset are constants and base is a variable
+ * not defined in the loop. An expression of no induction variable with
+ * a zero scale is invariant. Forms are tracked within a block, and are
+ * valid only as long as the induction variable is not redefined. */
+
+typedef struct ivform {
+    int root;           /* index of the induction variable, -1 if none */
+    int version;        /* definitions of the root seen before */
+    int scale;
+    int offset;
+    operand_t base;     /* OPERAND_NONE if none */
+} ivform_t;
+
+/* A new induction variable reducing the computations of a form. */
+typedef struct reduced {
+    ivform_t form;
+    operand_t var;
+} reduced_t;
+
+static struct {
+    cfg_t *cfg;
+    loop_t *loop;
+    int *n_loop_defs;
+    char *is_basic;
+    operand_t *basic_vars;  /* the operands of the basic variables */
+    int *versions;      /* current version of every basic variable */
+    ivform_t *forms;    /* the form of every variable in the block */
+    int *form_stamps;
+    int stamp;
+    int n_reduced;
+    reduced_t *reduced;
+} ivsr;
+
+void ivsr_find_basic()
+{
+    cfg_t *cfg = ivsr.cfg;
+    loop_t *loop = ivsr.loop;
+    for (int v = 0; v < cfg->n_vars; ++v)
+        ivsr.is_basic[v] = 1;
+    for (int i = 0; i < loop->n_blocks; ++i) {
+        block_foreach(node, loop->blocks[i]) {
+            operand_t *def = intercode_def(node->ic);
+            if (!def)
+                continue;
+            int v = cfg_var_index(cfg, def);
+            ivsr.n_loop_defs[v]++;
+            ivsr.basic_vars[v] = *def;
+            if (def->kind != OPERAND_VAR || loop_iv_step(node->ic, def) == 0)
+                ivsr.is_basic[v] = 0;
+        }
+    }
+    for (int v = 0; v < cfg->n_vars; ++v)
+        if (ivsr.n_loop_defs[v] == 0)
+            ivsr.is_basic[v] = 0;
+}
+
+void init_ivform(ivform_t *form, int root, int scale, int offset)
+{
+    form->root = root;
+    form->version = (root >= 0 ? ivsr.versions[root] : 0);
+    form->scale = scale;
+    form->offset = offset;
+    form->base.kind = OPERAND_NONE;
+}
+
+int ivform_is_const(ivform_t *form)
+{
+    return form->root < 0 && form->base.kind == OPERAND_NONE;
+}
+
+/* Return the form of the operand at the current point, or 0 if it has
+ * none. */
+int ivsr_operand_form(operand_t *op, ivform_t *form)
+{
+    if (is_const_operand(op)) {
+        init_ivform(form, -1, 0, op->val);
+        return 1;
+    }
+    int v = cfg_var_index(ivsr.cfg, op);
+    if (ivsr.n_loop_defs[v] == 0) {
+        init_ivform(form, -1, 0, 0);
+        form->base = *op;
+        return 1;
+    }
+    if (ivsr.is_basic[v]) {
+        init_ivform(form, v, 1, 0);
+        return 1;
+    }
+    if (ivsr.form_stamps[v] != ivsr.stamp)
+        return 0;
+    *form = ivsr.forms[v];
+    return form->root < 0 || form->version == ivsr.versions[form->root];
+}
+
+int ivform_add(ivform_t *lhs, ivform_t *rhs, ivform_t *result)
+{
+    if (lhs->root >= 0 && rhs->root >= 0)
+        return 0;
+    if (lhs->base.kind != OPERAND_NONE && rhs->base.kind != OPERAND_NONE)
+        return 0;
+    *result = (lhs->root >= 0 ? *lhs : *rhs);
+    result->offset = lhs->offset + rhs->offset;
+    if (lhs->base.kind != OPERAND_NONE)
+        result->base = lhs->base;
+    if (rhs->base.kind != OPERAND_NONE)
+        result->base = rhs->base;
+    return 1;
+}
+
+/* Compute the form of the value defined by the intercode. */
+int ivsr_def_form(intercode_t *ic, ivform_t *form)
+{
+    if (ic->kind == IC_ASSIGN)
+        return ivsr_operand_form(&((ic_assign_t *)ic)->rhs, form);
+    if (ic->kind != IC_ARITHBOP)
+        return 0;
+
+    ic_arithbop_t *arith = (ic_arithbop_t *)ic;
+    ivform_t lhs, rhs;
+    if (!ivsr_operand_form(&arith->lhs, &lhs) ||
+        !ivsr_operand_form(&arith->rhs, &rhs))
+        return 0;
+    switch (arith->op) {
+    case ICOP_ADD:
+        return ivform_add(&lhs, &rhs, form);
+    case ICOP_SUB:
+        if (!ivform_is_const(&rhs))
+            return 0;
+        rhs.offset = -rhs.offset;
+        return ivform_add(&lhs, &rhs, form);
+    case ICOP_MUL:
+        if (ivform_is_const(&lhs)) {
+            ivform_t t = lhs; lhs = rhs; rhs = t;
+        }
+        if (!ivform_is_const(&rhs) || lhs.base.kind != OPERAND_NONE)
+            return 0;
+        *form = lhs;
+        form->scale *= rhs.offset;
+        form->offset *= rhs.offset;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* ------------------------------------ *
+ *   induction variable reduction       *
+ * ------------------------------------ */
+
+/* The address computations of an induction variable, like those of
+ * 'a[i]', are replaced by copies of new induction variables. Each of
+ * them is initialized in the preheader and incremented right after every
+ * definition of its basic variable, so that it always holds the value
+ * of its form. An exit test on the basic variable is then rewritten
+ * onto a new variable, and the basic variable is left to dead code
+ * elimination if that was its last use. */
+
+int ivform_is_equal(ivform_t *lhs, ivform_t *rhs)
+{
+    if (lhs->root != rhs->root || lhs->scale != rhs->scale ||
+        lhs->offset != rhs->offset || lhs->base.kind != rhs->base.kind)
+        return 0;
+    return lhs->base.kind == OPERAND_NONE ||
+           operand_is_equal(&lhs->base, &rhs->base);
+}
+
+/* Whether computing the intercode every iteration is worth replacing.
+ * Only addresses are, as other values may overflow when incremented
+ * past the last iteration, which never computes them. */
+int ivsr_is_candidate(intercode_t *ic, operand_t *def, ivform_t *form)
+{
+    if (ic->kind != IC_ARITHBOP || def->kind != OPERAND_ADDR ||
+        form->root < 0 || form->scale == 0)
+        return 0;
+    int op = ((ic_arithbop_t *)ic)->op;
+    return op == ICOP_MUL ||
+           ((op == ICOP_ADD || op == ICOP_SUB) && form->scale != 1);
+}
+
+/* Return the index of the new induction variable of the form. */
+int ivsr_reduce(ivform_t *form)
+{
+    for (int i = 0; i < ivsr.n_reduced; ++i)
+        if (ivform_is_equal(&ivsr.reduced[i].form, form))
+            return i;
+    ivsr.reduced = realloc(ivsr.reduced, (ivsr.n_reduced + 1) * sizeof(reduced_t));
+    assert(ivsr.reduced);
+    reduced_t *reduced = &ivsr.reduced[ivsr.n_reduced++];
+    reduced->form = *form;
+    init_temp_addr(&reduced->var);
+    return ivsr.n_reduced - 1;
+}
+
+/* Find the candidates and give them new induction variables, without
+ * changing the code. Return the number of candidates. */
+int ivsr_find_candidates(iclistnode_t **candidates, int *reduced_of)
+{
+    cfg_t *cfg = ivsr.cfg;
+    loop_t *loop = ivsr.loop;
+    int n = 0;
+    for (int i = 0; i < loop->n_blocks; ++i) {
+        ivsr.stamp++;
+        block_foreach(node, loop->blocks[i]) {
+            intercode_t *ic = node->ic;
+            operand_t *def = intercode_def(ic);
+            if (!def)
+                continue;
+            int v = cfg_var_index(cfg, def);
+            ivform_t form;
+            int has_form = ivsr_def_form(ic, &form);
+            if (has_form && ivsr_is_candidate(ic, def, &form)) {
+                candidates[n] = node;
+                reduced_of[n++] = ivsr_reduce(&form);
+            }
+            if (ivsr.is_basic[v]) {
+                ivsr.versions[v]++;
+            } else if (has_form) {
+                ivsr.forms[v] = form;
+                ivsr.form_stamps[v] = ivsr.stamp;
+            } else {
+                ivsr.form_stamps[v] = 0;
+            }
+        }
+    }
+    return n;
+}
+
+/* Emit 'var := scale * op + offset + base' before the position. */
+void ivsr_emit_form(iclistnode_t *pos, operand_t *var, operand_t *op,
+                    ivform_t *form)
+{
+    iclist_t *body = &ivsr.cfg->func->body;
+    operand_t scale, offset;
+    init_const_operand(&scale, form->scale);
+    init_const_operand(&offset, form->offset);
+    if (is_const_operand(op)) {
+        init_const_operand(&offset, form->scale * op->val + form->offset);
+        iclist_insert_before(body, pos, create_ic_assign(var, &offset));
+        offset.val = 0;
+    } else if (form->scale == 1)
+        iclist_insert_before(body, pos, create_ic_assign(var, op));
+    else
+        iclist_insert_before(body, pos,
+                             create_ic_arithbop(ICOP_MUL, var, op, &scale));
+    if (offset.val != 0)
+        iclist_insert_before(body, pos,
+                             create_ic_arithbop(ICOP_ADD, var, var, &offset));
+    if (form->base.kind != OPERAND_NONE)
+        iclist_insert_before(body, pos,
+                             create_ic_arithbop(ICOP_ADD, var, var, &form->base));
+}
+
+/* Follow the increment of a basic variable by those of its new ones. */
+void ivsr_emit_increments(iclistnode_t *node)
+{
+    operand_t *def = intercode_def(node->ic);
+    int root = cfg_var_index(ivsr.cfg, def);
+    int step = loop_iv_step(node->ic, def);
+    for (int k = 0; k < ivsr.n_reduced; ++k) {
+        reduced_t *reduced = &ivsr.reduced[k];
+        if (reduced->form.root != root)
+            continue;
+        operand_t inc;
+        init_const_operand(&inc, reduced->form.scale * step);
+        iclist_insert_after(&ivsr.cfg->func->body, node,
+                            create_ic_arithbop(ICOP_ADD, &reduced->var,
+                                               &reduced->var, &inc));
+    }
+}
+
+/* ------------------------------------ *
+ *    linear function test replacement  *
+ * ------------------------------------ */
+
+/* Return the side of the exit test comparing a basic induction
+ * variable with an invariant, or NULL. */
+operand_t *ivsr_test_side(intercode_t *ic, operand_t **other)
+{
+    if (ic->kind != IC_CONDGOTO)
+        return NULL;
+    ic_condgoto_t *condgoto = (ic_condgoto_t *)ic;
+    operand_t *sides[2] = { &condgoto->lhs, &condgoto->rhs };
+    for (int i = 0; i < 2; ++i) {
+        operand_t *iv = sides[i], *inv = sides[1 - i];
+        if (is_const_operand(iv) || !ivsr.is_basic[cfg_var_index(ivsr.cfg, iv)])
+            continue;
+        if (!is_const_operand(inv) && ivsr.n_loop_defs[cfg_var_index(ivsr.cfg, inv)])
+            continue;
+        *other = inv;
+        return iv;
+    }
+    return NULL;
+}
+
+int node_in(iclistnode_t **nodes, int n, iclistnode_t *node)
+{
+    for (int i = 0; i < n; ++i)
+        if (nodes[i] == node)
+            return 1;
+    return 0;
+}
+
+/* Whether the basic variable is used in the loop only by its increments,
+ * exit tests and the candidates, and is dead after the loop. */
+int ivsr_is_replaceable(liveness_t *live, int root,
+                        iclistnode_t **candidates, int n_candidates)
+{
+    cfg_t *cfg = ivsr.cfg;
+    loop_t *loop = ivsr.loop;
+    for (int i = 0; i < loop->n_blocks; ++i) {
+        block_t *block = loop->blocks[i];
+        block_foreach(node, block) {
+            intercode_t *ic = node->ic;
+            operand_t *def = intercode_def(ic);
+            if ((def && cfg_var_index(cfg, def) == root) ||
+                node_in(candidates, n_candidates, node))
+                continue;
+            operand_t *other;
+            operand_t *side = ivsr_test_side(ic, &other);
+            if (side && cfg_var_index(cfg, side) == root)
+                continue;
+            operand_t *uses[2];
+            int n_uses = intercode_uses(ic, uses);
+            for (int k = 0; k < n_uses; ++k)
+                if (!is_const_operand(uses[k]) &&
+                    cfg_var_index(cfg, uses[k]) == root)
+                    return 0;
+        }
+        for (int k = 0; k < block->n_succs; ++k)
+            if (!loop_contains(loop, block->succs[k]) &&
+                bitset_contains(live->in[block->succs[k]->id], root))
+                return 0;
+    }
+    return 1;
+}
+
+/* Find the tests to rewrite onto new induction variables. Return their
+ * number. */
+int ivsr_find_tests(iclistnode_t **tests, int *reduced_of,
+                    iclistnode_t **candidates, int n_candidates)
+{
+    cfg_t *cfg = ivsr.cfg;
+    loop_t *loop = ivsr.loop;
+    liveness_t *live = create_liveness(cfg);
+    int n = 0;
+    for (int i = 0; i < loop->n_blocks; ++i) {
+        block_t *block = loop->blocks[i];
+        operand_t *other;
+        operand_t *side = ivsr_test_side(block->last->ic, &other);
+        if (!side)
+            continue;
+        int root = cfg_var_index(cfg, side), k = -1;
+        for (int j = 0; j < ivsr.n_reduced && k < 0; ++j) {
+            ivform_t *form = &ivsr.reduced[j].form;
+            if (form->root == root && form->scale > 0)
+                k = j;
+        }
+        if (k < 0 ||
+            !ivsr_is_replaceable(live, root, candidates, n_candidates))
+            continue;
+        tests[n] = block->last;
+        reduced_of[n++] = k;
+    }
+    destroy_liveness(live);
+    return n;
+}
+
+void ivsr_replace_test(iclistnode_t *pos, iclistnode_t *test, reduced_t *reduced)
+{
+    /* The comparison keeps its sense as the scale is positive. */
+    operand_t *other;
+    operand_t *side = ivsr_test_side(test->ic, &other);
+    ivform_t *form = &reduced->form;
+    operand_t bound;
+    init_temp_addr(&bound);
+    ivsr_emit_form(pos, &bound, other, form);
+    *other = bound;
+    *side = reduced->var;
+}
+
+/* ------------------------------------ *
+ *           the pass                   *
+ * ------------------------------------ */
+
+int ivsr_loop(loopnest_t *nest, loop_t *loop)
+{
+    cfg_t *cfg = nest->cfg;
+    int n_vars = (cfg->n_vars ? cfg->n_vars : 1);
+    ivsr.cfg = cfg;
+    ivsr.loop = loop;
+    ivsr.n_loop_defs = calloc(n_vars, sizeof(int));
+    ivsr.is_basic = calloc(n_vars, sizeof(char));
+    ivsr.basic_vars = malloc(n_vars * sizeof(operand_t));
+    ivsr.versions = calloc(n_vars, sizeof(int));
+    ivsr.forms = malloc(n_vars * sizeof(ivform_t));
+    ivsr.form_stamps = calloc(n_vars, sizeof(int));
+    ivsr.stamp = 0;
+    ivsr.n_reduced = 0;
+    ivsr.reduced = NULL;
+    int size = (cfg->func->body.size ? cfg->func->body.size : 1);
+    iclistnode_t **candidates = malloc(size * sizeof(iclistnode_t *));
+    iclistnode_t **tests = malloc(size * sizeof(iclistnode_t *));
+    iclistnode_t **increments = malloc(size * sizeof(iclistnode_t *));
+    int *cand_reduced = malloc(size * sizeof(int));
+    int *test_reduced = malloc(size * sizeof(int));
+    assert(ivsr.n_loop_defs && ivsr.is_basic && ivsr.basic_vars &&
+           ivsr.versions && ivsr.forms && ivsr.form_stamps);
+    assert(candidates && tests && increments && cand_reduced && test_reduced);
+
+    /* Everything is found before the code changes, as new variables are
+     * unknown to the CFG. */
+    ivsr_find_basic();
+    int n_candidates = ivsr_find_candidates(candidates, cand_reduced);
+    int n_tests = 0, n_increments = 0;
+    iclistnode_t *pos = NULL;
+    if (n_candidates > 0) {
+        n_tests = ivsr_find_tests(tests, test_reduced, candidates, n_candidates);
+        for (int i = 0; i < loop->n_blocks; ++i) {
+            block_foreach(node, loop->blocks[i]) {
+                operand_t *def = intercode_def(node->ic);
+                if (def && ivsr.is_basic[cfg_var_index(cfg, def)])
+                    increments[n_increments++] = node;
+            }
+        }
+        pos = loop_insert_preheader(nest, loop);
+    }
+
+    if (pos) {
+        for (int i = 0; i < ivsr.n_reduced; ++i) {
+            reduced_t *reduced = &ivsr.reduced[i];
+            ivsr_emit_form(pos, &reduced->var, &ivsr.basic_vars[reduced->form.root],
+                           &reduced->form);
+        }
+        for (int i = 0; i < n_candidates; ++i) {
+            operand_t target = *intercode_def(candidates[i]->ic);
+            iclist_replace(candidates[i],
+                           create_ic_assign(&target, &ivsr.reduced[cand_reduced[i]].var));
+        }
+        for (int i = 0; i < n_tests; ++i)
+            ivsr_replace_test(pos, tests[i], &ivsr.reduced[test_reduced[i]]);
+        for (int i = 0; i < n_increments; ++i)
+            ivsr_emit_increments(increments[i]);
+    }
+
+    free(ivsr.n_loop_defs);
+    free(ivsr.is_basic);
+    free(ivsr.basic_vars);
+    free(ivsr.versions);
+    free(ivsr.forms);
+    free(ivsr.form_stamps);
+    free(ivsr.reduced);
+    free(candidates);
+    free(tests);
+    free(increments);
+    free(cand_reduced);
+    free(test_reduced);
+    return pos != NULL;
+}
+
+int optim_ivsr(icfunc_t *func)
+{
+    return loop_transform_each(func, ivsr_loop);
+}
@@ -0,0 +1,312 @@
+#include "optim.h"
+#include "loop.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+/* ------------------------------------ *
+ *           address bases              *
+ * ------------------------------------ */
+
+/* Every address computed in a function is an offset from a local
+ * array or from a pointer received as parameter or loaded. The base is
+ * found through variables defined only once, and is the varid of the
+ * array, or -1 if unknown. An array escapes if its address is used in
+ * any other way than deriving addresses and accessing memory, so that
+ * only stores through unknown pointers may modify it. */
+
+static struct {
+    cfg_t *cfg;
+    int *n_defs;            /* in the whole function */
+    intercode_t **defs;     /* the only definition, if there is one */
+    char *escaped;          /* indexed by varid - var_base */
+} addr;
+
+#define ADDR_MAX_DEPTH  16
+
+int addr_base_r(operand_t *op, int depth)
+{
+    if (is_const_operand(op) || depth > ADDR_MAX_DEPTH)
+        return -1;
+    int v = cfg_var_index(addr.cfg, op);
+    if (addr.n_defs[v] != 1)
+        return -1;
+
+    intercode_t *ic = addr.defs[v];
+    switch (ic->kind) {
+    case IC_REF:
+        return ((ic_ref_t *)ic)->rhs.varid;
+    case IC_ASSIGN:
+        return addr_base_r(&((ic_assign_t *)ic)->rhs, depth + 1);
+    case IC_ARITHBOP: {
+        ic_arithbop_t *arith = (ic_arithbop_t *)ic;
+        if (arith->op != ICOP_ADD && arith->op != ICOP_SUB)
+            return -1;
+        int base = addr_base_r(&arith->lhs, depth + 1);
+        if (base < 0 && arith->op == ICOP_ADD)
+            base = addr_base_r(&arith->rhs, depth + 1);
+        return base;
+    }
+    default:
+        return -1;
+    }
+}
+
+int addr_base(operand_t *op)
+{
+    return addr_base_r(op, 0);
+}
+
+int addr_is_escaped(int base)
+{
+    return addr.escaped[base - addr.cfg->var_base];
+}
+
+void init_addr_bases(cfg_t *cfg)
+{
+    addr.cfg = cfg;
+    addr.n_defs = calloc(cfg->n_vars ? cfg->n_vars : 1, sizeof(int));
+    addr.defs = calloc(cfg->n_vars ? cfg->n_vars : 1, sizeof(intercode_t *));
+    addr.escaped = calloc(cfg->n_varids ? cfg->n_varids : 1, sizeof(char));
+    assert(addr.n_defs && addr.defs && addr.escaped);
+
+    iclist_t *body = &cfg->func->body;
+    for (iclistnode_t *cur = body->front; cur; cur = cur->next) {
+        operand_t *def = intercode_def(cur->ic);
+        if (!def)
+            continue;
+        int v = cfg_var_index(cfg, def);
+        addr.n_defs[v]++;
+        addr.defs[v] = cur->ic;
+    }
+
+    for (iclistnode_t *cur = body->front; cur; cur = cur->next) {
+        intercode_t *ic = cur->ic;
+        operand_t *uses[2];
+        int n_uses = intercode_uses(ic, uses);
+        operand_t *def = intercode_def(ic);
+        for (int i = 0; i < n_uses; ++i) {
+            int base = addr_base(uses[i]);
+            if (base < 0)
+                continue;
+            int derives = (ic->kind == IC_ASSIGN ||
+                           (ic->kind == IC_ARITHBOP &&
+                            (((ic_arithbop_t *)ic)->op == ICOP_ADD ||
+                             ((ic_arithbop_t *)ic)->op == ICOP_SUB)));
+            if (ic->kind == IC_DREF ||
+                (ic->kind == IC_DREFASSIGN && uses[i] == &((ic_drefassign_t *)ic)->lhs) ||
+                (derives && addr.n_defs[cfg_var_index(cfg, def)] == 1))
+                continue;
+            addr.escaped[base - cfg->var_base] = 1;
+        }
+    }
+}
+
+void destroy_addr_bases()
+{
+    free(addr.n_defs);
+    free(addr.defs);
+    free(addr.escaped);
+}
+
+/* ------------------------------------ *
+ *     loop invariant code motion       *
+ * ------------------------------------ */
+
+/* An intercode in a loop is invariant if its operands are constants,
+ * defined outside the loop, or defined by invariant intercodes. It is
+ * moved to the preheader if its target is defined only there in the
+ * loop and not used before being defined. If its block does not
+ * dominate every exit of the loop, it would be executed where it was
+ * not, so it must neither trap nor change a variable used after the
+ * loop. Loads are moved only if nothing in the loop may store to the
+ * same memory. */
+
+static struct {
+    cfg_t *cfg;
+    loopnest_t *nest;
+    loop_t *loop;
+    liveness_t *live;
+    int *n_loop_defs;
+    char *invariant;        /* variables defined by invariant intercodes */
+    int has_call;
+    int has_unknown_store;
+    char *stored;           /* array bases stored to, by varid - var_base */
+    char *exit_live;        /* variables live at the exits */
+} licm;
+
+int licm_dominates_exits(block_t *block)
+{
+    loop_t *loop = licm.loop;
+    for (int i = 0; i < loop->n_blocks; ++i)
+        if (loop_is_exiting(loop, loop->blocks[i]) &&
+            !idoms_dominate(licm.nest->idoms, block->id, loop->blocks[i]->id))
+            return 0;
+    return 1;
+}
+
+void licm_analyse_loop()
+{
+    cfg_t *cfg = licm.cfg;
+    loop_t *loop = licm.loop;
+    int n_vars = cfg->n_vars ? cfg->n_vars : 1;
+    licm.n_loop_defs = calloc(n_vars, sizeof(int));
+    licm.invariant = calloc(n_vars, sizeof(char));
+    licm.exit_live = calloc(n_vars, sizeof(char));
+    licm.stored = calloc(cfg->n_varids ? cfg->n_varids : 1, sizeof(char));
+    licm.has_call = licm.has_unknown_store = 0;
+    assert(licm.n_loop_defs && licm.invariant && licm.exit_live && licm.stored);
+
+    for (int i = 0; i < loop->n_blocks; ++i) {
+        block_t *block = loop->blocks[i];
+        block_foreach(node, block) {
+            intercode_t *ic = node->ic;
+            operand_t *def = intercode_def(ic);
+            if (def)
+                licm.n_loop_defs[cfg_var_index(cfg, def)]++;
+            if (ic->kind == IC_CALL)
+                licm.has_call = 1;
+            if (ic->kind == IC_DREFASSIGN) {
+                int base = addr_base(&((ic_drefassign_t *)ic)->lhs);
+                if (base < 0)
+                    licm.has_unknown_store = 1;
+                else
+                    licm.stored[base - cfg->var_base] = 1;
+            }
+        }
+        for (int j = 0; j < block->n_succs; ++j) {
+            block_t *succ = block->succs[j];
+            if (loop_contains(loop, succ))
+                continue;
+            for (int v = 0; v < cfg->n_vars; ++v)
+                if (bitset_contains(licm.live->in[succ->id], v))
+                    licm.exit_live[v] = 1;
+        }
+    }
+}
+
+void licm_free_loop()
+{
+    free(licm.n_loop_defs);
+    free(licm.invariant);
+    free(licm.exit_live);
+    free(licm.stored);
+}
+
+int licm_is_invariant_operand(operand_t *op)
+{
+    if (is_const_operand(op))
+        return 1;
+    int v = cfg_var_index(licm.cfg, op);
+    return licm.n_loop_defs[v] == 0 || licm.invariant[v];
+}
+
+/* Whether the load cannot see a store of the loop. */
+int licm_load_is_invariant(ic_dref_t *load)
+{
+    if (!licm.has_call && !licm.has_unknown_store) {
+        int base = addr_base(&load->rhs);
+        if (base < 0) {
+            /* Only stores to known arrays, which a pointer received
+             * from outside cannot point to unless they escaped. */
+            for (int i = 0; i < licm.cfg->n_varids; ++i)
+                if (licm.stored[i] && addr.escaped[i])
+                    return 0;
+            return 1;
+        }
+        return !licm.stored[base - licm.cfg->var_base];
+    }
+    if (licm.has_unknown_store)
+        return 0;
+    /* Calls may only reach arrays that escaped. */
+    int base = addr_base(&load->rhs);
+    return base >= 0 && !addr_is_escaped(base) &&
+           !licm.stored[base - licm.cfg->var_base];
+}
+
+int licm_can_hoist(block_t *block, intercode_t *ic)
+{
+    cfg_t *cfg = licm.cfg;
+    switch (ic->kind) {
+    case IC_ASSIGN: case IC_ARITHBOP: case IC_REF: case IC_DREF:
+        break;
+    default:
+        return 0;
+    }
+
+    operand_t *def = intercode_def(ic);
+    int v = cfg_var_index(cfg, def);
+    if (licm.n_loop_defs[v] != 1 || licm.invariant[v] ||
+        bitset_contains(licm.live->in[licm.loop->header->id], v))
+        return 0;
+
+    operand_t *uses[2];
+    int n_uses = intercode_uses(ic, uses);
+    for (int i = 0; i < n_uses; ++i)
+        if (!licm_is_invariant_operand(uses[i]))
+            return 0;
+    if (ic->kind == IC_DREF && !licm_load_is_invariant((ic_dref_t *)ic))
+        return 0;
+
+    if (!licm_dominates_exits(block)) {
+        int traps = (ic->kind == IC_DREF ||
+                     (ic->kind == IC_ARITHBOP && ((ic_arithbop_t *)ic)->op == ICOP_DIV));
+        if (traps || licm.exit_live[v])
+            return 0;
+    }
+    return 1;
+}
+
+/* Hoist the invariants of the loop and return whether any is moved. */
+int licm_hoist(loop_t *loop)
+{
+    cfg_t *cfg = licm.cfg;
+    licm.loop = loop;
+    licm_analyse_loop();
+
+    iclistnode_t **hoisted = malloc(cfg->func->body.size * sizeof(iclistnode_t *));
+    assert(hoisted);
+    int n_hoisted = 0, changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = 0; i < loop->n_blocks; ++i) {
+            block_t *block = loop->blocks[i];
+            block_foreach(node, block) {
+                if (!licm_can_hoist(block, node->ic))
+                    continue;
+                licm.invariant[cfg_var_index(cfg, intercode_def(node->ic))] = 1;
+                hoisted[n_hoisted++] = node;
+                changed = 1;
+            }
+        }
+    }
+
+    iclistnode_t *pos = NULL;
+    if (n_hoisted > 0)
+        pos = loop_insert_preheader(licm.nest, loop);
+    if (pos) {
+        for (int i = 0; i < n_hoisted; ++i)
+            iclist_move_before(&cfg->func->body, pos, hoisted[i]);
+    }
+
+    free(hoisted);
+    licm_free_loop();
+    return pos != NULL;
+}
+
+int licm_loop(loopnest_t *nest, loop_t *loop)
+{
+    licm.cfg = nest->cfg;
+    licm.nest = nest;
+    licm.live = create_liveness(nest->cfg);
+    init_addr_bases(nest->cfg);
+    int changed = licm_hoist(loop);
+    destroy_addr_bases();
+    destroy_liveness(licm.live);
+    return changed;
+}
+
+int optim_licm(icfunc_t *func)
+{
+    return loop_transform_each(func, licm_loop);
+}
@@ -0,0 +1,347 @@
+#include "optim.h"
+#include "cfg.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+/* ------------------------------------ *
+ *        local value numbering         *
+ * ------------------------------------ */
+
+/* Within a block, every value computed is given a number, and equal
+ * computations on equal numbers get the same number. When a computation
+ * is found again while a variable still holds its result, it becomes a
+ * copy of that variable. Loads are numbered together with a memory
+ * version, which is bumped by every store and call, so that they are
+ * never reused across them. A store also records the stored value as
+ * the result of loading from the address again. */
+
+enum { VNKEY_CONST, VNKEY_ARITH, VNKEY_REF, VNKEY_DREF };
+
+typedef struct vnkey {
+    int kind;
+    int op;
+    int a;
+    int b;
+} vnkey_t;
+
+typedef struct vnvalue {
+    int is_const;
+    int val;
+    operand_t holder;   /* OPERAND_NONE if no variable holds it */
+} vnvalue_t;
+
+static struct {
+    cfg_t *cfg;
+    int *var_vn;        /* -1 if the variable is not numbered yet */
+    int n_values;
+    int capacity;
+    vnvalue_t *values;
+    /* An open-addressing hash table. Entries of previous blocks are
+     * distinguished by the stamp. */
+    int table_size;
+    vnkey_t *keys;
+    int *vns;
+    int *stamps;
+    int stamp;
+    int mem_version;
+} lvn;
+
+int lvn_new_value()
+{
+    if (lvn.n_values == lvn.capacity) {
+        lvn.capacity = (lvn.capacity ? 2 * lvn.capacity : 64);
+        lvn.values = realloc(lvn.values, lvn.capacity * sizeof(vnvalue_t));
+        assert(lvn.values);
+    }
+    vnvalue_t *value = &lvn.values[lvn.n_values];
+    value->is_const = 0;
+    value->val = 0;
+    value->holder.kind = OPERAND_NONE;
+    return lvn.n_values++;
+}
+
+unsigned int vnkey_hash(vnkey_t *key)
+{
+    unsigned int h = key->kind;
+    h = h * 31 + key->op;
+    h = h * 1000003u + key->a;
+    h = h * 1000003u + key->b;
+    return h ^ (h >> 15);
+}
+
+/* Return the slot of the key, which is free if the key is absent. */
+int lvn_lookup_slot(vnkey_t *key)
+{
+    int mask = lvn.table_size - 1;
+    int i = vnkey_hash(key) & mask;
+    while (lvn.stamps[i] == lvn.stamp) {
+        vnkey_t *k = &lvn.keys[i];
+        if (k->kind == key->kind && k->op == key->op &&
+            k->a == key->a && k->b == key->b)
+            return i;
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+int lvn_find(vnkey_t *key)
+{
+    int i = lvn_lookup_slot(key);
+    return (lvn.stamps[i] == lvn.stamp ? lvn.vns[i] : -1);
+}
+
+void lvn_insert(vnkey_t *key, int vn)
+{
+    int i = lvn_lookup_slot(key);
+    lvn.keys[i] = *key;
+    lvn.vns[i] = vn;
+    lvn.stamps[i] = lvn.stamp;
+}
+
+void init_vnkey(vnkey_t *key, int kind, int op, int a, int b)
+{
+    key->kind = kind;
+    key->op = op;
+    key->a = a;
+    key->b = b;
+}
+
+int lvn_const_value(int val)
+{
+    vnkey_t key;
+    init_vnkey(&key, VNKEY_CONST, 0, val, 0);
+    int vn = lvn_find(&key);
+    if (vn < 0) {
+        vn = lvn_new_value();
+        lvn.values[vn].is_const = 1;
+        lvn.values[vn].val = val;
+        lvn_insert(&key, vn);
+    }
+    return vn;
+}
+
+int lvn_operand_value(operand_t *op)
+{
+    if (is_const_operand(op))
+        return lvn_const_value(op->val);
+    int v = cfg_var_index(lvn.cfg, op);
+    if (lvn.var_vn[v] < 0) {
+        lvn.var_vn[v] = lvn_new_value();
+        lvn.values[lvn.var_vn[v]].holder = *op;
+    }
+    return lvn.var_vn[v];
+}
+
+/* Whether the holder of the value still holds it. */
+int lvn_has_holder(int vn)
+{
+    operand_t *holder = &lvn.values[vn].holder;
+    if (holder->kind == OPERAND_NONE)
+        return 0;
+    return lvn.var_vn[cfg_var_index(lvn.cfg, holder)] == vn;
+}
+
+void lvn_define(operand_t *target, int vn)
+{
+    lvn.var_vn[cfg_var_index(lvn.cfg, target)] = vn;
+    if (!lvn.values[vn].is_const && !lvn_has_holder(vn))
+        lvn.values[vn].holder = *target;
+}
+
+/* Replace the intercode with a copy of the value if possible, or remove
+ * it if the target holds the value already. */
+int lvn_reuse(iclistnode_t *node, operand_t *target, int vn)
+{
+    operand_t src;
+    if (lvn.values[vn].is_const)
+        init_const_operand(&src, lvn.values[vn].val);
+    else if (lvn_has_holder(vn))
+        src = lvn.values[vn].holder;
+    else
+        return 0;
+
+    operand_t dst = *target;
+    if (operand_is_equal(&dst, &src))
+        iclist_remove(&lvn.cfg->func->body, node);
+    else
+        iclist_replace(node, create_ic_assign(&dst, &src));
+    return 1;
+}
+
+int is_commutative_icop(int icop)
+{
+    return icop == ICOP_ADD || icop == ICOP_MUL;
+}
+
+/* Return the value of an arithmetic operation if it is simply one of the
+ * operands or a constant, otherwise -1. */
+int lvn_simplify_arith(int op, int a, int b)
+{
+    vnvalue_t *va = &lvn.values[a], *vb = &lvn.values[b];
+    if (va->is_const && vb->is_const) {
+        int result;
+        if (fold_arith_icop(op, va->val, vb->val, &result) == 0)
+            return lvn_const_value(result);
+        return -1;
+    }
+    if (vb->is_const) {
+        if ((op == ICOP_ADD || op == ICOP_SUB) && vb->val == 0)
+            return a;
+        if ((op == ICOP_MUL || op == ICOP_DIV) && vb->val == 1)
+            return a;
+        if (op == ICOP_MUL && vb->val == 0)
+            return b;
+    }
+    if (va->is_const) {
+        if (op == ICOP_ADD && va->val == 0)
+            return b;
+        if (op == ICOP_MUL && va->val == 1)
+            return b;
+        if (op == ICOP_MUL && va->val == 0)
+            return a;
+    }
+    if (op == ICOP_SUB && a == b)
+        return lvn_const_value(0);
+    return -1;
+}
+
+/* Number the value computed by the intercode. If it is available
+ * already, the intercode is replaced and 1 is returned. */
+int lvn_visit(iclistnode_t *node)
+{
+    intercode_t *ic = node->ic;
+    vnkey_t key;
+    int vn;
+
+    switch (ic->kind) {
+    case IC_ASSIGN: {
+        ic_assign_t *assign = (ic_assign_t *)ic;
+        lvn_define(&assign->lhs, lvn_operand_value(&assign->rhs));
+        return 0;
+    }
+    case IC_ARITHBOP: {
+        ic_arithbop_t *arith = (ic_arithbop_t *)ic;
+        int a = lvn_operand_value(&arith->lhs);
+        int b = lvn_operand_value(&arith->rhs);
+        operand_t target = arith->target;
+        vn = lvn_simplify_arith(arith->op, a, b);
+        if (vn < 0) {
+            if (is_commutative_icop(arith->op) && a > b) {
+                int t = a; a = b; b = t;
+            }
+            init_vnkey(&key, VNKEY_ARITH, arith->op, a, b);
+            vn = lvn_find(&key);
+            if (vn < 0) {
+                vn = lvn_new_value();
+                lvn_insert(&key, vn);
+                lvn_define(&target, vn);
+                return 0;
+            }
+        }
+        int changed = lvn_reuse(node, &target, vn);
+        lvn_define(&target, vn);
+        return changed;
+    }
+    case IC_REF: {
+        ic_ref_t *ref = (ic_ref_t *)ic;
+        operand_t target = ref->lhs;
+        init_vnkey(&key, VNKEY_REF, 0, ref->rhs.varid, 0);
+        vn = lvn_find(&key);
+        if (vn < 0) {
+            vn = lvn_new_value();
+            lvn_insert(&key, vn);
+            lvn_define(&target, vn);
+            return 0;
+        }
+        int changed = lvn_reuse(node, &target, vn);
+        lvn_define(&target, vn);
+        return changed;
+    }
+    case IC_DREF: {
+        ic_dref_t *dref = (ic_dref_t *)ic;
+        operand_t target = dref->lhs;
+        init_vnkey(&key, VNKEY_DREF, 0, lvn_operand_value(&dref->rhs),
+                   lvn.mem_version);
+        vn = lvn_find(&key);
+        if (vn < 0) {
+            vn = lvn_new_value();
+            lvn_insert(&key, vn);
+            lvn_define(&target, vn);
+            return 0;
+        }
+        int changed = lvn_reuse(node, &target, vn);
+        lvn_define(&target, vn);
+        return changed;
+    }
+    case IC_DREFASSIGN: {
+        ic_drefassign_t *store = (ic_drefassign_t *)ic;
+        int addr = lvn_operand_value(&store->lhs);
+        int val = lvn_operand_value(&store->rhs);
+        lvn.mem_version++;
+        init_vnkey(&key, VNKEY_DREF, 0, addr, lvn.mem_version);
+        lvn_insert(&key, val);
+        return 0;
+    }
+    case IC_CALL:
+        lvn.mem_version++;
+        break;
+    default:
+        break;
+    }
+
+    operand_t *def = intercode_def(ic);
+    if (def)
+        lvn_define(def, lvn_new_value());
+    return 0;
+}
+
+int lvn_block(block_t *block)
+{
+    int changed = 0;
+    lvn.stamp++;
+    lvn.n_values = 0;
+    lvn.mem_version = 0;
+    for (int v = 0; v < lvn.cfg->n_vars; ++v)
+        lvn.var_vn[v] = -1;
+
+    iclistnode_t *end = block->last->next;
+    for (iclistnode_t *cur = block->first, *next; cur != end; cur = next) {
+        next = cur->next;
+        changed |= lvn_visit(cur);
+    }
+    return changed;
+}
+
+int optim_lvn(icfunc_t *func)
+{
+    cfg_t *cfg = create_cfg(func);
+    lvn.cfg = cfg;
+    lvn.var_vn = malloc((cfg->n_vars ? cfg->n_vars : 1) * sizeof(int));
+    lvn.n_values = lvn.capacity = 0;
+    lvn.values = NULL;
+
+    /* Every intercode inserts at most three entries, and the table is
+     * kept at most half full. */
+    int size = 16;
+    while (size < 6 * func->body.size)
+        size *= 2;
+    lvn.table_size = size;
+    lvn.keys = malloc(size * sizeof(vnkey_t));
+    lvn.vns = malloc(size * sizeof(int));
+    lvn.stamps = calloc(size, sizeof(int));
+    lvn.stamp = 0;
+    assert(lvn.var_vn && lvn.keys && lvn.vns && lvn.stamps);
+
+    int changed = 0;
+    for (int i = 0; i < cfg->n_blocks; ++i)
+        changed |= lvn_block(cfg->blocks[i]);
+
+    free(lvn.var_vn);
+    free(lvn.values);
+    free(lvn.keys);
+    free(lvn.vns);
+    free(lvn.stamps);
+    destroy_cfg(cfg);
+    return changed;
+}
@@ -0,0 +1,548 @@
+#include "optim.h"
+#include "cfg.h"
+#include "bitset.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+/* ------------------------------------ *
+ *    partial redundancy elimination    *
+ * ------------------------------------ */
+
+/* Lazy code motion by Knoop, Ruthing and Steffen, in the edge-based
+ * form of Drechsler and Stadel. An expression is computed into a new
+ * temporary at the latest edges where it is anticipated and not yet
+ * available, and the computations it makes redundant become copies of
+ * the temporary. Loops and diamonds are handled alike, and nothing is
+ * computed on a path that would not compute it anyway.
+ *
+ * Expressions are compared lexically, with commutative operands in a
+ * canonical order. Since the translator gives each computation a new
+ * temporary, redundancy of nested computations is exposed only after
+ * the inner ones are replaced and their copies propagated, so the
+ * pass alternates both until nothing changes. */
+
+typedef struct expr {
+    int kind;           /* IC_ARITHBOP, IC_REF or IC_DREF */
+    int op;
+    operand_t lhs;
+    operand_t rhs;
+    int is_addr;
+    operand_t temp;
+} expr_t;
+
+static struct {
+    cfg_t *cfg;
+    int n_exprs;
+    int capacity;
+    expr_t *exprs;
+    bitset_t **var_kill;    /* expressions using every variable */
+    bitset_t *mem_kill;     /* loads */
+    bitset_t **antloc, **comp, **transp;
+    bitset_t **antin, **antout, **avout, **laterin;
+    bitset_t **later;       /* 2 per block, for each successor */
+    bitset_t *delete_any;
+} pre;
+
+int operand_order(operand_t *lhs, operand_t *rhs)
+{
+    int lconst = is_const_operand(lhs), rconst = is_const_operand(rhs);
+    if (lconst != rconst)
+        return rconst - lconst;
+    int l = (lconst ? lhs->val : lhs->varid);
+    int r = (rconst ? rhs->val : rhs->varid);
+    return (l > r) - (l < r);
+}
+
+/* Describe the expression computed by 'ic' in 'expr', and return 0 if
+ * it computes none. */
+int get_expr(intercode_t *ic, expr_t *expr)
+{
+    expr->kind = ic->kind;
+    expr->op = 0;
+    expr->rhs.kind = OPERAND_NONE;
+    switch (ic->kind) {
+    case IC_ARITHBOP: {
+        ic_arithbop_t *arith = (ic_arithbop_t *)ic;
+        expr->op = arith->op;
+        expr->lhs = arith->lhs;
+        expr->rhs = arith->rhs;
+        if ((expr->op == ICOP_ADD || expr->op == ICOP_MUL) &&
+            operand_order(&expr->lhs, &expr->rhs) > 0) {
+            expr->lhs = arith->rhs;
+            expr->rhs = arith->lhs;
+        }
+        return 1;
+    }
+    case IC_REF:
+        expr->lhs = ((ic_ref_t *)ic)->rhs;
+        return 1;
+    case IC_DREF:
+        expr->lhs = ((ic_dref_t *)ic)->rhs;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+int expr_is_equal(expr_t *lhs, expr_t *rhs)
+{
+    if (lhs->kind != rhs->kind || lhs->op != rhs->op ||
+        !operand_is_equal(&lhs->lhs, &rhs->lhs))
+        return 0;
+    if (lhs->rhs.kind == OPERAND_NONE || rhs->rhs.kind == OPERAND_NONE)
+        return lhs->rhs.kind == rhs->rhs.kind;
+    return operand_is_equal(&lhs->rhs, &rhs->rhs);
+}
+
+int pre_find_expr(expr_t *expr)
+{
+    for (int i = 0; i < pre.n_exprs; ++i)
+        if (expr_is_equal(&pre.exprs[i], expr))
+            return i;
+    return -1;
+}
+
+/* Return the index of the expression computed by 'ic', or -1. */
+int pre_expr_of(intercode_t *ic)
+{
+    expr_t expr;
+    if (!get_expr(ic, &expr))
+        return -1;
+    return pre_find_expr(&expr);
+}
+
+void pre_collect_exprs()
+{
+    pre.n_exprs = 0;
+    for (iclistnode_t *cur = pre.cfg->func->body.front; cur; cur = cur->next) {
+        expr_t expr;
+        if (!get_expr(cur->ic, &expr) || pre_find_expr(&expr) >= 0)
+            continue;
+        /* The temporary is allocated when needed, with the kind of the
+         * first target. */
+        expr.temp.kind = OPERAND_NONE;
+        expr.is_addr = (intercode_def(cur->ic)->kind == OPERAND_ADDR);
+        if (pre.n_exprs == pre.capacity) {
+            pre.capacity = (pre.capacity ? 2 * pre.capacity : 64);
+            pre.exprs = realloc(pre.exprs, pre.capacity * sizeof(expr_t));
+            assert(pre.exprs);
+        }
+        pre.exprs[pre.n_exprs++] = expr;
+    }
+
+    cfg_t *cfg = pre.cfg;
+    pre.var_kill = malloc((cfg->n_vars ? cfg->n_vars : 1) * sizeof(bitset_t *));
+    assert(pre.var_kill);
+    for (int v = 0; v < cfg->n_vars; ++v)
+        pre.var_kill[v] = create_bitset(pre.n_exprs);
+    pre.mem_kill = create_bitset(pre.n_exprs);
+    for (int e = 0; e < pre.n_exprs; ++e) {
+        expr_t *expr = &pre.exprs[e];
+        if (expr->kind == IC_DREF)
+            bitset_add(pre.mem_kill, e);
+        if (expr->kind == IC_REF)
+            continue;
+        if (!is_const_operand(&expr->lhs))
+            bitset_add(pre.var_kill[cfg_var_index(cfg, &expr->lhs)], e);
+        if (expr->rhs.kind != OPERAND_NONE && !is_const_operand(&expr->rhs))
+            bitset_add(pre.var_kill[cfg_var_index(cfg, &expr->rhs)], e);
+    }
+}
+
+/* Remove the expressions killed by 'ic' from 'set'. */
+void pre_kill(intercode_t *ic, bitset_t *set)
+{
+    operand_t *def = intercode_def(ic);
+    if (def)
+        bitset_subtract(set, pre.var_kill[cfg_var_index(pre.cfg, def)]);
+    if (ic->kind == IC_DREFASSIGN || ic->kind == IC_CALL)
+        bitset_subtract(set, pre.mem_kill);
+}
+
+bitset_t **create_bitsets(int n, int n_bits)
+{
+    bitset_t **sets = malloc((n ? n : 1) * sizeof(bitset_t *));
+    assert(sets);
+    for (int i = 0; i < n; ++i)
+        sets[i] = create_bitset(n_bits);
+    return sets;
+}
+
+void destroy_bitsets(bitset_t **sets, int n)
+{
+    for (int i = 0; i < n; ++i)
+        destroy_bitset(sets[i]);
+    free(sets);
+}
+
+void pre_local_properties()
+{
+    cfg_t *cfg = pre.cfg;
+    pre.antloc = create_bitsets(cfg->n_blocks, pre.n_exprs);
+    pre.comp = create_bitsets(cfg->n_blocks, pre.n_exprs);
+    pre.transp = create_bitsets(cfg->n_blocks, pre.n_exprs);
+    /* Expressions whose operands are not redefined so far in the block. */
+    bitset_t *intact = create_bitset(pre.n_exprs);
+
+    for (int b = 0; b < cfg->n_blocks; ++b) {
+        bitset_fill(intact);
+        block_foreach(node, cfg->blocks[b]) {
+            int e = pre_expr_of(node->ic);
+            if (e >= 0) {
+                if (bitset_contains(intact, e))
+                    bitset_add(pre.antloc[b], e);
+                bitset_add(pre.comp[b], e);
+            }
+            pre_kill(node->ic, intact);
+            pre_kill(node->ic, pre.comp[b]);
+        }
+        bitset_copy(pre.transp[b], intact);
+    }
+    destroy_bitset(intact);
+}
+
+void pre_global_properties()
+{
+    cfg_t *cfg = pre.cfg;
+    int n = cfg->n_blocks, n_order;
+    block_t **order = cfg_reverse_postorder(cfg, &n_order);
+    int *ipdoms = cfg_ipdoms(cfg);
+    bitset_t *tmp = create_bitset(pre.n_exprs);
+
+    /* Anticipability, backward. Code that never leaves the function
+     * anticipates nothing, or computations would be moved into it. */
+    pre.antin = create_bitsets(n, pre.n_exprs);
+    pre.antout = create_bitsets(n, pre.n_exprs);
+    for (int b = 0; b < n; ++b)
+        if (ipdoms[b] != -1)
+            bitset_fill(pre.antin[b]);
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int k = n_order - 1; k >= 0; --k) {
+            block_t *block = order[k];
+            int b = block->id;
+            if (ipdoms[b] == -1)
+                continue;
+            bitset_t *out = pre.antout[b];
+            if (block->n_succs == 0)
+                bitset_clear(out);
+            else
+                bitset_fill(out);
+            for (int j = 0; j < block->n_succs; ++j)
+                bitset_intersect(out, pre.antin[block->succs[j]->id]);
+            bitset_copy(tmp, out);
+            bitset_intersect(tmp, pre.transp[b]);
+            bitset_union(tmp, pre.antloc[b]);
+            if (!bitset_equal(tmp, pre.antin[b])) {
+                bitset_copy(pre.antin[b], tmp);
+                changed = 1;
+            }
+        }
+    }
+
+    /* Availability, forward. */
+    pre.avout = create_bitsets(n, pre.n_exprs);
+    bitset_t *avin = create_bitset(pre.n_exprs);
+    for (int b = 0; b < n; ++b)
+        bitset_fill(pre.avout[b]);
+    changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int k = 0; k < n_order; ++k) {
+            block_t *block = order[k];
+            int b = block->id;
+            if (b == 0)
+                bitset_clear(avin);
+            else
+                bitset_fill(avin);
+            for (int j = 0; j < block->n_preds; ++j)
+                bitset_intersect(avin, pre.avout[block->preds[j]->id]);
+            bitset_copy(tmp, avin);
+            bitset_intersect(tmp, pre.transp[b]);
+            bitset_union(tmp, pre.comp[b]);
+            if (!bitset_equal(tmp, pre.avout[b])) {
+                bitset_copy(pre.avout[b], tmp);
+                changed = 1;
+            }
+        }
+    }
+    destroy_bitset(avin);
+
+    free(order);
+    free(ipdoms);
+    destroy_bitset(tmp);
+}
+
+/* EARLIEST(i,j) = ANTIN(j) - AVOUT(i) - (TRANSP(i) & ANTOUT(i)) */
+void pre_earliest(block_t *from, block_t *to, bitset_t *set)
+{
+    bitset_t *keep = create_bitset(pre.n_exprs);
+    bitset_copy(keep, pre.transp[from->id]);
+    bitset_intersect(keep, pre.antout[from->id]);
+    bitset_copy(set, pre.antin[to->id]);
+    bitset_subtract(set, pre.avout[from->id]);
+    bitset_subtract(set, keep);
+    destroy_bitset(keep);
+}
+
+void pre_placement()
+{
+    cfg_t *cfg = pre.cfg;
+    int n = cfg->n_blocks, n_order;
+    block_t **order = cfg_reverse_postorder(cfg, &n_order);
+    bitset_t *tmp = create_bitset(pre.n_exprs);
+
+    /* LATER(i,j) = EARLIEST(i,j) | (LATERIN(i) - ANTLOC(i)), and
+     * LATERIN(j) is the intersection over incoming edges. */
+    pre.laterin = create_bitsets(n, pre.n_exprs);
+    pre.later = create_bitsets(2 * n, pre.n_exprs);
+    for (int b = 0; b < n; ++b)
+        bitset_fill(pre.laterin[b]);
+    for (int i = 0; i < 2 * n; ++i)
+        bitset_fill(pre.later[i]);
+    bitset_copy(pre.laterin[0], pre.antin[0]);
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int k = 0; k < n_order; ++k) {
+            block_t *block = order[k];
+            int b = block->id;
+            for (int j = 0; j < block->n_succs; ++j) {
+                bitset_t *later = pre.later[2 * b + j];
+                pre_earliest(block, block->succs[j], later);
+                bitset_copy(tmp, pre.laterin[b]);
+                bitset_subtract(tmp, pre.antloc[b]);
+                bitset_union(later, tmp);
+            }
+            if (b == 0)
+                continue;
+            bitset_fill(tmp);
+            for (int j = 0; j < block->n_preds; ++j) {
+                block_t *pred = block->preds[j];
+                int s = (pred->succs[0] == block ? 0 : 1);
+                bitset_intersect(tmp, pre.later[2 * pred->id + s]);
+            }
+            if (!bitset_equal(tmp, pre.laterin[b])) {
+                bitset_copy(pre.laterin[b], tmp);
+                changed = 1;
+            }
+        }
+    }
+
+    /* DELETE(b) = ANTLOC(b) - LATERIN(b). Only the expressions deleted
+     * somewhere are worth a temporary. */
+    pre.delete_any = create_bitset(pre.n_exprs);
+    for (int b = 0; b < n; ++b) {
+        bitset_copy(tmp, pre.antloc[b]);
+        bitset_subtract(tmp, pre.laterin[b]);
+        bitset_union(pre.delete_any, tmp);
+    }
+
+    free(order);
+    destroy_bitset(tmp);
+}
+
+operand_t *pre_temp(int e)
+{
+    expr_t *expr = &pre.exprs[e];
+    if (expr->temp.kind == OPERAND_NONE) {
+        if (expr->is_addr)
+            init_temp_addr(&expr->temp);
+        else
+            init_temp_var(&expr->temp);
+    }
+    return &expr->temp;
+}
+
+intercode_t *create_expr_intercode(int e)
+{
+    expr_t *expr = &pre.exprs[e];
+    operand_t *temp = pre_temp(e);
+    switch (expr->kind) {
+    case IC_ARITHBOP:
+        return create_ic_arithbop(expr->op, temp, &expr->lhs, &expr->rhs);
+    case IC_REF:
+        return create_ic_ref(temp, &expr->lhs);
+    case IC_DREF:
+        return create_ic_dref(temp, &expr->lhs);
+    default:
+        assert(0);
+        return NULL;
+    }
+}
+
+/* Replace upward exposed computations deleted in the block by copies of
+ * the temporaries, and save the result of the other computations in
+ * the temporaries. */
+int pre_rewrite_block(block_t *block)
+{
+    iclist_t *body = &pre.cfg->func->body;
+    bitset_t *intact = create_bitset(pre.n_exprs);
+    bitset_fill(intact);
+    int changed = 0;
+
+    iclistnode_t *end = block->last->next;
+    for (iclistnode_t *cur = block->first; cur != end; cur = cur->next) {
+        intercode_t *ic = cur->ic;
+        int e = pre_expr_of(ic);
+        if (e >= 0 && bitset_contains(pre.delete_any, e)) {
+            operand_t target = *intercode_def(ic);
+            operand_t *temp = pre_temp(e);
+            if (bitset_contains(intact, e) && !bitset_contains(pre.laterin[block->id], e) &&
+                bitset_contains(pre.antloc[block->id], e)) {
+                iclist_replace(cur, create_ic_assign(&target, temp));
+                ic = cur->ic;
+                changed = 1;
+            }
+            else {
+                iclist_insert_before(body, cur, create_expr_intercode(e));
+                iclist_replace(cur, create_ic_assign(&target, temp));
+                ic = cur->ic;
+            }
+        }
+        pre_kill(ic, intact);
+    }
+    destroy_bitset(intact);
+    return changed;
+}
+
+/* Put the computations of the expressions in 'set' on the edge,
+ * splitting it if needed. */
+void pre_insert_on_edge(block_t *from, block_t *to, bitset_t *set)
+{
+    iclist_t *body = &pre.cfg->func->body;
+    iclistnode_t *pos = NULL;
+    int after = 0, split = 0;
+
+    if (from->n_succs == 1) {
+        int kind = from->last->ic->kind;
+        pos = from->last;
+        after = (kind != IC_GOTO && kind != IC_CONDGOTO);
+    }
+    else if (to->n_preds == 1) {
+        pos = to->first;
+        while (pos->ic->kind == IC_LABEL)
+            pos = pos->next;
+    }
+    else if (from->fall == to) {
+        /* Code right after the branch is only reached by falling. */
+        pos = from->last;
+        after = 1;
+    }
+    else {
+        /* A new block at the end of the function, which ends with a
+         * jump as checked before. */
+        split = 1;
+    }
+
+    ic_condgoto_t *cond = (ic_condgoto_t *)from->last->ic;
+    int labelid = 0;
+    if (split) {
+        assert(cond->kind == IC_CONDGOTO);
+        labelid = alloc_labelid();
+        iclist_push_back(body, create_ic_label(labelid));
+    }
+    for (int e = 0; e < pre.n_exprs; ++e) {
+        if (!bitset_contains(set, e))
+            continue;
+        intercode_t *ic = create_expr_intercode(e);
+        if (split)
+            iclist_push_back(body, ic);
+        else if (after)
+            pos = iclist_insert_after(body, pos, ic);
+        else
+            iclist_insert_before(body, pos, ic);
+    }
+    if (split) {
+        iclist_push_back(body, create_ic_goto(cond->labelid));
+        cond->labelid = labelid;
+    }
+}
+
+int pre_transform()
+{
+    cfg_t *cfg = pre.cfg;
+    int changed = 0;
+    for (int b = 0; b < cfg->n_blocks; ++b)
+        changed |= pre_rewrite_block(cfg->blocks[b]);
+
+    /* INSERT(i,j) = LATER(i,j) - LATERIN(j) */
+    bitset_t *insert = create_bitset(pre.n_exprs);
+    for (int b = 0; b < cfg->n_blocks; ++b) {
+        block_t *block = cfg->blocks[b];
+        for (int j = 0; j < block->n_succs; ++j) {
+            bitset_copy(insert, pre.later[2 * b + j]);
+            bitset_subtract(insert, pre.laterin[block->succs[j]->id]);
+            bitset_intersect(insert, pre.delete_any);
+            if (bitset_count(insert) > 0) {
+                pre_insert_on_edge(block, block->succs[j], insert);
+                changed = 1;
+            }
+        }
+    }
+    destroy_bitset(insert);
+    return changed;
+}
+
+void pre_free()
+{
+    int n = pre.cfg->n_blocks;
+    destroy_bitsets(pre.var_kill, pre.cfg->n_vars);
+    destroy_bitset(pre.mem_kill);
+    destroy_bitsets(pre.antloc, n);
+    destroy_bitsets(pre.comp, n);
+    destroy_bitsets(pre.transp, n);
+    destroy_bitsets(pre.antin, n);
+    destroy_bitsets(pre.antout, n);
+    destroy_bitsets(pre.avout, n);
+    destroy_bitsets(pre.laterin, n);
+    destroy_bitsets(pre.later, 2 * n);
+    destroy_bitset(pre.delete_any);
+}
+
+int lazy_code_motion(icfunc_t *func)
+{
+    cfg_t *cfg = create_cfg(func);
+    if (cfg_remove_unreachable(cfg)) {
+        destroy_cfg(cfg);
+        cfg = create_cfg(func);
+    }
+
+    pre.cfg = cfg;
+    pre_collect_exprs();
+    pre_local_properties();
+    pre_global_properties();
+    pre_placement();
+    int changed = 0;
+    if (bitset_count(pre.delete_any) > 0)
+        changed = pre_transform();
+
+    pre_free();
+    destroy_cfg(cfg);
+    return changed;
+}
+
+#define PRE_MAX_ROUNDS  4
+
+int optim_pre(icfunc_t *func)
+{
+    /* Edges may be split by new blocks at the end of the function, which
+     * must not be reached by falling off the original end. */
+    if (!intercode_is_jump(func->body.back->ic))
+        return 0;
+
+    int changed = 0;
+    for (int i = 0; i < PRE_MAX_ROUNDS; ++i) {
+        if (!lazy_code_motion(func))
+            break;
+        optim_copyprop(func);
+        changed = 1;
+    }
+    free(pre.exprs);
+    pre.exprs = NULL;
+    pre.capacity = 0;
+    return changed;
+}
@@ -0,0 +1,158 @@
+#include "optim.h"
+#include "loop.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+/* ------------------------------------ *
+ *            loop rotation             *
+ * ------------------------------------ */
+
+/* A 'while' loop tests its condition at the header and jumps back to it
+ * from the end of the body, which takes two jumps per iteration:
+ *
+ *     LABEL head; IF !cond GOTO exit; body; GOTO head; LABEL exit
+ *
+ * The test is copied in place of the jump back, so that the loop becomes
+ * a 'do-while' guarded by the original test:
+ *
+ *     LABEL head; IF !cond GOTO exit; LABEL loop; body;
+ *     IF cond GOTO loop; GOTO exit; LABEL exit
+ *
+ * where the last jump is removed later by simplifycfg. The condition may
+ * span several blocks, as a short-circuit condition does, as long as they
+ * are entered only from the header and lead either out of the loop or to
+ * the body. The labels inside the condition are renamed in the copy. */
+
+#define ROTATE_MAX_SIZE     12
+
+static struct {
+    cfg_t *cfg;
+    loop_t *loop;
+    int n_conds;
+    block_t **conds;    /* the blocks of the condition, from the header */
+    block_t *body;      /* the first block of the body */
+} rotate;
+
+int rotate_in_conds(block_t *block)
+{
+    for (int i = 0; i < rotate.n_conds; ++i)
+        if (rotate.conds[i] == block)
+            return 1;
+    return 0;
+}
+
+/* Whether the first n blocks of the chain can be the condition, which
+ * leaves the loop or enters the body at the block it falls into. */
+int rotate_is_cond(int n)
+{
+    loop_t *loop = rotate.loop;
+    block_t *body = rotate.conds[n - 1]->fall;
+    if (!body || !loop_contains(loop, body))
+        return 0;
+    int size = 0, is_exiting = 0;
+    for (int i = 0; i < n; ++i) {
+        block_t *block = rotate.conds[i];
+        if (block == body)
+            return 0;
+        block_foreach(node, block)
+            if (node->ic->kind != IC_LABEL)
+                size++;
+        is_exiting |= loop_is_exiting(loop, block);
+        block_t *target = block->jump;
+        if (!loop_contains(loop, target) || target == body)
+            continue;
+        int j;
+        for (j = 0; j < n && rotate.conds[j] != target; ++j)
+            continue;
+        if (j == n)
+            return 0;
+    }
+    return is_exiting && size <= ROTATE_MAX_SIZE;
+}
+
+/* Find the blocks of the condition and the body. Return whether the
+ * loop can be rotated. */
+int rotate_find_conds()
+{
+    loop_t *loop = rotate.loop;
+    block_t *header = loop->header;
+    if (header->first->ic->kind != IC_LABEL || loop->n_latches != 1 ||
+        loop->latches[0]->last->ic->kind != IC_GOTO)
+        return 0;
+
+    /* The chain of tests from the header, each entered only from the
+     * previous ones. */
+    block_t *block = header;
+    while (block && block->last->ic->kind == IC_CONDGOTO &&
+           loop_contains(loop, block)) {
+        if (block != header) {
+            int i;
+            for (i = 0; i < block->n_preds; ++i)
+                if (!rotate_in_conds(block->preds[i]))
+                    break;
+            if (i < block->n_preds)
+                break;
+        }
+        rotate.conds[rotate.n_conds++] = block;
+        block = block->fall;
+    }
+
+    /* The longest prefix of the chain that makes a condition. */
+    while (rotate.n_conds > 0 && !rotate_is_cond(rotate.n_conds))
+        rotate.n_conds--;
+    if (rotate.n_conds == 0)
+        return 0;
+    rotate.body = rotate.conds[rotate.n_conds - 1]->fall;
+    return 1;
+}
+
+/* Copy the condition before the jump back and remove the jump. */
+void rotate_copy_conds(int body_label)
+{
+    iclist_t *list = &rotate.cfg->func->body;
+    iclistnode_t *pos = rotate.loop->latches[0]->last;
+    iclist_copy_range(list, pos, rotate.conds[0]->first,
+                      rotate.conds[rotate.n_conds - 1]->last);
+
+    /* The last test falls into the body. */
+    ic_condgoto_t *cond = (ic_condgoto_t *)pos->prev->ic;
+    assert(cond->kind == IC_CONDGOTO);
+    int exit_label = cond->labelid;
+    cond->relop = complement_rel_icop(cond->relop);
+    cond->labelid = body_label;
+    iclist_insert_before(list, pos, create_ic_goto(exit_label));
+    iclist_remove(list, pos);
+}
+
+int rotate_loop(loopnest_t *nest, loop_t *loop)
+{
+    cfg_t *cfg = nest->cfg;
+    rotate.cfg = cfg;
+    rotate.loop = loop;
+    rotate.n_conds = 0;
+    rotate.conds = malloc(cfg->n_blocks * sizeof(block_t *));
+    assert(rotate.conds);
+
+    int changed = rotate_find_conds();
+    if (changed) {
+        block_t *body = rotate.body;
+        int body_label;
+        if (body->first->ic->kind == IC_LABEL) {
+            body_label = ((ic_label_t *)body->first->ic)->labelid;
+        } else {
+            body_label = alloc_labelid();
+            iclist_insert_before(&cfg->func->body, body->first,
+                                 create_ic_label(body_label));
+        }
+        rotate_copy_conds(body_label);
+    }
+
+    free(rotate.conds);
+    return changed;
+}
+
+int optim_rotate(icfunc_t *func)
+{
+    return loop_transform_each(func, rotate_loop);
+}
@@ -0,0 +1,289 @@
+#include "optim.h"
+#include "cfg.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* ------------------------------------ *
+ *   sparse conditional constant prop   *
+ * ------------------------------------ */
+
+/* Every variable is mapped to a lattice value at the entry of every
+ * block. Only the blocks reachable through edges proved executable are
+ * visited, so constants flowing into branches decide which successors
+ * are visited at all. Since the IR is not in SSA form, the values are
+ * kept per block instead of per definition. */
+
+enum { LAT_TOP, LAT_CONST, LAT_BOTTOM };
+
+typedef struct latval {
+    int kind;
+    int val;
+} latval_t;
+
+static struct {
+    cfg_t *cfg;
+    int n_vars;
+    latval_t *in;       /* n_blocks * n_vars values at block entries */
+    latval_t *state;    /* values at the current intercode */
+    char *executable;
+    block_t **worklist; /* a circular queue of blocks */
+    char *in_worklist;
+    int head;
+    int size;
+} sccp;
+
+latval_t *sccp_block_in(block_t *block)
+{
+    return sccp.in + (size_t)block->id * sccp.n_vars;
+}
+
+void sccp_push(block_t *block)
+{
+    if (sccp.in_worklist[block->id])
+        return;
+    int n = sccp.cfg->n_blocks;
+    sccp.worklist[(sccp.head + sccp.size++) % n] = block;
+    sccp.in_worklist[block->id] = 1;
+}
+
+block_t *sccp_pop()
+{
+    assert(sccp.size > 0);
+    block_t *block = sccp.worklist[sccp.head];
+    sccp.head = (sccp.head + 1) % sccp.cfg->n_blocks;
+    sccp.size--;
+    sccp.in_worklist[block->id] = 0;
+    return block;
+}
+
+latval_t sccp_eval(operand_t *op)
+{
+    latval_t ret;
+    if (is_const_operand(op)) {
+        ret.kind = LAT_CONST;
+        ret.val = op->val;
+        return ret;
+    }
+    return sccp.state[cfg_var_index(sccp.cfg, op)];
+}
+
+latval_t sccp_eval_arithbop(ic_arithbop_t *ic)
+{
+    latval_t lhs = sccp_eval(&ic->lhs);
+    latval_t rhs = sccp_eval(&ic->rhs);
+    latval_t ret;
+    ret.kind = LAT_BOTTOM;
+    ret.val = 0;
+
+    if (lhs.kind == LAT_TOP || rhs.kind == LAT_TOP) {
+        ret.kind = LAT_TOP;
+    }
+    else if (lhs.kind == LAT_CONST && rhs.kind == LAT_CONST) {
+        if (fold_arith_icop(ic->op, lhs.val, rhs.val, &ret.val) == 0)
+            ret.kind = LAT_CONST;
+    }
+    else if (ic->op == ICOP_MUL && ((lhs.kind == LAT_CONST && lhs.val == 0) ||
+                                    (rhs.kind == LAT_CONST && rhs.val == 0))) {
+        ret.kind = LAT_CONST;
+    }
+    return ret;
+}
+
+/* Return 1 if the branch is taken, 0 if not, and -1 if unknown. */
+int sccp_eval_condgoto(ic_condgoto_t *ic)
+{
+    latval_t lhs = sccp_eval(&ic->lhs);
+    latval_t rhs = sccp_eval(&ic->rhs);
+    if (lhs.kind == LAT_CONST && rhs.kind == LAT_CONST)
+        return eval_rel_icop(ic->relop, lhs.val, rhs.val);
+    return -1;
+}
+
+void sccp_transfer(intercode_t *ic)
+{
+    operand_t *def = intercode_def(ic);
+    if (!def)
+        return;
+
+    latval_t val;
+    val.kind = LAT_BOTTOM;
+    val.val = 0;
+    if (ic->kind == IC_ASSIGN)
+        val = sccp_eval(&((ic_assign_t *)ic)->rhs);
+    else if (ic->kind == IC_ARITHBOP)
+        val = sccp_eval_arithbop((ic_arithbop_t *)ic);
+    sccp.state[cfg_var_index(sccp.cfg, def)] = val;
+}
+
+void sccp_flow(block_t *succ)
+{
+    latval_t *in = sccp_block_in(succ);
+    int changed = !sccp.executable[succ->id];
+    sccp.executable[succ->id] = 1;
+
+    for (int i = 0; i < sccp.n_vars; ++i) {
+        latval_t *dst = &in[i], *src = &sccp.state[i];
+        if (src->kind == LAT_TOP || dst->kind == LAT_BOTTOM)
+            continue;
+        if (dst->kind == LAT_TOP) {
+            *dst = *src;
+            changed = 1;
+        }
+        else if (src->kind == LAT_BOTTOM || src->val != dst->val) {
+            dst->kind = LAT_BOTTOM;
+            changed = 1;
+        }
+    }
+    if (changed)
+        sccp_push(succ);
+}
+
+void sccp_visit(block_t *block)
+{
+    memcpy(sccp.state, sccp_block_in(block), sccp.n_vars * sizeof(latval_t));
+    block_foreach(node, block)
+        sccp_transfer(node->ic);
+
+    intercode_t *last = block->last->ic;
+    int taken = -1;
+    if (last->kind == IC_CONDGOTO)
+        taken = sccp_eval_condgoto((ic_condgoto_t *)last);
+
+    if (block->jump && taken != 0)
+        sccp_flow(block->jump);
+    if (block->fall && taken != 1)
+        sccp_flow(block->fall);
+}
+
+void sccp_analyse()
+{
+    cfg_t *cfg = sccp.cfg;
+    latval_t *entry = sccp_block_in(cfg->blocks[0]);
+    /* Nothing is assumed at the entry, not even for uninitialized
+     * variables, so that the code reading them keeps its behaviour. */
+    for (int i = 0; i < sccp.n_vars; ++i)
+        entry[i].kind = LAT_BOTTOM;
+    sccp.executable[0] = 1;
+    sccp_push(cfg->blocks[0]);
+
+    while (sccp.size > 0)
+        sccp_visit(sccp_pop());
+}
+
+/* Replace the operand with a constant if its value is known. */
+int sccp_substitute(operand_t *op)
+{
+    if (op->kind != OPERAND_VAR)
+        return 0;
+    latval_t val = sccp_eval(op);
+    if (val.kind != LAT_CONST)
+        return 0;
+    init_const_operand(op, val.val);
+    return 1;
+}
+
+int sccp_rewrite_block(block_t *block)
+{
+    iclist_t *body = &sccp.cfg->func->body;
+    iclistnode_t *end = block->last->next;
+    int changed = 0;
+
+    memcpy(sccp.state, sccp_block_in(block), sccp.n_vars * sizeof(latval_t));
+    for (iclistnode_t *cur = block->first, *next; cur != end; cur = next) {
+        next = cur->next;
+        intercode_t *ic = cur->ic;
+
+        switch (ic->kind) {
+        case IC_ASSIGN:
+            changed |= sccp_substitute(&((ic_assign_t *)ic)->rhs);
+            break;
+        case IC_ARITHBOP: {
+            ic_arithbop_t *arith = (ic_arithbop_t *)ic;
+            latval_t val = sccp_eval_arithbop(arith);
+            if (val.kind == LAT_CONST) {
+                operand_t c;
+                init_const_operand(&c, val.val);
+                iclist_replace(cur, create_ic_assign(&arith->target, &c));
+                changed = 1;
+            }
+            else {
+                changed |= sccp_substitute(&arith->lhs);
+                changed |= sccp_substitute(&arith->rhs);
+            }
+            break;
+        }
+        case IC_DREFASSIGN:
+            changed |= sccp_substitute(&((ic_drefassign_t *)ic)->rhs);
+            break;
+        case IC_CONDGOTO: {
+            ic_condgoto_t *cond = (ic_condgoto_t *)ic;
+            int taken = sccp_eval_condgoto(cond);
+            if (taken == 1) {
+                iclist_replace(cur, create_ic_goto(cond->labelid));
+                changed = 1;
+            }
+            else if (taken == 0) {
+                iclist_remove(body, cur);
+                changed = 1;
+                continue;
+            }
+            else {
+                changed |= sccp_substitute(&cond->lhs);
+                changed |= sccp_substitute(&cond->rhs);
+            }
+            break;
+        }
+        case IC_RETURN:
+            changed |= sccp_substitute(&((ic_return_t *)ic)->ret);
+            break;
+        case IC_ARG:
+            changed |= sccp_substitute(&((ic_arg_t *)ic)->arg);
+            break;
+        case IC_WRITE:
+            changed |= sccp_substitute(&((ic_write_t *)ic)->var);
+            break;
+        default:
+            break;
+        }
+        sccp_transfer(cur->ic);
+    }
+    return changed;
+}
+
+int optim_sccp(icfunc_t *func)
+{
+    cfg_t *cfg = create_cfg(func);
+    int n_blocks = cfg->n_blocks;
+
+    sccp.cfg = cfg;
+    sccp.n_vars = cfg->n_vars;
+    sccp.in = calloc((size_t)n_blocks * (cfg->n_vars ? cfg->n_vars : 1),
+                     sizeof(latval_t));
+    sccp.state = malloc((cfg->n_vars ? cfg->n_vars : 1) * sizeof(latval_t));
+    sccp.executable = calloc(n_blocks, sizeof(char));
+    sccp.worklist = malloc(n_blocks * sizeof(block_t *));
+    sccp.in_worklist = calloc(n_blocks, sizeof(char));
+    sccp.head = sccp.size = 0;
+    assert(sccp.in && sccp.state && sccp.executable &&
+           sccp.worklist && sccp.in_worklist);
+
+    sccp_analyse();
+
+    int changed = 0;
+    for (int i = 0; i < n_blocks; ++i)
+        if (sccp.executable[i])
+            changed |= sccp_rewrite_block(cfg->blocks[i]);
+    for (int i = 0; i < n_blocks; ++i)
+        if (!sccp.executable[i])
+            changed |= cfg_remove_block(cfg, cfg->blocks[i]);
+
+    free(sccp.in);
+    free(sccp.state);
+    free(sccp.executable);
+    free(sccp.worklist);
+    free(sccp.in_worklist);
+    destroy_cfg(cfg);
+    return changed;
+}
@@ -0,0 +1,79 @@
+#include "optim.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* ------------------------------------ *
+ *      tail recursion elimination      *
+ * ------------------------------------ */
+
+/* A call of the function to itself whose result is returned at once
+ *
+ *     ARG a2; ARG a1; t := CALL f; RETURN t
+ *
+ * is replaced by assigning the arguments to the parameters and jumping
+ * back to the beginning of the body:
+ *
+ *     t1 := a1; t2 := a2; p1 := t1; p2 := t2; GOTO entry
+ *
+ * The arguments go through temporaries, since they may read parameters
+ * assigned before them. The frame is reused, which is wrong only if an
+ * argument may point into it, so functions taking the address of their
+ * own arrays are left alone. Tail calls to other functions are turned
+ * into jumps by the code generator. */
+
+void tailcall_replace(icfunc_t *func, iclistnode_t *call, int entry_label)
+{
+    iclist_t *body = &func->body;
+    int n_params = 0;
+    for (iclistnode_t *cur = body->front->next; cur->ic->kind == IC_PARAM;
+         cur = cur->next)
+        n_params++;
+
+    operand_t *temps = malloc((n_params ? n_params : 1) * sizeof(operand_t));
+    assert(temps);
+    iclistnode_t *arg = call->prev;
+    for (int i = 0; i < n_params; ++i, arg = arg->prev) {
+        assert(arg->ic->kind == IC_ARG);
+        init_temp_var(&temps[i]);
+        iclist_insert_before(body, call,
+                             create_ic_assign(&temps[i], &((ic_arg_t *)arg->ic)->arg));
+    }
+    for (int i = 0; i < n_params; ++i)
+        iclist_remove(body, arg->next);
+    iclistnode_t *param = body->front->next;
+    for (int i = 0; i < n_params; ++i, param = param->next)
+        iclist_insert_before(body, call,
+                             create_ic_assign(&((ic_param_t *)param->ic)->var,
+                                              &temps[i]));
+    free(temps);
+
+    iclist_remove(body, call->next);
+    iclist_replace(call, create_ic_goto(entry_label));
+}
+
+int optim_tailcall(icfunc_t *func)
+{
+    iclist_t *body = &func->body;
+    for (iclistnode_t *cur = body->front; cur != NULL; cur = cur->next)
+        if (cur->ic->kind == IC_REF)
+            return 0;
+
+    iclistnode_t *entry = body->front->next;
+    while (entry && entry->ic->kind == IC_PARAM)
+        entry = entry->next;
+    int entry_label = 0;
+
+    for (iclistnode_t *cur = entry; cur != NULL; cur = cur->next) {
+        if (!iclist_is_tail_call(cur) ||
+            strcmp(((ic_call_t *)cur->ic)->fname, func->fname))
+            continue;
+        if (!entry_label) {
+            entry_label = alloc_labelid();
+            iclist_insert_before(body, entry, create_ic_label(entry_label));
+        }
+        tailcall_replace(func, cur, entry_label);
+    }
+    return entry_label != 0;
+}
@@ -0,0 +1,307 @@
+#include "optim.h"
+#include "loop.h"
+
+#include <stdlib.h>
+#include <limits.h>
+#include <assert.h>
+
+/* ------------------------------------ *
+ *           loop unrolling             *
+ * ------------------------------------ */
+
+/* Rotated loops whose blocks lie together and which are left only by the
+ * test at the bottom are unrolled, if the test compares a basic induction
+ * variable with an invariant. The variable must be incremented once in
+ * every iteration, so that the trip count follows from its value on
+ * entry.
+ *
+ * If the trip count is a small constant, the loop is replaced by copies
+ * of its body. Otherwise the body is copied several times into a new
+ * loop, which runs while enough iterations are left, and the original
+ * loop runs the remainder:
+ *
+ *     LABEL entry; IF bound - (factor - 1) * step overflows GOTO head;
+ *     bound' := bound - (factor - 1) * step
+ *     LABEL top; IF i !relop bound' GOTO head;
+ *     body; ... body; IF i relop bound GOTO top; GOTO exit;
+ *     LABEL head; body; IF i relop bound GOTO head;
+ *     LABEL exit
+ *
+ * The number of copies is limited by the unroll factor and by a budget of
+ * intercodes added to the loop. */
+
+#define UNROLL_DEFAULT_FACTOR   4
+#define UNROLL_BUDGET           48
+#define UNROLL_FULL_BUDGET      64
+#define UNROLL_MAX_LOOKBACK     8
+
+static int unroll_factor = UNROLL_DEFAULT_FACTOR;
+
+static struct {
+    cfg_t *cfg;
+    loop_t *loop;
+    block_t *latch;
+    operand_t iv;       /* the induction variable tested */
+    int step;
+    int relop;          /* the loop goes on while 'iv relop bound' */
+    operand_t bound;
+    int size;           /* intercodes of the loop except labels */
+} unroll;
+
+void optim_set_unroll_factor(int factor)
+{
+    assert(factor >= 1);
+    unroll_factor = factor;
+}
+
+int swap_rel_icop(int icop)
+{
+    switch (icop) {
+    case ICOP_L:  return ICOP_G;
+    case ICOP_LE: return ICOP_GE;
+    case ICOP_G:  return ICOP_L;
+    case ICOP_GE: return ICOP_LE;
+    default:      return icop;
+    }
+}
+
+int unroll_defs_in_loop(operand_t *var, iclistnode_t **def_node, block_t **def_block)
+{
+    loop_t *loop = unroll.loop;
+    int n_defs = 0;
+    for (int i = 0; i < loop->n_blocks; ++i) {
+        block_foreach(node, loop->blocks[i]) {
+            operand_t *def = intercode_def(node->ic);
+            if (def && operand_is_equal(def, var)) {
+                *def_node = node;
+                *def_block = loop->blocks[i];
+                n_defs++;
+            }
+        }
+    }
+    return n_defs;
+}
+
+/* Check the shape of the loop and find its test. */
+int unroll_analyse(loopnest_t *nest)
+{
+    cfg_t *cfg = unroll.cfg;
+    loop_t *loop = unroll.loop;
+    block_t *header = loop->header;
+    if (loop->n_latches != 1 || header->first->ic->kind != IC_LABEL)
+        return 0;
+    block_t *latch = unroll.latch = loop->latches[0];
+    if (latch->last->ic->kind != IC_CONDGOTO || latch->jump != header ||
+        !latch->fall || loop_contains(loop, latch->fall))
+        return 0;
+    if (latch->id - header->id + 1 != loop->n_blocks)
+        return 0;
+
+    unroll.size = 0;
+    for (int i = header->id; i <= latch->id; ++i) {
+        block_t *block = cfg->blocks[i];
+        if (!loop_contains(loop, block) ||
+            (block != latch && loop_is_exiting(loop, block)))
+            return 0;
+        block_foreach(node, block)
+            if (node->ic->kind != IC_LABEL)
+                unroll.size++;
+    }
+
+    ic_condgoto_t *test = (ic_condgoto_t *)latch->last->ic;
+    operand_t *sides[2] = { &test->lhs, &test->rhs };
+    for (int i = 0; i < 2; ++i) {
+        operand_t *iv = sides[i], *bound = sides[1 - i];
+        iclistnode_t *def_node, *node;
+        block_t *def_block, *block;
+        if (is_const_operand(iv) || iv->kind != OPERAND_VAR ||
+            unroll_defs_in_loop(iv, &def_node, &def_block) != 1)
+            continue;
+        if (!is_const_operand(bound) &&
+            unroll_defs_in_loop(bound, &node, &block) != 0)
+            continue;
+        int step = loop_iv_step(def_node->ic, iv);
+        if (step == 0 || !idoms_dominate(nest->idoms, def_block->id, latch->id))
+            continue;
+        unroll.iv = *iv;
+        unroll.step = step;
+        unroll.bound = *bound;
+        unroll.relop = (i == 0 ? test->relop : swap_rel_icop(test->relop));
+        return 1;
+    }
+    return 0;
+}
+
+/* Find the constant value of the induction variable on entry. */
+int unroll_initial_value(int *value)
+{
+    block_t *header = unroll.loop->header, *block = NULL;
+    for (int i = 0; i < header->n_preds; ++i) {
+        if (loop_contains(unroll.loop, header->preds[i]))
+            continue;
+        if (block)
+            return 0;
+        block = header->preds[i];
+    }
+
+    for (int k = 0; block && k < UNROLL_MAX_LOOKBACK; ++k) {
+        for (iclistnode_t *node = block->last; node != block->first->prev;
+             node = node->prev) {
+            operand_t *def = intercode_def(node->ic);
+            if (!def || !operand_is_equal(def, &unroll.iv))
+                continue;
+            ic_assign_t *assign = (ic_assign_t *)node->ic;
+            if (assign->kind != IC_ASSIGN || !is_const_operand(&assign->rhs))
+                return 0;
+            *value = assign->rhs.val;
+            return 1;
+        }
+        block = (block->n_preds == 1 ? block->preds[0] : NULL);
+    }
+    return 0;
+}
+
+/* Return the trip count of the loop, or 0 if it is unknown or too big. */
+int unroll_trip_count(int max_trips)
+{
+    int initial;
+    if (!is_const_operand(&unroll.bound) || !unroll_initial_value(&initial))
+        return 0;
+
+    /* The count is unknown once the value leaves the range of int. */
+    long long value = initial;
+    for (int trips = 1; trips <= max_trips; ++trips) {
+        value += unroll.step;
+        if (value < INT_MIN || value > INT_MAX)
+            return 0;
+        if (!eval_rel_icop(unroll.relop, value, unroll.bound.val))
+            return trips;
+    }
+    return 0;
+}
+
+/* Insert a copy of the loop before the position and return the copy of
+ * its test. */
+iclistnode_t *unroll_copy_body(iclistnode_t *pos)
+{
+    iclist_copy_range(&unroll.cfg->func->body, pos,
+                      unroll.loop->header->first, unroll.latch->last);
+    assert(pos->prev->ic->kind == IC_CONDGOTO);
+    return pos->prev;
+}
+
+void unroll_fully(int trips)
+{
+    iclist_t *body = &unroll.cfg->func->body;
+    iclistnode_t *pos = unroll.latch->last->next;
+    for (int i = 0; i < trips; ++i)
+        iclist_remove(body, unroll_copy_body(pos));
+
+    /* The labels of the header stay for the jumps from outside. */
+    iclistnode_t *cur = unroll.loop->header->first;
+    while (cur->ic->kind == IC_LABEL)
+        cur = cur->next;
+    iclistnode_t *end = unroll.latch->last->next;
+    while (cur != end)
+        cur = iclist_remove(body, cur);
+}
+
+void unroll_partially(int factor)
+{
+    iclist_t *body = &unroll.cfg->func->body;
+    block_t *header = unroll.loop->header;
+    iclistnode_t *pos = header->first;
+    int header_label = ((ic_label_t *)header->first->ic)->labelid;
+
+    iclistnode_t *after = unroll.latch->last->next;
+    int exit_label;
+    if (after->ic->kind == IC_LABEL) {
+        exit_label = ((ic_label_t *)after->ic)->labelid;
+    } else {
+        exit_label = alloc_labelid();
+        iclist_insert_before(body, after, create_ic_label(exit_label));
+    }
+
+    int entry_label = alloc_labelid();
+    iclist_insert_before(body, pos, create_ic_label(entry_label));
+    operand_t bound, delta;
+    int shift = (factor - 1) * unroll.step;
+    if (is_const_operand(&unroll.bound)) {
+        init_const_operand(&bound, unroll.bound.val - shift);
+    } else {
+        /* If the subtraction would overflow, fewer iterations than the
+         * factor are left, which the original loop runs. */
+        operand_t limit;
+        init_const_operand(&limit, shift > 0 ? INT_MIN + shift : INT_MAX + shift);
+        iclist_insert_before(body, pos,
+                             create_ic_condgoto(shift > 0 ? ICOP_L : ICOP_G,
+                                                &unroll.bound, &limit, header_label));
+        init_temp_var(&bound);
+        init_const_operand(&delta, shift);
+        iclist_insert_before(body, pos,
+                             create_ic_arithbop(ICOP_SUB, &bound, &unroll.bound, &delta));
+    }
+    int top_label = alloc_labelid();
+    iclist_insert_before(body, pos, create_ic_label(top_label));
+
+    /* Jumps from outside enter the new loop as well. */
+    for (int i = 0; i < header->n_preds; ++i) {
+        block_t *pred = header->preds[i];
+        if (loop_contains(unroll.loop, pred) || pred->jump != header)
+            continue;
+        int *target = block_jump_labelid(pred);
+        assert(target && *target == header_label);
+        *target = entry_label;
+    }
+    iclist_insert_before(body, pos,
+                         create_ic_condgoto(complement_rel_icop(unroll.relop),
+                                            &unroll.iv, &bound, header_label));
+
+    for (int i = 0; i < factor; ++i) {
+        iclistnode_t *test = unroll_copy_body(pos);
+        if (i < factor - 1)
+            iclist_remove(body, test);
+        else
+            ((ic_condgoto_t *)test->ic)->labelid = top_label;
+    }
+    iclist_insert_before(body, pos, create_ic_goto(exit_label));
+}
+
+int unroll_loop(loopnest_t *nest, loop_t *loop)
+{
+    unroll.cfg = nest->cfg;
+    unroll.loop = loop;
+    if (!unroll_analyse(nest))
+        return 0;
+
+    int trips = unroll_trip_count(UNROLL_FULL_BUDGET / unroll.size);
+    if (trips > 0) {
+        unroll_fully(trips);
+        return 1;
+    }
+
+    /* The remainder needs the test to be monotonic. */
+    int relop = unroll.relop;
+    if (!(unroll.step > 0 && (relop == ICOP_L || relop == ICOP_LE)) &&
+        !(unroll.step < 0 && (relop == ICOP_G || relop == ICOP_GE)))
+        return 0;
+    int factor = UNROLL_BUDGET / unroll.size;
+    if (factor > unroll_factor)
+        factor = unroll_factor;
+    if (factor < 2)
+        return 0;
+    /* A constant bound of the new loop must not overflow either. */
+    long long shift = (long long)(factor - 1) * unroll.step;
+    if (shift < INT_MIN || shift > INT_MAX)
+        return 0;
+    if (is_const_operand(&unroll.bound) &&
+        (unroll.bound.val - shift < INT_MIN || unroll.bound.val - shift > INT_MAX))
+        return 0;
+    unroll_partially(factor);
+    return 1;
+}
+
+int optim_unroll(icfunc_t *func)
+{
+    return loop_transform_each(func, unroll_loop);
+}
@@ -0,0 +1,136 @@
+#include "optim.h"
+#include "loop.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+/* ------------------------------------ *
+ *           loop unswitching           *
+ * ------------------------------------ */
+
+/* A branch inside a loop on operands not defined in the loop goes the
+ * same way in every iteration. The loop is then copied to the end of the
+ * function, and the test is made once before entering it, to choose the
+ * original loop, where the branch never jumps, or the copy, where it
+ * always does. The loop should lie in one piece from its header, which
+ * rotated loops do. Copies are limited by the size of the loop and by a
+ * budget of intercodes added to the function. */
+
+#define UNSWITCH_MAX_SIZE       40
+#define UNSWITCH_FUNC_BUDGET    120
+
+static struct {
+    cfg_t *cfg;
+    loop_t *loop;
+    int budget;
+} unswitch;
+
+int unswitch_is_invariant(operand_t *op)
+{
+    if (is_const_operand(op))
+        return 1;
+    loop_t *loop = unswitch.loop;
+    for (int i = 0; i < loop->n_blocks; ++i) {
+        block_foreach(node, loop->blocks[i]) {
+            operand_t *def = intercode_def(node->ic);
+            if (def && operand_is_equal(def, op))
+                return 0;
+        }
+    }
+    return 1;
+}
+
+/* Return the size of the loop if it is in one piece, otherwise 0. */
+int unswitch_loop_size()
+{
+    cfg_t *cfg = unswitch.cfg;
+    loop_t *loop = unswitch.loop;
+    int first = loop->header->id, size = 0;
+    if (first + loop->n_blocks > cfg->n_blocks)
+        return 0;
+    for (int i = first; i < first + loop->n_blocks; ++i) {
+        block_t *block = cfg->blocks[i];
+        if (!loop_contains(loop, block))
+            return 0;
+        block_foreach(node, block)
+            if (node->ic->kind != IC_LABEL)
+                size++;
+    }
+    return size;
+}
+
+/* Find a branch on invariant operands which stays in the loop. */
+iclistnode_t *unswitch_find_branch()
+{
+    loop_t *loop = unswitch.loop;
+    for (int i = 0; i < loop->n_blocks; ++i) {
+        block_t *block = loop->blocks[i];
+        ic_condgoto_t *cond = (ic_condgoto_t *)block->last->ic;
+        if (cond->kind != IC_CONDGOTO || loop_is_exiting(loop, block))
+            continue;
+        if (is_const_operand(&cond->lhs) && is_const_operand(&cond->rhs))
+            continue;
+        if (unswitch_is_invariant(&cond->lhs) && unswitch_is_invariant(&cond->rhs))
+            return block->last;
+    }
+    return NULL;
+}
+
+int unswitch_loop(loopnest_t *nest, loop_t *loop)
+{
+    cfg_t *cfg = nest->cfg;
+    iclist_t *body = &cfg->func->body;
+    unswitch.cfg = cfg;
+    unswitch.loop = loop;
+
+    int size = unswitch_loop_size();
+    if (size == 0 || size > UNSWITCH_MAX_SIZE || size > unswitch.budget ||
+        loop->header->first->ic->kind != IC_LABEL)
+        return 0;
+    iclistnode_t *branch = unswitch_find_branch();
+    block_t *last = cfg->blocks[loop->header->id + loop->n_blocks - 1];
+    iclistnode_t *after = last->last->next;
+    if (!branch || !after || !intercode_is_jump(body->back->ic))
+        return 0;
+    iclistnode_t *pos = loop_insert_preheader(nest, loop);
+    if (!pos)
+        return 0;
+    unswitch.budget -= size;
+
+    /* The code after the loop gets a label for the copy to go back. */
+    int after_label;
+    if (after->ic->kind == IC_LABEL) {
+        after_label = ((ic_label_t *)after->ic)->labelid;
+    } else {
+        after_label = alloc_labelid();
+        iclist_insert_before(body, after, create_ic_label(after_label));
+    }
+
+    /* The copy goes to the end, where nothing falls into it. */
+    iclistnode_t *first = loop->header->first;
+    int offset = 0;
+    for (iclistnode_t *cur = first; cur != branch; cur = cur->next)
+        offset++;
+    iclist_push_back(body, create_ic_goto(after_label));
+    iclistnode_t *end = body->back;
+    iclistnode_t *copy = iclist_copy_range(body, end, first, last->last);
+    int copy_label = ((ic_label_t *)copy->ic)->labelid;
+    iclistnode_t *copy_branch = copy;
+    for (int i = 0; i < offset; ++i)
+        copy_branch = copy_branch->next;
+
+    ic_condgoto_t *cond = (ic_condgoto_t *)branch->ic;
+    iclist_insert_before(body, pos,
+                         create_ic_condgoto(cond->relop, &cond->lhs, &cond->rhs,
+                                            copy_label));
+    iclist_replace(copy_branch,
+                   create_ic_goto(((ic_condgoto_t *)copy_branch->ic)->labelid));
+    iclist_remove(body, branch);
+    return 1;
+}
+
+int optim_unswitch(icfunc_t *func)
+{
+    unswitch.budget = UNSWITCH_FUNC_BUDGET;
+    return loop_transform_each(func, unswitch_loop);
+}
@@ -0,0 +1,485 @@
+#include "optim.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+/* ------------------------------------ *
+ *              program                 *
+ * ------------------------------------ */
+
+icfunc_t *create_icfunc(const char *fname)
+{
+    icfunc_t *func = malloc(sizeof(icfunc_t));
+    assert(func);
+    func->fname = fname;
+    init_iclist(&func->body);
+    return func;
+}
+
+void init_icprog(icprog_t *prog)
+{
+    prog->size = 0;
+    prog->capacity = 0;
+    prog->funcs = NULL;
+}
+
+void icprog_push_back(icprog_t *prog, icfunc_t *func)
+{
+    if (prog->size == prog->capacity) {
+        prog->capacity = (prog->capacity ? 2 * prog->capacity : 8);
+        prog->funcs = realloc(prog->funcs, prog->capacity * sizeof(icfunc_t *));
+        assert(prog->funcs);
+    }
+    prog->funcs[prog->size++] = func;
+}
+
+void icprog_split(icprog_t *prog, iclist_t *iclist)
+{
+    init_icprog(prog);
+    while (iclist->size > 0) {
+        iclistnode_t *front = iclist->front;
+        assert(front->ic->kind == IC_FUNCDEF);
+
+        iclistnode_t *last = front;
+        while (last->next && last->next->ic->kind != IC_FUNCDEF)
+            last = last->next;
+
+        icfunc_t *func = create_icfunc(((ic_funcdef_t *)front->ic)->fname);
+        iclist_split_front(iclist, last, &func->body);
+        icprog_push_back(prog, func);
+    }
+}
+
+void icprog_join(icprog_t *prog, iclist_t *iclist)
+{
+    for (int i = 0; i < prog->size; ++i) {
+        iclist_splice_back(iclist, &prog->funcs[i]->body);
+        free(prog->funcs[i]);
+    }
+    free(prog->funcs);
+    init_icprog(prog);
+}
+
+icfunc_t *icprog_find_func(icprog_t *prog, const char *fname)
+{
+    for (int i = 0; i < prog->size; ++i)
+        if (!strcmp(prog->funcs[i]->fname, fname))
+            return prog->funcs[i];
+    return NULL;
+}
+
+icfunc_t *icprog_add_func(icprog_t *prog, const char *fname)
+{
+    icfunc_t *func = create_icfunc(fname);
+    iclist_push_back(&func->body, create_ic_funcdef(fname));
+    icprog_push_back(prog, func);
+    return func;
+}
+
+void icprog_remove_func(icprog_t *prog, int index)
+{
+    assert(index >= 0 && index < prog->size);
+    icfunc_t *func = prog->funcs[index];
+    while (func->body.size > 0)
+        iclist_remove(&func->body, func->body.front);
+    free(func);
+    for (int i = index + 1; i < prog->size; ++i)
+        prog->funcs[i - 1] = prog->funcs[i];
+    prog->size--;
+}
+
+int icprog_count_intercodes(icprog_t *prog)
+{
+    int count = 0;
+    for (int i = 0; i < prog->size; ++i)
+        count += prog->funcs[i]->body.size;
+    return count;
+}
+
+/* ------------------------------------ *
+ *               passes                 *
+ * ------------------------------------ */
+
+typedef struct optim_pass {
+    const char *name;
+    const char *desc;
+    /* Exactly one of them is provided. They return whether the IR changed. */
+    int (*run_on_func)(icfunc_t *func);
+    int (*run_on_prog)(icprog_t *prog);
+} optim_pass_t;
+
+int run_verify(icprog_t *prog);
+int run_print(icfunc_t *func);
+
+static const optim_pass_t passes[] = {
+    { "verify", "check the well-formedness of the IR", NULL, run_verify },
+    { "print", "print the IR to stderr", run_print, NULL },
+    { "tailcall", "turn tail recursion into jumps", optim_tailcall, NULL },
+    { "ipcp", "propagate constant arguments and returns across calls",
+      NULL, optim_ipcp },
+    { "deadarg", "remove parameters whose values are never used",
+      NULL, optim_deadarg },
+    { "deadfunc", "remove functions not reachable from main",
+      NULL, optim_deadfunc },
+    { "clone", "specialize functions for constant arguments", NULL, optim_clone },
+    { "inline", "inline calls to small functions", NULL, optim_inline },
+    { "sccp", "sparse conditional constant propagation", optim_sccp, NULL },
+    { "copyprop", "global copy propagation and coalescing", optim_copyprop, NULL },
+    { "lvn", "local value numbering", optim_lvn, NULL },
+    { "pre", "partial redundancy elimination by lazy code motion",
+      optim_pre, NULL },
+    { "rotate", "rotate loops to test their conditions at the bottom",
+      optim_rotate, NULL },
+    { "licm", "loop-invariant code motion", optim_licm, NULL },
+    { "unswitch", "move invariant branches out of loops", optim_unswitch, NULL },
+    { "unroll", "unroll counted loops", optim_unroll, NULL },
+    { "ivsr", "induction variable strength reduction", optim_ivsr, NULL },
+    { "dce", "mark-and-sweep dead code elimination", optim_dce, NULL },
+    { "simplifycfg", "remove unreachable code, redundant jumps and labels",
+      optim_simplify_cfg, NULL },
+};
+
+#define N_PASSES    ((int)(sizeof(passes) / sizeof(passes[0])))
+
+/* The pipelines of each optimization level, in the format of '--passes'. */
+static const char *level_pipelines[OPTIM_MAX_LEVEL + 1] = {
+    /* -O0 */ "",
+    /* -O1 */ "sccp,lvn,copyprop,dce",
+    /* -O2 */ "sccp,lvn,copyprop,dce,tailcall,ipcp,deadarg,sccp,dce,inline,"
+              "deadfunc,simplifycfg,sccp,lvn,copyprop,pre,rotate,licm,ivsr,"
+              "copyprop,dce",
+    /* -O3 */ "sccp,lvn,copyprop,dce,tailcall,ipcp,deadarg,clone,sccp,dce,inline,"
+              "deadfunc,simplifycfg,sccp,lvn,copyprop,pre,rotate,unswitch,unroll,"
+              "simplifycfg,sccp,lvn,copyprop,licm,ivsr,copyprop,dce",
+};
+
+const optim_pass_t *find_pass(const char *name)
+{
+    for (int i = 0; i < N_PASSES; ++i)
+        if (!strcmp(passes[i].name, name))
+            return &passes[i];
+    return NULL;
+}
+
+void optim_print_passes(FILE *fp)
+{
+    for (int i = 0; i < N_PASSES; ++i)
+        fprintf(fp, "  %-16s %s\n", passes[i].name, passes[i].desc);
+}
+
+/* ------------------------------------ *
+ *             pass manager             *
+ * ------------------------------------ */
+
+#define MAX_PIPELINE_SIZE   64
+
+static struct {
+    int level;
+    int size;
+    const optim_pass_t *passes[MAX_PIPELINE_SIZE];
+    int stats;
+    int verify;
+} pipeline;
+
+/* Statistics are gathered per pass even if it runs several times. */
+static struct {
+    int runs;
+    int changes;
+    double seconds;
+    int delta;
+} pass_stats[N_PASSES];
+
+int parse_pipeline(const char *passes)
+{
+    char *buf = malloc(strlen(passes) + 1);
+    assert(buf);
+    strcpy(buf, passes);
+
+    int ret = 0;
+    pipeline.size = 0;
+    for (char *name = strtok(buf, ","); name; name = strtok(NULL, ",")) {
+        const optim_pass_t *pass = find_pass(name);
+        if (!pass) {
+            fprintf(stderr, "Unknown pass '%s'.\n", name);
+            ret = -1;
+            break;
+        }
+        if (pipeline.size == MAX_PIPELINE_SIZE) {
+            fprintf(stderr, "Too many passes in the pipeline.\n");
+            ret = -1;
+            break;
+        }
+        pipeline.passes[pipeline.size++] = pass;
+    }
+    free(buf);
+    return ret;
+}
+
+void optim_set_level(int level)
+{
+    assert(level >= 0 && level <= OPTIM_MAX_LEVEL);
+    pipeline.level = level;
+    int ret = parse_pipeline(level_pipelines[level]);
+    assert(ret == 0);
+}
+
+int optim_get_level()
+{
+    return pipeline.level;
+}
+
+int optim_set_passes(const char *passes)
+{
+    return parse_pipeline(passes);
+}
+
+void optim_enable_stats()
+{
+    pipeline.stats = 1;
+}
+
+int optim_stats_enabled()
+{
+    return pipeline.stats;
+}
+
+void optim_enable_verify()
+{
+    pipeline.verify = 1;
+}
+
+void fprint_pass_stats(FILE *fp)
+{
+    fprintf(fp, "%-16s %6s %8s %10s %10s\n",
+            "pass", "runs", "changes", "time(ms)", "delta");
+    for (int i = 0; i < N_PASSES; ++i) {
+        if (pass_stats[i].runs == 0)
+            continue;
+        fprintf(fp, "%-16s %6d %8d %10.3f %+10d\n", passes[i].name,
+                pass_stats[i].runs, pass_stats[i].changes,
+                pass_stats[i].seconds * 1000, pass_stats[i].delta);
+    }
+}
+
+void run_pass(const optim_pass_t *pass, icprog_t *prog)
+{
+    int before = icprog_count_intercodes(prog);
+    clock_t start = clock();
+
+    int changes = 0;
+    if (pass->run_on_prog) {
+        changes += (pass->run_on_prog(prog) ? 1 : 0);
+    }
+    else {
+        for (int i = 0; i < prog->size; ++i)
+            changes += (pass->run_on_func(prog->funcs[i]) ? 1 : 0);
+    }
+
+    int id = pass - passes;
+    pass_stats[id].runs++;
+    pass_stats[id].changes += changes;
+    pass_stats[id].seconds += (double)(clock() - start) / CLOCKS_PER_SEC;
+    pass_stats[id].delta += icprog_count_intercodes(prog) - before;
+}
+
+void verify_icprog(icprog_t *prog, const char *when);
+
+void optimize_intercodes(iclist_t *iclist)
+{
+    icprog_t prog;
+    icprog_split(&prog, iclist);
+
+    if (pipeline.verify)
+        verify_icprog(&prog, "before optimization");
+    for (int i = 0; i < pipeline.size; ++i) {
+        run_pass(pipeline.passes[i], &prog);
+        if (pipeline.verify)
+            verify_icprog(&prog, pipeline.passes[i]->name);
+    }
+    if (pipeline.stats) {
+        fprintf(stderr, "intercodes: %d\n", icprog_count_intercodes(&prog));
+        fprint_pass_stats(stderr);
+    }
+
+    icprog_join(&prog, iclist);
+}
+
+/* ------------------------------------ *
+ *             IR verifier              *
+ * ------------------------------------ */
+
+static struct {
+    icfunc_t *func;
+    const char *when;
+} verifier;
+
+void verify_error(iclistnode_t *node, const char *msg)
+{
+    fprintf(stderr, "IR verification failed after %s in function %s: %s\n",
+            verifier.when, verifier.func->fname, msg);
+    if (node) {
+        fprintf(stderr, "  at: ");
+        fprint_intercode(stderr, node->ic);
+        fprintf(stderr, "\n");
+    }
+    exit(1);
+}
+
+void verify_operand(iclistnode_t *node, operand_t *op)
+{
+    if (op->kind == OPERAND_NONE)
+        verify_error(node, "missing operand");
+    if (op->kind == OPERAND_VAR || op->kind == OPERAND_ADDR) {
+        if (op->varid <= 0 || op->varid >= varid_bound())
+            verify_error(node, "invalid varid");
+    }
+}
+
+void verify_labelid(iclistnode_t *node, int labelid)
+{
+    if (labelid <= 0 || labelid >= labelid_bound())
+        verify_error(node, "invalid labelid");
+}
+
+void verify_icfunc(icfunc_t *func, const char *when)
+{
+    verifier.func = func;
+    verifier.when = when;
+
+    iclist_t *body = &func->body;
+    if (!body->front || body->front->ic->kind != IC_FUNCDEF ||
+        strcmp(((ic_funcdef_t *)body->front->ic)->fname, func->fname))
+        verify_error(body->front, "function does not begin with its FUNCTION");
+
+    /* Check the links of the list. */
+    int size = 0;
+    iclistnode_t *prev = NULL;
+    for (iclistnode_t *cur = body->front; cur != NULL; cur = cur->next) {
+        if (cur->prev != prev)
+            verify_error(cur, "broken link in the intercode list");
+        prev = cur;
+        size++;
+    }
+    if (prev != body->back || size != body->size)
+        verify_error(NULL, "inconsistent size or back of the intercode list");
+
+    char *label_defined = calloc(labelid_bound(), sizeof(char));
+    char *var_declared = calloc(varid_bound(), sizeof(char));
+    assert(label_defined && var_declared);
+
+    int in_params = 1;
+    for (iclistnode_t *cur = body->front->next; cur != NULL; cur = cur->next) {
+        intercode_t *ic = cur->ic;
+        if (ic->kind != IC_PARAM)
+            in_params = 0;
+
+        switch (ic->kind) {
+        case IC_FUNCDEF:
+            verify_error(cur, "nested FUNCTION");
+            break;
+        case IC_PARAM:
+            if (!in_params)
+                verify_error(cur, "PARAM is not at the beginning of function");
+            break;
+        case IC_LABEL: {
+            int labelid = ((ic_label_t *)ic)->labelid;
+            verify_labelid(cur, labelid);
+            if (label_defined[labelid])
+                verify_error(cur, "label defined more than once");
+            label_defined[labelid] = 1;
+            break;
+        }
+        case IC_DEC: {
+            operand_t *var = &((ic_dec_t *)ic)->var;
+            verify_operand(cur, var);
+            if (var->kind != OPERAND_VAR || ((ic_dec_t *)ic)->size <= 0)
+                verify_error(cur, "invalid DEC");
+            var_declared[var->varid] = 1;
+            break;
+        }
+        case IC_ARG:
+            if (!cur->next || (cur->next->ic->kind != IC_ARG &&
+                               cur->next->ic->kind != IC_CALL))
+                verify_error(cur, "ARG is not followed by ARG or CALL");
+            break;
+        default:
+            break;
+        }
+
+        operand_t *def = intercode_def(ic);
+        if (def) {
+            verify_operand(cur, def);
+            if (is_const_operand(def))
+                verify_error(cur, "constant is assigned");
+        }
+        operand_t *uses[2];
+        int n_uses = intercode_uses(ic, uses);
+        for (int i = 0; i < n_uses; ++i)
+            verify_operand(cur, uses[i]);
+    }
+
+    /* Check jump targets and referred arrays after all labels and
+     * declarations are known. */
+    for (iclistnode_t *cur = body->front; cur != NULL; cur = cur->next) {
+        intercode_t *ic = cur->ic;
+        int labelid = 0;
+        if (ic->kind == IC_GOTO)
+            labelid = ((ic_goto_t *)ic)->labelid;
+        else if (ic->kind == IC_CONDGOTO)
+            labelid = ((ic_condgoto_t *)ic)->labelid;
+        if (labelid) {
+            verify_labelid(cur, labelid);
+            if (!label_defined[labelid])
+                verify_error(cur, "jump to an undefined label");
+        }
+        if (ic->kind == IC_REF) {
+            operand_t *rhs = &((ic_ref_t *)ic)->rhs;
+            verify_operand(cur, rhs);
+            if (rhs->kind != OPERAND_VAR || !var_declared[rhs->varid])
+                verify_error(cur, "taking address of an undeclared variable");
+        }
+    }
+
+    free(label_defined);
+    free(var_declared);
+}
+
+void verify_icprog(icprog_t *prog, const char *when)
+{
+    /* Labels are emitted as global symbols, so they must be unique
+     * across functions as well. */
+    char *label_owner = calloc(labelid_bound(), sizeof(char));
+    assert(label_owner);
+
+    for (int i = 0; i < prog->size; ++i) {
+        icfunc_t *func = prog->funcs[i];
+        verify_icfunc(func, when);
+        for (int j = 0; j < i; ++j)
+            if (!strcmp(prog->funcs[j]->fname, func->fname))
+                verify_error(func->body.front, "function defined more than once");
+        for (iclistnode_t *cur = func->body.front; cur != NULL; cur = cur->next) {
+            if (cur->ic->kind != IC_LABEL)
+                continue;
+            int labelid = ((ic_label_t *)cur->ic)->labelid;
+            if (label_owner[labelid])
+                verify_error(cur, "label defined in another function");
+            label_owner[labelid] = 1;
+        }
+    }
+
+    free(label_owner);
+}
+
+int run_verify(icprog_t *prog)
+{
+    verify_icprog(prog, "verify pass");
+    return 0;
+}
+
+int run_print(icfunc_t *func)
+{
+    fprint_iclist(stderr, &func->body);
+    return 0;
+}
@@ -0,0 +1,90 @@
+#ifndef _OPTIM_H
+#define _OPTIM_H
+
+#include "intercode.h"
+
+#include <stdio.h>
+
+/* ------------------------------------ *
+ *              program                 *
+ * ------------------------------------ */
+
+/* The intercodes of a function. The body begins with its IC_FUNCDEF. */
+typedef struct icfunc {
+    const char *fname;
+    iclist_t body;
+} icfunc_t;
+
+typedef struct icprog {
+    int size;
+    int capacity;
+    icfunc_t **funcs;
+} icprog_t;
+
+/* Move the intercodes in 'iclist' into functions of 'prog', or back. */
+void icprog_split(icprog_t *prog, iclist_t *iclist);
+void icprog_join(icprog_t *prog, iclist_t *iclist);
+
+icfunc_t *icprog_find_func(icprog_t *prog, const char *fname);
+/* Append a function with nothing but its IC_FUNCDEF in the body. */
+icfunc_t *icprog_add_func(icprog_t *prog, const char *fname);
+/* Destroy the function at 'index', keeping the order of the others. */
+void icprog_remove_func(icprog_t *prog, int index);
+int icprog_count_intercodes(icprog_t *prog);
+
+/* ------------------------------------ *
+ *             pass manager             *
+ * ------------------------------------ */
+
+#define OPTIM_MAX_LEVEL 3
+
+/* Choose the pipeline run by 'optimize_intercodes'. Either '-O<level>'
+ * or an explicit comma-separated list of pass names can be given.
+ * 'optim_set_passes' returns -1 if the list contains an unknown pass. */
+void optim_set_level(int level);
+int optim_get_level();
+int optim_set_passes(const char *passes);
+void optim_print_passes(FILE *fp);
+
+/* Report the time and the change of intercode counts of every pass. */
+void optim_enable_stats();
+int optim_stats_enabled();
+/* Run the IR verifier after every pass. */
+void optim_enable_verify();
+
+/* Run the chosen pipeline on the intercodes of the whole program. */
+void optimize_intercodes(iclist_t *iclist);
+
+/* Check the well-formedness of a function and abort if it is broken.
+ * 'when' describes the moment of checking in the error message. */
+void verify_icfunc(icfunc_t *func, const char *when);
+
+/* ------------------------------------ *
+ *               passes                 *
+ * ------------------------------------ */
+
+/* Every pass returns whether it changed the intercodes. */
+int optim_tailcall(icfunc_t *func);
+int optim_ipcp(icprog_t *prog);
+int optim_deadarg(icprog_t *prog);
+int optim_deadfunc(icprog_t *prog);
+int optim_clone(icprog_t *prog);
+int optim_inline(icprog_t *prog);
+/* Set the largest cost of a callee inlined by 'optim_inline'. */
+void optim_set_inline_threshold(int threshold);
+int optim_sccp(icfunc_t *func);
+int optim_copyprop(icfunc_t *func);
+int optim_lvn(icfunc_t *func);
+int optim_pre(icfunc_t *func);
+int optim_rotate(icfunc_t *func);
+int optim_licm(icfunc_t *func);
+int optim_unswitch(icfunc_t *func);
+int optim_unroll(icfunc_t *func);
+/* Set the largest number of copies of a loop body made by 'optim_unroll'
+ * when its trip count is unknown. */
+void optim_set_unroll_factor(int factor);
+int optim_ivsr(icfunc_t *func);
+int optim_dce(icfunc_t *func);
+int optim_simplify_cfg(icfunc_t *func);
+
+#endif
@@ -2,8 +2,10 @@
 #include "syntaxtree.h"
 #include "semantics.h"
 #include "intercodes.h"
+#include "optim.h"
 #include "mips.h"
 extern FILE *fout;
+extern int output_ir;
 
 #define YYSTYPE treenode_t *
 
@@ -65,7 +67,11 @@ Program: ExtDefList {
             if (!has_semantic_error()) {
                 intercodes_translate($$);
                 if (!has_translate_error()) {
-                    gen_mips(fout);
+                    optimize_intercodes(get_intercodes());
+                    if (output_ir)
+                        fprint_intercodes(fout);
+                    else
+                        gen_mips(fout);
                 }
             }
         }